@@ -0,0 +1,159 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdio.h>
+
+// Hardware access goes through the HAL, which includes the generated headers
+#include "hal.h"
+
+#include "app.h"
+#include "globals.h"
+#include "usb_utils.h"
+#include "switch.h"
+#include "timebase.h"
+#include "sequence.h"
+#include "output.h"
+#include "schedule.h"
+#include "stats.h"
+#include "transition.h"
+#include "stream.h"
+#include "preset.h"
+#include "wear.h"
+
+/**
+ * Global clock output state
+ */
+volatile uint8_t CLK_OUT = 0;
+volatile uint8_t PULSE_LD = 0;
+uint8_t BINARY_MODE = 0;
+uint8_t ECHO_ON = 1;
+uint8_t STAGED = 0;
+uint8_t CHAIN_SEL = 1u;
+const char *term = "\r";
+
+// Buffers used to store current switch state of each chain
+static switches_t switch_states[NUM_CHAINS];
+// Buffer used to store USB commands
+static usb_buf_t usb_input_buffer;
+
+/**
+ * Write out a pulse on the LD line once the buffer has been cleared, and
+ * start shifting the next queued frame. While the clock is running, keep
+ * it fed instead.
+ */
+void app_spi_isr(uint8_t chain) {
+    if (chain == 0 && CLK_OUT) {
+        output_clock_isr();
+    } else if (hal_spi_done(chain) && (PULSE_LD & (1u << chain))) {
+        if (chain == 0)
+            stats_mark(STAT_MARK_SPI_DONE);
+        output_done(chain);
+    }
+}
+
+void app_init(void) {
+    for (size_t chain = 0; chain < NUM_CHAINS; chain += 1)
+        switches_all(&switch_states[chain], 0x00); // Set all closed initially
+
+    /* Empty the USB input buffer */
+    init_usb_buffer(&usb_input_buffer);
+    /* Start the cycle counter used for latency statistics */
+    stats_init();
+
+    hal_enable_interrupts(); /* Enable global interrupts. */
+
+    /* Start the SPI interface and USBFS operation */
+    hal_start(USBFS_DEVICE);
+    /* Start the timebase used to step sequences */
+    timebase_init();
+    sequence_init();
+    schedule_init();
+    transition_init();
+    stream_init();
+
+    /* Restore the power on preset, if one is stored, to every chain */
+    preset_init();
+    wear_init();
+    const uint8_t *preset = preset_power_on();
+    if (preset != NULL) {
+        CHAIN_SEL = CHAINS_ALL;
+        if (write_frame(preset) == USB_SUCCESS) {
+            for (size_t chain = 0; chain < NUM_CHAINS; chain += 1)
+                switches_unpack(&switch_states[chain], preset);
+        }
+        CHAIN_SEL = 1u;
+    }
+}
+
+void app_poll(void) {
+    // Check for a USB UART config change
+    // 
+    // If it has changed, reset the buffer, this is an indication
+    // that the connected has restarted
+    if (check_usb_uart_config_change() == USB_CONFIG_CHANGED) {
+        init_usb_buffer(&usb_input_buffer);
+    }
+
+    // Read in USB data
+    if (hal_usb_configured() != USB_NOT_CONFIGURED) {
+        read_usb_data(&usb_input_buffer);
+
+        // Pick up any scheduled frame, sequence step or stream frame that
+        // has gone out before parsing, so commands see the switches as
+        // they are
+        schedule_sync(&switch_states[0]);
+        sequence_sync(&switch_states[0]);
+        stream_sync(&switch_states[0]);
+
+        // Check whether there is a command terminator in the buffer
+        parse_usb_buffer(&usb_input_buffer, switch_states);
+
+        // Report on any scheduled frames that have gone out
+        write_schedule_reports();
+        // and on completed writes, if the host asked for them
+        write_events();
+        // and hand back stream credits
+        write_stream_credits();
+
+        // Send any queued responses
+        flush_usb();
+    }
+
+    // Step the sequence if it is waiting on the trigger input
+    sequence_poll();
+
+    // Checkpoint the switch wear counters, a row at a time
+    wear_poll();
+
+    // Sleep until an interrupt gives the loop something to do. The SPI
+    // and clock run from their own interrupts, USB traffic wakes the
+    // core, and the timebase tick bounds how long anything left by an
+    // interrupt (reports, events) waits to be sent.
+    uint8_t intr = hal_enter_critical();
+    if (usb_idle() && !sequence_polling())
+        hal_sleep();
+    hal_exit_critical(intr);
+}
+
+/* [] END OF FILE */
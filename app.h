@@ -0,0 +1,55 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __APP_H__
+#define __APP_H__
+
+#include <stdint.h>
+
+/**
+ * The firmware proper, as run by main() on the device and by the host
+ * simulator (host/sim) with the HAL_SIM backend, so both run the same
+ * start up order, main loop and interrupt handling.
+ */
+
+/**
+ * Bring up the hardware and every module, and restore the power on preset
+ */
+void app_init(void);
+
+/**
+ * Run one pass of the main loop: take USB data, run any complete commands,
+ * send reports and replies, then sleep until the next interrupt if there is
+ * nothing left to do
+ */
+void app_poll(void);
+
+/**
+ * SPI done handling for a chain, called from its SPIM TX ISR. Latches a
+ * finished frame and starts the next one, or keeps the fill clock fed on
+ * chain 0.
+ */
+void app_spi_isr(uint8_t chain);
+
+#endif
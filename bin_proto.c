@@ -0,0 +1,468 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "hal.h"
+#include "globals.h"
+#include "usb_utils.h"
+#include "switch.h"
+#include "bin_proto.h"
+#include "sequence.h"
+#include "output.h"
+#include "schedule.h"
+#include "timebase.h"
+#include "stats.h"
+#include "preset.h"
+#include "events.h"
+#include "transition.h"
+#include "stream.h"
+#include "wear.h"
+#include "speed.h"
+
+/**
+ * Nibble-wise lookup table for CRC-8, polynomial 0x07
+ */
+static const uint8_t crc8_table[16] = {
+	0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15,
+	0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D
+};
+
+/**
+ * Calculate the CRC-8 of a block of data
+ */
+uint8_t bin_crc8(const uint8_t *data, size_t len) {
+	uint8_t crc = 0;
+	for (size_t i = 0; i < len; i += 1) {
+		crc ^= data[i];
+		crc = (crc << 4) ^ crc8_table[crc >> 4];
+		crc = (crc << 4) ^ crc8_table[crc >> 4];
+	}
+	return crc;
+}
+
+/**
+ * Build a frame from the device to the host into out, returning its length
+ */
+static size_t bin_frame(uint8_t opcode, const uint8_t *payload, size_t len, uint8_t *out) {
+	out[0] = BIN_SYNC;
+	out[1] = opcode | BIN_REPLY;
+	out[2] = len;
+	memcpy(out + BIN_HEADER_SIZE, payload, len);
+	out[BIN_HEADER_SIZE + len] = bin_crc8(out + 1, len + 2);
+	return BIN_HEADER_SIZE + len + 1;
+}
+
+/**
+ * Send a reply frame for a given opcode
+ */
+static usb_status_t bin_reply(uint8_t opcode, usb_status_t status) {
+	uint8_t payload = (uint8_t)status;
+	uint8_t frame[BIN_HEADER_SIZE + 2];
+	return write_usb_reply(frame, bin_frame(opcode, &payload, 1, frame));
+}
+
+/**
+ * Send a frame from the device to the host
+ */
+usb_status_t bin_event(uint8_t opcode, const uint8_t *payload, size_t len) {
+	uint8_t frame[BIN_MAX_FRAME];
+	return write_usb(frame, bin_frame(opcode, payload, len, frame));
+}
+
+/**
+ * Return 1 if a header could start a frame from the host: the opcode is one
+ * the host sends, and the length is one it takes
+ */
+static uint8_t bin_header_valid(uint8_t opcode, size_t len) {
+	if (len > BIN_MAX_PAYLOAD)
+		return 0;
+	switch (opcode) {
+	case BIN_NOOP:
+	case BIN_CLEAR:
+	case BIN_LOAD:
+	case BIN_STOP:
+	case BIN_BEGIN:
+	case BIN_COMMIT:
+	case BIN_SEQ_CLEAR:
+	case BIN_SEQ_STEP:
+	case BIN_ASCII:
+		return len == 0;
+	case BIN_SELECT:
+	case BIN_CHAIN:
+	case BIN_EVENTS:
+	case BIN_SAVE:
+	case BIN_RECALL:
+	case BIN_POWERON:
+		return len == 1;
+	case BIN_WRITE:
+	case BIN_SEQ_ADD:
+		return len == SWITCHES_FRAME_SIZE;
+	case BIN_MASKS:
+		return len == NUM_SWITCHES;
+	case BIN_CLOCK:
+		return len == 0 || len == 5;
+	case BIN_DELTA:
+		return len != 0;
+	case BIN_SEQ_RUN:
+		return len == 5;
+	case BIN_SCHEDULE:
+		return len == 5 + SWITCHES_FRAME_SIZE;
+	case BIN_VERIFY:
+		return len <= 1;
+	case BIN_TRANSITION:
+		return len == 1 || len == 3;
+	case BIN_SPEED:
+		return len == 0 || len == 2;
+	case BIN_WEAR:
+		return len == 1 || len == 2;
+	case BIN_PUSH:
+		return len != 0 && len % SWITCHES_FRAME_SIZE == 0 &&
+				len <= BIN_PUSH_MAX_FRAMES * SWITCHES_FRAME_SIZE;
+	case BIN_STREAM:
+		return len <= 1 || len == 3;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Parse input buffer looking for complete frames.
+ */
+usb_status_t parse_binary_buffer(usb_buf_t *usb_input_buffer, switches_t *state) {
+	uint8_t frame[BIN_MAX_FRAME];
+
+	// Framing lets us resynchronize, so we don't need to skip a message on overflow
+	usb_input_buffer->overflow = 0;
+
+	while (BINARY_MODE && usb_buf_count(usb_input_buffer) > 0) {
+		// Leave the input until there is room for the reply
+		if (!usb_tx_room(USB_TX_PARSE_ROOM))
+			break;
+		uint16_t count = usb_buf_count(usb_input_buffer);
+		// Skip anything that isn't the start of a frame
+		if (usb_buf_peek(usb_input_buffer, 0) != BIN_SYNC) {
+			usb_input_buffer->tail += 1;
+			continue;
+		}
+		// Wait for the rest of the header
+		if (count < BIN_HEADER_SIZE)
+			break;
+		uint8_t opcode = usb_buf_peek(usb_input_buffer, 1);
+		size_t len = usb_buf_peek(usb_input_buffer, 2);
+		// A header no host would send isn't a frame, i.e. a sync byte in a
+		// payload. Resync on the next sync byte without a reply.
+		if (!bin_header_valid(opcode, len)) {
+			usb_input_buffer->tail += 1;
+			continue;
+		}
+		// Wait for the rest of the frame, but not forever, in case the
+		// header was noise that happened to look valid
+		size_t frame_len = BIN_HEADER_SIZE + len + 1;
+		if (count < frame_len) {
+			if (!usb_input_buffer->frame_waiting) {
+				usb_input_buffer->frame_waiting = 1;
+				usb_input_buffer->frame_wait_start = timebase_now();
+				break;
+			}
+			if (timebase_now() - usb_input_buffer->frame_wait_start < BIN_FRAME_TIMEOUT)
+				break;
+			usb_input_buffer->frame_waiting = 0;
+			bin_reply(opcode, USB_BAD_CRC);
+			usb_input_buffer->tail += 1;
+			continue;
+		}
+		usb_input_buffer->frame_waiting = 0;
+		// Copy the frame out of the ring and check the CRC. On failure,
+		// resync on the next sync byte
+		usb_buf_copy(usb_input_buffer, 0, frame, frame_len);
+		if (bin_crc8(frame + 1, len + 2) != frame[frame_len - 1]) {
+			bin_reply(opcode, USB_BAD_CRC);
+			usb_input_buffer->tail += 1;
+			continue;
+		}
+
+		// Execute the command
+		usb_input_buffer->tail += frame_len;
+		stats_mark(STAT_MARK_TERM);
+		usb_status_t status = do_binary_command(opcode, frame + BIN_HEADER_SIZE, len, state);
+		if (usb_tx_end() && status == USB_SUCCESS)
+			status = USB_BUF_OVERFLOW;
+		stats_status(status);
+		bin_reply(opcode, status);
+	}
+
+	// If we've left binary mode, the remainder of the buffer is ASCII
+	usb_line_reset(usb_input_buffer);
+	if (BINARY_MODE == 0)
+		return USB_MODE_CHANGED;
+	return USB_SUCCESS;
+}
+
+/**
+ * Run a binary command
+ */
+usb_status_t do_binary_command(uint8_t opcode, const uint8_t *payload, size_t len, switches_t *state) {
+	usb_status_t status;
+	uint32_t due;
+
+	switch (opcode) {
+	case BIN_NOOP:
+		break;
+	case BIN_CLEAR:
+		FOR_EACH_SELECTED_CHAIN(chain)
+			switches_all(&state[chain], 0x00);
+		return write_switches(state);
+	case BIN_WRITE:
+		if (len != SWITCHES_FRAME_SIZE)
+			return USB_INVALID_NUM_ARGS;
+		FOR_EACH_SELECTED_CHAIN(chain)
+			switches_unpack(&state[chain], payload);
+		return write_frame(payload);
+	case BIN_SELECT:
+		if (len != 1)
+			return USB_INVALID_NUM_ARGS;
+		if (payload[0] > 0x1F)
+			return USB_INVALID_ARG;
+		FOR_EACH_SELECTED_CHAIN(chain)
+			switches_all(&state[chain], payload[0]);
+		return write_switches(state);
+	case BIN_MASKS:
+		if (len != NUM_SWITCHES)
+			return USB_INVALID_NUM_ARGS;
+		for (size_t i = 0; i < NUM_SWITCHES; i += 1) {
+			if (payload[i] > 0x1F)
+				return USB_INVALID_ARG;
+		}
+		FOR_EACH_SELECTED_CHAIN(chain) {
+			for (size_t i = 0; i < NUM_SWITCHES; i += 1)
+				switches_set(&state[chain], i, payload[i]);
+		}
+		return write_switches(state);
+	case BIN_DELTA:
+		if (len == 0)
+			return USB_INVALID_NUM_ARGS;
+		if (!switches_check_delta(payload, len))
+			return USB_INVALID_ARG;
+		FOR_EACH_SELECTED_CHAIN(chain)
+			switches_apply_delta(&state[chain], payload, len);
+		return write_switches(state);
+	case BIN_LOAD:
+		if (sequence_running())
+			return USB_SEQ_RUNNING;
+		if (CLK_OUT)
+			return USB_CLOCK_ON;
+		FOR_EACH_SELECTED_CHAIN(chain)
+			hal_ld_pulse(chain);
+		output_invalidate(CHAIN_SEL);
+		wear_forget(CHAIN_SEL);
+		break;
+	case BIN_CLOCK:
+		if (len == 0)
+			return start_clock(0x00, 0, 0);
+		if (len != 5)
+			return USB_INVALID_NUM_ARGS;
+		return start_clock(payload[0],
+				payload[1] | (payload[2] << 8),
+				payload[3] | (payload[4] << 8));
+	case BIN_STOP:
+		sequence_stop();
+		schedule_clear();
+		transition_stop();
+		stream_stop();
+		stream_sync(&state[0]);
+		output_stop();
+		break;
+	case BIN_CHAIN:
+		if (len != 1)
+			return USB_INVALID_NUM_ARGS;
+		if (payload[0] == 0 || (payload[0] & ~CHAINS_ALL))
+			return USB_INVALID_ARG;
+		CHAIN_SEL = payload[0];
+		break;
+	case BIN_BEGIN:
+		STAGED = 1;
+		break;
+	case BIN_COMMIT:
+		STAGED = 0;
+		return write_switches(state);
+	case BIN_SEQ_CLEAR:
+		sequence_clear();
+		break;
+	case BIN_SEQ_ADD:
+		if (len != SWITCHES_FRAME_SIZE)
+			return USB_INVALID_NUM_ARGS;
+		return sequence_add(payload);
+	case BIN_SEQ_RUN:
+		if (len != 5)
+			return USB_INVALID_NUM_ARGS;
+		if (payload[0] > SEQ_TRIGGER)
+			return USB_INVALID_ARG;
+		return sequence_run((seq_source_t)payload[0],
+				payload[1] | (payload[2] << 8),
+				payload[3] | (payload[4] << 8));
+	case BIN_SEQ_STEP:
+		status = sequence_step();
+		sequence_sync(&state[0]);
+		return status;
+	case BIN_SCHEDULE:
+		if (len != 5 + SWITCHES_FRAME_SIZE)
+			return USB_INVALID_NUM_ARGS;
+		if (payload[0] > 1)
+			return USB_INVALID_ARG;
+		if (CLK_OUT)
+			return USB_CLOCK_ON;
+		if (sequence_running() || stream_running())
+			return USB_SEQ_RUNNING;
+		if (transition_running())
+			return USB_TRANSITION_RUNNING;
+		due = payload[1] | (payload[2] << 8) | ((uint32_t)payload[3] << 16) | ((uint32_t)payload[4] << 24);
+		if (payload[0] == 1)
+			due += timebase_now();
+		return schedule_add(due, payload + 5);
+	case BIN_SAVE:
+		if (len != 1)
+			return USB_INVALID_NUM_ARGS;
+		FOR_EACH_SELECTED_CHAIN(chain) {
+			uint8_t frame[SWITCHES_FRAME_SIZE];
+			switches_pack(&state[chain], frame);
+			return preset_save(payload[0], frame);
+		}
+		return USB_INVALID_ARG;
+	case BIN_RECALL:
+		if (len != 1)
+			return USB_INVALID_NUM_ARGS;
+		return recall_preset(state, payload[0]);
+	case BIN_POWERON:
+		if (len != 1)
+			return USB_INVALID_NUM_ARGS;
+		return preset_set_power_on(payload[0]);
+	case BIN_SPEED:
+		if (len == 0) {
+			uint16_t divider = speed_divider();
+			uint8_t report[2] = {divider & 0xFF, divider >> 8};
+			return bin_event(BIN_SPEED, report, sizeof(report));
+		}
+		if (len != 2)
+			return USB_INVALID_NUM_ARGS;
+		if (payload[0] == 0 && payload[1] == 0)
+			return speed_calibrate();
+		return speed_set(payload[0] | ((uint16_t)payload[1] << 8));
+	case BIN_WEAR:
+		if (len < 1)
+			return USB_INVALID_NUM_ARGS;
+		if (payload[0] == 1)
+			return (len == 1) ? wear_save() : USB_INVALID_NUM_ARGS;
+		if (payload[0] == 2)
+			return (len == 1) ? wear_clear(CHAIN_SEL) : USB_INVALID_NUM_ARGS;
+		if (payload[0] != 0)
+			return USB_INVALID_ARG;
+		if (len != 2)
+			return USB_INVALID_NUM_ARGS;
+		if (payload[1] >= NUM_SWITCHES)
+			return USB_INVALID_ARG;
+		FOR_EACH_SELECTED_CHAIN(chain) {
+			const uint32_t *counts = wear_counts(chain) + payload[1]*5;
+			uint8_t report[2 + 5*4];
+			report[0] = chain;
+			report[1] = payload[1];
+			for (size_t i = 0; i < 5*4; i += 1)
+				report[2 + i] = counts[4 - i/4] >> (8 * (i % 4));
+			bin_event(BIN_WEAR, report, sizeof(report));
+		}
+		break;
+	case BIN_VERIFY:
+		if (len == 0) {
+			// Checked, mismatches and bit errors, as u32 LE
+			const output_verify_t *verify = output_verify_counts();
+			uint32_t counts[3] = {verify->checked, verify->mismatches, verify->bit_errors};
+			uint8_t report[12];
+			for (size_t i = 0; i < sizeof(report); i += 1)
+				report[i] = counts[i / 4] >> (8 * (i % 4));
+			return bin_event(BIN_VERIFY, report, sizeof(report));
+		}
+		if (len != 1)
+			return USB_INVALID_NUM_ARGS;
+		if (payload[0] == 2)
+			output_verify_clear();
+		else if (payload[0] <= 1)
+			output_verify_enable(payload[0]);
+		else
+			return USB_INVALID_ARG;
+		break;
+	case BIN_EVENTS:
+		if (len != 1)
+			return USB_INVALID_NUM_ARGS;
+		if (payload[0] > 1)
+			return USB_INVALID_ARG;
+		events_enable(payload[0]);
+		break;
+	case BIN_TRANSITION:
+		if (len != 1 && len != 3)
+			return USB_INVALID_NUM_ARGS;
+		if (payload[0] > TRANSITION_MBB)
+			return USB_INVALID_ARG;
+		transition_configure(payload[0], len == 3 ? (uint16_t)(payload[1] | (payload[2] << 8)) : 0u);
+		break;
+	case BIN_PUSH:
+		if (len == 0 || len % SWITCHES_FRAME_SIZE != 0)
+			return USB_INVALID_NUM_ARGS;
+		for (size_t i = 0; i < len; i += SWITCHES_FRAME_SIZE) {
+			status = stream_push(payload + i);
+			if (status != USB_SUCCESS)
+				return status;
+		}
+		break;
+	case BIN_STREAM:
+		if (len == 0) {
+			// Queued frames (u8), then popped, underruns, late and overflows
+			// as u32 LE
+			const stream_counts_t *counts = stream_counts();
+			uint32_t values[4] = {counts->popped, counts->underruns, counts->late, counts->overflows};
+			uint8_t report[1 + sizeof(values)];
+			report[0] = stream_queued();
+			for (size_t i = 0; i < sizeof(values); i += 1)
+				report[1 + i] = values[i / 4] >> (8 * (i % 4));
+			return bin_event(BIN_STREAM, report, sizeof(report));
+		}
+		if (payload[0] == 0 && len == 1) {
+			stream_stop();
+			stream_sync(&state[0]);
+		} else if (payload[0] == 2 && len == 1)
+			stream_clear_counts();
+		else if (payload[0] == 1 && len == 3) {
+			if (sequence_running() || schedule_busy())
+				return USB_SEQ_RUNNING;
+			return stream_start(payload[1] | (payload[2] << 8));
+		} else
+			return USB_INVALID_ARG;
+		break;
+	case BIN_ASCII:
+		BINARY_MODE = 0;
+		break;
+	default:
+		return USB_INVALID_CMD;
+	}
+	return USB_SUCCESS;
+}
@@ -0,0 +1,133 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __BIN_PROTO_H__
+#define __BIN_PROTO_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "switch.h"
+#include "usb_utils.h"
+
+/**
+ * Binary framed protocol. Entered from ASCII mode with the BINARY command,
+ * and left again with the BIN_ASCII opcode or a USB configuration change.
+ *
+ * Each frame is laid out as:
+ *      [BIN_SYNC] [opcode] [length] [payload (length bytes)] [crc]
+ * where crc is a CRC-8 (poly 0x07, init 0x00) over opcode, length and payload.
+ *
+ * Every frame is answered with a reply frame carrying a single byte payload,
+ * the usb_status_t of the command:
+ *      [BIN_SYNC] [opcode | BIN_REPLY] [1] [status] [crc]
+ * The device may also send unsolicited event frames in the same format with
+ * a longer payload, such as the report for an executed BIN_SCHEDULE entry.
+ *
+ * A sync byte only starts a frame if the opcode is one the host can send and
+ * the length is valid for it. Anything else is skipped without a reply, so
+ * sync bytes inside payloads or line noise don't produce replies for frames
+ * that were never sent. A frame with a valid header but a bad CRC, or whose
+ * payload doesn't arrive within BIN_FRAME_TIMEOUT ticks, is answered with
+ * USB_BAD_CRC.
+ */
+#define BIN_SYNC (0xA5u)
+#define BIN_REPLY (0x80u)
+#define BIN_HEADER_SIZE (3u) // Sync, opcode and length
+// Most frames a single BIN_PUSH can carry: 8, or fewer if 8 frames don't
+// fit in the length byte
+#define BIN_PUSH_MAX_FRAMES ((255u / SWITCHES_FRAME_SIZE < 8u) ? 255u / SWITCHES_FRAME_SIZE : 8u)
+#define BIN_MAX_PAYLOAD ((NUM_SWITCHES > BIN_PUSH_MAX_FRAMES * SWITCHES_FRAME_SIZE) ? NUM_SWITCHES : BIN_PUSH_MAX_FRAMES * SWITCHES_FRAME_SIZE)
+#define BIN_MAX_FRAME (BIN_HEADER_SIZE + BIN_MAX_PAYLOAD + 1u)
+// Ticks to wait for the rest of a frame once its header has arrived
+#define BIN_FRAME_TIMEOUT (50u)
+
+/* Payload lengths are a single byte, i.e. BIN_MASKS has one per channel */
+#if BIN_MAX_PAYLOAD > 255u
+#error "Binary payloads must fit in the length byte, so at most 255 channels"
+#endif
+
+typedef enum {
+	BIN_NOOP = 0x00, // Do nothing
+	BIN_CLEAR = 0x01, // Clear all switches
+	BIN_WRITE = 0x02, // Write a packed frame (SWITCHES_FRAME_SIZE bytes)
+	BIN_SELECT = 0x03, // Apply a single mask (1 byte) to all channels
+	BIN_MASKS = 0x04, // Apply a mask per channel (NUM_SWITCHES bytes)
+	BIN_LOAD = 0x05, // Pulse the LD line, without changing shift registers
+	BIN_CLOCK = 0x06, // Start the clock, optionally with pattern, count (u16 LE), divider (u16 LE)
+	BIN_STOP = 0x07, // Stop all operations
+	BIN_BEGIN = 0x08, // Stage channel edits without sending them
+	BIN_COMMIT = 0x09, // Send and latch the staged edits as a single frame
+	BIN_CHAIN = 0x0A, // Select the chains that commands apply to (1 byte mask)
+	BIN_DELTA = 0x0B, // Apply a delta to the switch state (see switches_check_delta)
+	BIN_SEQ_CLEAR = 0x10, // Empty the sequence table
+	BIN_SEQ_ADD = 0x11, // Append a packed frame to the sequence table
+	BIN_SEQ_RUN = 0x12, // Arm the sequence (source, count (u16 LE), period (u16 LE))
+	BIN_SEQ_STEP = 0x13, // Output the next step of an armed sequence
+	BIN_SCHEDULE = 0x20, // Output a frame at a tick (flags, tick (u32 LE), frame). Flag 1 makes the tick relative
+	BIN_VERIFY = 0x21, // Readback verification: 0 off, 1 on, 2 clear counters. No payload reports the counters
+	BIN_EVENTS = 0x22, // Completion events: 0 off, 1 on
+	BIN_TRANSITION = 0x23, // Transition mode (0 off, 1 break before make, 2 make before break), [dwell ticks (u16 LE)]
+	BIN_SPEED = 0x24, // Shift clock divider (u16 LE), 0 to calibrate. No payload reports the divider
+	BIN_SAVE = 0x30, // Store the state of the (first) selected chain in a preset slot (1 byte)
+	BIN_RECALL = 0x31, // Write a preset slot to the selected chains (1 byte)
+	BIN_POWERON = 0x32, // Choose the preset output at power on (1 byte, 0xFF for none)
+	BIN_WEAR = 0x33, // Wear counters: 0 report (channel), 1 save, 2 clear the selected chains
+	BIN_PUSH = 0x40, // Append up to BIN_PUSH_MAX_FRAMES packed frames to the stream FIFO
+	BIN_STREAM = 0x41, // Stream control: 0 stop, 1 start (period ticks (u16 LE)), 2 clear counters. No payload reports the counters
+	BIN_CREDIT = 0x42, // Device to host only: stream credits returned (1 byte)
+	BIN_ASCII = 0x7F // Return to the ASCII command set
+} bin_opcode_t;
+
+/**
+ * Calculate the CRC-8 (poly 0x07) of a block of data
+ */
+uint8_t bin_crc8(const uint8_t *data, size_t len);
+
+/**
+ * Send an unsolicited frame to the host, with the reply bit set on the opcode.
+ * Executed BIN_SCHEDULE entries are reported this way, with a payload of
+ * the due tick and the lateness in microseconds (both u32 LE). Completion
+ * events use BIN_EVENTS, with a payload of the event type, chain mask,
+ * sequence number (u16 LE), tick (u32 LE) and microseconds into the tick
+ * (u16 LE). Wear counters are reported with BIN_WEAR, a frame per selected
+ * chain with a payload of the chain, the channel and the A-E counters (each
+ * u32 LE). Stream credits use BIN_CREDIT, which is never a reply, so they
+ * can't be mistaken for the status of a BIN_PUSH.
+ */
+usb_status_t bin_event(uint8_t opcode, const uint8_t *payload, size_t len);
+
+/**
+ * Parse the USB buffer for complete binary frames, executing each one and
+ * replying with its status. Returns USB_MODE_CHANGED if a frame switched
+ * back to ASCII, leaving the rest of the buffer to the ASCII parser.
+ */
+usb_status_t parse_binary_buffer(usb_buf_t *usb_input_buffer, switches_t *state);
+
+/**
+ * Run a single binary command.
+ */
+usb_status_t do_binary_command(uint8_t opcode, const uint8_t *payload, size_t len, switches_t *state);
+
+#endif
@@ -24,9 +24,25 @@ DEALINGS IN THE SOFTWARE.
 #ifndef CYAPICALLBACKS_H
 #define CYAPICALLBACKS_H
 
+#include "topology.h"
+
 void SPIM_TX_ISR_ExitCallback(void);
 #define SPIM_TX_ISR_EXIT_CALLBACK
 
+/* Further chains, see NUM_CHAINS */
+#if NUM_CHAINS > 1
+void SPIM_1_TX_ISR_ExitCallback(void);
+#define SPIM_1_TX_ISR_EXIT_CALLBACK
+#endif
+#if NUM_CHAINS > 2
+void SPIM_2_TX_ISR_ExitCallback(void);
+#define SPIM_2_TX_ISR_EXIT_CALLBACK
+#endif
+#if NUM_CHAINS > 3
+void SPIM_3_TX_ISR_ExitCallback(void);
+#define SPIM_3_TX_ISR_EXIT_CALLBACK
+#endif
+
     
 #endif /* CYAPICALLBACKS_H */   
 /* [] */
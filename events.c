@@ -0,0 +1,83 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "hal.h"
+#include "events.h"
+#include "timebase.h"
+
+/**
+ * Events written by the output interrupt and read by the main loop
+ */
+static event_t queue[EVENT_QUEUE_SIZE];
+static volatile uint8_t head = 0;
+static volatile uint8_t tail = 0;
+static volatile uint8_t enabled = 0;
+static uint16_t seq = 0;
+
+/**
+ * Turn completion events on or off
+ */
+void events_enable(uint8_t enable) {
+	uint8_t intr = hal_enter_critical();
+	enabled = enable;
+	tail = head;
+	hal_exit_critical(intr);
+}
+
+/**
+ * Return 1 if completion events are on
+ */
+uint8_t events_enabled(void) {
+	return enabled;
+}
+
+/**
+ * Record an event. The sequence number advances even when the queue is
+ * full, so the host sees the gap.
+ */
+void events_record(event_type_t type, uint8_t chains) {
+	if (!enabled)
+		return;
+	uint8_t next = (head + 1) % EVENT_QUEUE_SIZE;
+	if (next != tail) {
+		queue[head].type = type;
+		queue[head].chains = chains;
+		queue[head].seq = seq;
+		queue[head].tick = timebase_now();
+		queue[head].us = timebase_subtick_us();
+		head = next;
+	}
+	seq += 1;
+}
+
+/**
+ * Take the oldest event
+ */
+uint8_t events_take(event_t *event) {
+	if (tail == head)
+		return 0;
+	*event = queue[tail];
+	tail = (tail + 1) % EVENT_QUEUE_SIZE;
+	return 1;
+}
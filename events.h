@@ -0,0 +1,74 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __EVENTS_H__
+#define __EVENTS_H__
+
+#include <stdint.h>
+
+/**
+ * Completion events. When enabled, the output interrupt records an event as
+ * each LD pulse fires, and another once nothing is left in flight on any
+ * chain. The main loop sends them to the host, which can then pipeline
+ * commands against real completion rather than waiting out a worst case
+ * delay. Every event carries a sequence number, so a host can spot events
+ * that were dropped because the queue filled up.
+ */
+#define EVENT_QUEUE_SIZE (32u)
+
+typedef enum {
+	EVENT_LATCHED = 0, // The LD lines of the chains in the mask were pulsed
+	EVENT_DRAINED = 1, // No frames are being shifted or waiting on any chain
+} event_type_t;
+
+typedef struct {
+	uint8_t type; // event_type_t
+	uint8_t chains; // Chains that latched, zero for EVENT_DRAINED
+	uint16_t seq; // Counts every event, including dropped ones
+	uint32_t tick; // Timebase tick the event happened on
+	uint16_t us; // Microseconds into the tick
+} event_t;
+
+/**
+ * Turn completion events on or off. Turning them off drops any events that
+ * haven't been sent yet.
+ */
+void events_enable(uint8_t enable);
+
+/**
+ * Return 1 if completion events are on
+ */
+uint8_t events_enabled(void);
+
+/**
+ * Record an event, if events are on. Called from the output interrupt.
+ */
+void events_record(event_type_t type, uint8_t chains);
+
+/**
+ * Take the oldest unsent event. Returns 0 if there are none.
+ */
+uint8_t events_take(event_t *event);
+
+#endif
@@ -0,0 +1,42 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __GLOBALS_H__
+#define __GLOBALS_H__
+
+#include <stdint.h>
+
+/**
+ * Global state shared between the main loop, the command handlers and
+ * the ISR callbacks. Defined in app.c. Anything an ISR writes is volatile.
+ */
+extern volatile uint8_t CLK_OUT;
+extern volatile uint8_t PULSE_LD; // Mask of the chains with a frame waiting to be latched
+extern uint8_t BINARY_MODE;
+extern uint8_t ECHO_ON;
+extern uint8_t STAGED;
+extern uint8_t CHAIN_SEL; // Mask of the chains that commands apply to
+extern const char *term;
+
+#endif
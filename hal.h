@@ -0,0 +1,205 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __HAL_H__
+#define __HAL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "topology.h"
+
+/**
+ * Hardware abstraction layer. The firmware talks to the USB CDC endpoint,
+ * the SPIMs, the LD lines and the SysTick timer only through these calls.
+ * SPIM and LD calls that take a chain index address one of the NUM_CHAINS
+ * chains. The fill clock, bit rate and trigger only exist on chain 0.
+ * On the device they are inline wrappers around the generated PSoC APIs.
+ * Building with HAL_SIM defined leaves them to be provided by a simulation
+ * backend instead.
+ */
+typedef void (*hal_callback_t)(void);
+
+/* EEPROM geometry of the PSoC 5LP: 2 KB in 16 byte rows */
+#define HAL_EEPROM_ROW_SIZE (16u)
+#define HAL_EEPROM_ROWS (128u)
+
+#ifndef HAL_SIM
+
+#include "project.h"
+
+/* Generated API of the SPIM and LD line of each chain */
+typedef struct {
+    void (*start)(void);
+    void (*put)(const uint8 buffer[], uint8 count);
+    void (*clear)(void);
+    uint8 (*rx_size)(void);
+    uint8 (*read)(void);
+    void (*rx_clear)(void);
+    reg8 *status;
+    void (*ld)(uint8 value);
+} hal_chain_t;
+
+static inline const hal_chain_t *hal_chain(uint8_t chain) {
+    static const hal_chain_t chains[NUM_CHAINS] = {
+        {SPIM_Start, SPIM_PutArray, SPIM_ClearTxBuffer, SPIM_GetRxBufferSize,
+         SPIM_ReadRxData, SPIM_ClearRxBuffer, SPIM_TX_STATUS_PTR, LD_PulseGen_Write},
+#if NUM_CHAINS > 1
+        {SPIM_1_Start, SPIM_1_PutArray, SPIM_1_ClearTxBuffer, SPIM_1_GetRxBufferSize,
+         SPIM_1_ReadRxData, SPIM_1_ClearRxBuffer, SPIM_1_TX_STATUS_PTR, LD_PulseGen_1_Write},
+#endif
+#if NUM_CHAINS > 2
+        {SPIM_2_Start, SPIM_2_PutArray, SPIM_2_ClearTxBuffer, SPIM_2_GetRxBufferSize,
+         SPIM_2_ReadRxData, SPIM_2_ClearRxBuffer, SPIM_2_TX_STATUS_PTR, LD_PulseGen_2_Write},
+#endif
+#if NUM_CHAINS > 3
+        {SPIM_3_Start, SPIM_3_PutArray, SPIM_3_ClearTxBuffer, SPIM_3_GetRxBufferSize,
+         SPIM_3_ReadRxData, SPIM_3_ClearRxBuffer, SPIM_3_TX_STATUS_PTR, LD_PulseGen_3_Write},
+#endif
+    };
+    return &chains[chain];
+}
+
+/* Start the SPIMs, and USB operation with 5-V operation */
+static inline void hal_start(uint32_t usb_device) {
+    for (uint8_t chain = 0; chain < NUM_CHAINS; chain += 1)
+        hal_chain(chain)->start();
+    USBUART_Start(usb_device, USBUART_5V_OPERATION);
+}
+
+/* USB CDC endpoint */
+static inline uint8_t hal_usb_config_changed(void) { return USBUART_IsConfigurationChanged(); }
+static inline uint8_t hal_usb_configured(void) { return USBUART_GetConfiguration(); }
+static inline void hal_usb_cdc_init(void) { USBUART_CDC_Init(); }
+static inline uint8_t hal_usb_tx_ready(void) { return USBUART_CDCIsReady(); }
+static inline void hal_usb_put(const uint8_t *buf, size_t len) { USBUART_PutData(buf, len); }
+static inline uint8_t hal_usb_rx_ready(void) { return USBUART_DataIsReady(); }
+static inline size_t hal_usb_get(uint8_t *buf) { return USBUART_GetAll(buf); }
+
+/* SPIM of each chain */
+static inline void hal_spi_put(uint8_t chain, const uint8_t *buf, size_t len) { hal_chain(chain)->put(buf, len); }
+static inline void hal_spi_clear(uint8_t chain) { hal_chain(chain)->clear(); }
+static inline uint8_t hal_spi_done(uint8_t chain) { return (*hal_chain(chain)->status & SPIM_STS_SPI_DONE) != 0; }
+static inline size_t hal_spi_rx_size(uint8_t chain) { return hal_chain(chain)->rx_size(); }
+static inline uint8_t hal_spi_read(uint8_t chain) { return hal_chain(chain)->read(); }
+static inline void hal_spi_rx_clear(uint8_t chain) { hal_chain(chain)->rx_clear(); }
+
+/* Byte at a time access to the chain 0 SPIM, for the fill clock */
+static inline size_t hal_spi_tx_size(void) { return SPIM_GetTxBufferSize(); }
+static inline void hal_spi_write(uint8_t byte) { SPIM_WriteTxData(byte); }
+
+/* SPIM bit rate, set by dividing down the clock feeding the SPIM (Clock_1) */
+#ifdef CY_CLOCK_Clock_1_H
+#define HAL_HAS_SPI_DIVIDER
+static inline void hal_spi_set_divider(uint16_t divider) { Clock_1_SetDividerValue(divider); }
+static inline uint16_t hal_spi_divider(void) { return Clock_1_GetDividerRegister() + 1u; }
+#endif
+
+/* LD line of each chain */
+static inline void hal_ld_pulse(uint8_t chain) { hal_chain(chain)->ld(1u); }
+
+/* Trigger input, only present if a TRIG pin has been added to the design */
+#ifdef CY_PINS_TRIG_H
+#define HAL_HAS_TRIGGER
+static inline uint8_t hal_trigger_read(void) { return TRIG_Read(); }
+/* Rising edge interrupt of the trigger, if the pin interrupt is set to
+ * rising edge and wired to a TRIG_ISR component. Otherwise it is polled. */
+#ifdef CY_ISR_TRIG_ISR_H
+#define HAL_HAS_TRIGGER_ISR
+static inline void hal_trigger_isr(hal_callback_t cb) { TRIG_ISR_StartEx(cb); }
+static inline void hal_trigger_clear(void) { TRIG_ClearInterrupt(); }
+#endif
+#endif
+
+/* SysTick timebase */
+static inline void hal_tick_start(void) { CySysTickStart(); }
+static inline void hal_tick_callback(uint32_t slot, hal_callback_t cb) { CySysTickSetCallback(slot, cb); }
+static inline uint32_t hal_tick_value(void) { return CySysTickGetValue(); }
+static inline uint32_t hal_tick_reload(void) { return CySysTickGetReload(); }
+
+/* DWT cycle counter, used to timestamp the command path */
+static inline void hal_cycles_init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+static inline uint32_t hal_cycles(void) { return DWT->CYCCNT; }
+
+/* EEPROM. Reads are straight from the memory mapped array, writes are a
+ * row at a time and block until the row has been programmed. */
+static inline void hal_eeprom_start(void) { CyEEPROM_Start(); }
+static inline const uint8_t *hal_eeprom_data(void) { return (const uint8_t *)CY_EEPROM_BASE; }
+static inline uint8_t hal_eeprom_write_row(uint16_t row, const uint8_t *data) {
+    if (CySetTemp() != CYRET_SUCCESS)
+        return 0;
+    return CyWriteRowData(CY_SPC_FIRST_EE_ARRAYID, row, data) == CYRET_SUCCESS;
+}
+
+/* Interrupts and critical sections */
+static inline void hal_enable_interrupts(void) { CyGlobalIntEnable; }
+static inline uint8_t hal_enter_critical(void) { return CyEnterCriticalSection(); }
+static inline void hal_exit_critical(uint8_t state) { CyExitCriticalSection(state); }
+/* Sleep until the next interrupt. Called inside a critical section, a
+ * pending interrupt still wakes the core, and runs once the section ends. */
+static inline void hal_sleep(void) { __WFI(); }
+
+#else
+
+void hal_start(uint32_t usb_device);
+uint8_t hal_usb_config_changed(void);
+uint8_t hal_usb_configured(void);
+void hal_usb_cdc_init(void);
+uint8_t hal_usb_tx_ready(void);
+void hal_usb_put(const uint8_t *buf, size_t len);
+uint8_t hal_usb_rx_ready(void);
+size_t hal_usb_get(uint8_t *buf);
+void hal_spi_put(uint8_t chain, const uint8_t *buf, size_t len);
+void hal_spi_clear(uint8_t chain);
+uint8_t hal_spi_done(uint8_t chain);
+size_t hal_spi_rx_size(uint8_t chain);
+uint8_t hal_spi_read(uint8_t chain);
+void hal_spi_rx_clear(uint8_t chain);
+size_t hal_spi_tx_size(void);
+void hal_spi_write(uint8_t byte);
+#define HAL_HAS_SPI_DIVIDER
+void hal_spi_set_divider(uint16_t divider);
+uint16_t hal_spi_divider(void);
+void hal_ld_pulse(uint8_t chain);
+void hal_tick_start(void);
+void hal_tick_callback(uint32_t slot, hal_callback_t cb);
+uint32_t hal_tick_value(void);
+uint32_t hal_tick_reload(void);
+void hal_cycles_init(void);
+uint32_t hal_cycles(void);
+void hal_eeprom_start(void);
+const uint8_t *hal_eeprom_data(void);
+uint8_t hal_eeprom_write_row(uint16_t row, const uint8_t *data);
+void hal_enable_interrupts(void);
+uint8_t hal_enter_critical(void);
+void hal_exit_critical(uint8_t state);
+void hal_sleep(void);
+
+#endif
+
+#endif
@@ -0,0 +1,204 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * End to end latency of the firmware command path, run on the simulated
+ * device: scripted command streams go in through the USB endpoint and run
+ * through the real main loop (app_poll), so a regression in the parser,
+ * the packer or the output queue shows up here before it reaches hardware.
+ *
+ * Reports, for each script:
+ *      commands/s: commands answered per second, sent in 64 byte packets
+ *      in->LD: from the last byte of a command arriving to its LD pulse
+ *      loop: cost of one main loop pass, idle and with a command to run
+ *
+ * Times are host times, so compare runs on the same machine only.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "device.hpp"
+
+using bench_clock = std::chrono::steady_clock;
+
+static bench_clock::time_point ld_time;
+static void on_ld(uint8_t chain) {
+	if (chain == 0)
+		ld_time = bench_clock::now();
+}
+
+static double ns_since(bench_clock::time_point start, bench_clock::time_point end) {
+	return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+/**
+ * A command script: the i'th command of the stream
+ */
+struct script {
+	const char *name;
+	std::function<std::string(size_t)> command;
+	bool latches; // Every command pulses LD
+};
+
+static const char *const masks[] = {"A", "BE", "0", "ACE", "ABCDE", "D"};
+
+static std::string write_frame(size_t i) {
+	std::vector<uint8_t> frame(sim_frame_size());
+	for (size_t b = 0; b < frame.size(); b += 1)
+		frame[b] = uint8_t(i * 7u + b * 13u);
+	return "WRITE " + device::hex(frame);
+}
+
+static const script scripts[] = {
+	{"NOOP", [](size_t) { return std::string("NOOP"); }, false},
+	{"SET", [](size_t i) {
+		return "SET " + std::to_string(i % 32u) + " " + masks[i % 6u];
+	}, true},
+	{"SELECT", [](size_t i) { return std::string("SELECT ") + "ABCDE"[i % 5u]; }, true},
+	{"DELTA x4", [](size_t i) {
+		std::string line = "DELTA";
+		for (size_t e = 0; e < 4; e += 1)
+			line += " " + std::to_string((i + 7u * e) % 32u) + ":" + masks[(i + e) % 6u];
+		return line;
+	}, true},
+	{"WRITE", write_frame, true},
+};
+
+// Commands per throughput run, and latency samples per script
+static const size_t THROUGHPUT_COMMANDS = 20000;
+static const size_t LATENCY_SAMPLES = 5000;
+static const size_t LOOP_PASSES = 200000;
+static const size_t USB_PACKET = 64;
+
+/**
+ * Commands per second, with the stream cut into USB packets as the host
+ * would send it
+ */
+static double throughput(const script &s) {
+	device dev;
+	std::string stream;
+	for (size_t i = 0; i < THROUGHPUT_COMMANDS; i += 1)
+		stream += s.command(i) + "\r";
+
+	uint8_t reply[SIM_HOST_BUFFER_SIZE];
+	size_t ok = 0; // Status lines are all 4 bytes
+	bench_clock::time_point start = bench_clock::now();
+	for (size_t offset = 0; offset < stream.size(); offset += USB_PACKET) {
+		size_t len = std::min(USB_PACKET, stream.size() - offset);
+		sim_host_write(reinterpret_cast<const uint8_t *>(stream.data()) + offset, len);
+		sim_run(64);
+		size_t got = sim_host_read(reply, sizeof(reply));
+		for (size_t r = 0; r + 1 < got; r += 4)
+			ok += reply[r] == 'F' && reply[r + 1] == 'F';
+	}
+	bench_clock::time_point end = bench_clock::now();
+	if (ok != THROUGHPUT_COMMANDS)
+		std::fprintf(stderr, "%s: %zu of %zu commands succeeded\n", s.name, ok, THROUGHPUT_COMMANDS);
+	return THROUGHPUT_COMMANDS / (ns_since(start, end) * 1e-9);
+}
+
+/**
+ * Latency from a command arriving to its LD pulse, as median and 99th
+ * percentile
+ */
+static void latency(const script &s, double *median, double *p99) {
+	device dev;
+	std::vector<double> samples;
+	uint8_t reply[SIM_HOST_BUFFER_SIZE];
+	for (size_t i = 0; i < LATENCY_SAMPLES; i += 1) {
+		std::string line = s.command(i) + "\r";
+		uint32_t pulses = sim_ld_pulses(0);
+		bench_clock::time_point start = bench_clock::now();
+		sim_host_write(reinterpret_cast<const uint8_t *>(line.data()), line.size());
+		sim_run(64);
+		if (sim_ld_pulses(0) != pulses)
+			samples.push_back(ns_since(start, ld_time));
+		sim_host_read(reply, sizeof(reply));
+	}
+	if (samples.empty()) {
+		*median = *p99 = 0;
+		return;
+	}
+	std::sort(samples.begin(), samples.end());
+	*median = samples[samples.size() / 2];
+	*p99 = samples[samples.size() * 99 / 100];
+}
+
+/**
+ * Cost of a main loop pass with nothing to do
+ */
+static double idle_pass(void) {
+	device dev;
+	bench_clock::time_point start = bench_clock::now();
+	for (size_t i = 0; i < LOOP_PASSES; i += 1)
+		sim_run(1);
+	return ns_since(start, bench_clock::now()) / LOOP_PASSES;
+}
+
+/**
+ * Cost of a main loop pass that runs one command of a script
+ */
+static double busy_pass(const script &s) {
+	device dev;
+	std::vector<std::string> lines;
+	for (size_t i = 0; i < LATENCY_SAMPLES; i += 1)
+		lines.push_back(s.command(i) + "\r");
+	uint8_t reply[SIM_HOST_BUFFER_SIZE];
+	double total = 0;
+	for (const std::string &line : lines) {
+		sim_host_write(reinterpret_cast<const uint8_t *>(line.data()), line.size());
+		bench_clock::time_point start = bench_clock::now();
+		sim_run(1);
+		total += ns_since(start, bench_clock::now());
+		sim_host_read(reply, sizeof(reply));
+	}
+	return total / lines.size();
+}
+
+int main() {
+	sim_on_ld(on_ld);
+	std::printf("latency benchmark, %u chain(s), %zu byte frames\n",
+	            unsigned(sim_num_chains()), sim_frame_size());
+	std::printf("  %-10s %12s %12s %12s %12s\n", "script", "commands/s",
+	            "in->LD p50", "in->LD p99", "loop pass");
+	for (const script &s : scripts) {
+		double median = 0, p99 = 0;
+		if (s.latches)
+			latency(s, &median, &p99);
+		std::printf("  %-10s %12.0f", s.name, throughput(s));
+		if (s.latches)
+			std::printf(" %10.0fns %10.0fns", median, p99);
+		else
+			std::printf(" %12s %12s", "-", "-");
+		std::printf(" %10.0fns\n", busy_pass(s));
+	}
+	std::printf("  %-10s %12s %12s %12s %10.0fns\n", "idle", "-", "-", "-", idle_pass());
+	sim_on_ld(NULL);
+	return 0;
+}
@@ -0,0 +1,113 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Throughput of the ASCII parser on the simulated device. Each workload is
+ * a stream of lines that the parser has to read in full but that put out
+ * no frame, so the time is spent taking bytes out of the input ring,
+ * splitting arguments and looking up verbs rather than packing or shifting.
+ *
+ * Reports, for each workload:
+ *      MB/s: input bytes parsed per second, sent in 64 byte packets
+ *      ns/line: time per line, including its status reply
+ *
+ * Times are host times, so compare runs on the same machine only.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "device.hpp"
+
+extern "C" {
+#include "usb_utils.h"
+}
+
+using bench_clock = std::chrono::steady_clock;
+
+struct workload {
+	const char *name;
+	std::string line;
+	const char *reply; // Status every line should get
+};
+
+static std::string hex_args(void) {
+	std::vector<uint8_t> frame(sim_frame_size());
+	for (size_t b = 0; b < frame.size(); b += 1)
+		frame[b] = uint8_t(b * 37u);
+	return device::hex(frame);
+}
+
+static const size_t STREAM_BYTES = 4u << 20;
+static const size_t USB_PACKET = 64;
+
+/**
+ * Parse a stream of one line over and over, returning bytes/s and ns/line
+ */
+static void run(const workload &w, double *bytes_per_s, double *ns_per_line) {
+	device dev;
+	std::string line = w.line + "\r";
+	std::string stream;
+	while (stream.size() < STREAM_BYTES)
+		stream += line;
+	size_t lines = stream.size() / line.size();
+
+	uint8_t reply[SIM_HOST_BUFFER_SIZE];
+	size_t answered = 0; // Status lines are all 4 bytes
+	bench_clock::time_point start = bench_clock::now();
+	for (size_t offset = 0; offset < stream.size(); offset += USB_PACKET) {
+		size_t len = std::min(USB_PACKET, stream.size() - offset);
+		sim_host_write(reinterpret_cast<const uint8_t *>(stream.data()) + offset, len);
+		sim_run(64);
+		size_t got = sim_host_read(reply, sizeof(reply));
+		for (size_t r = 0; r + 1 < got; r += 4)
+			answered += reply[r] == w.reply[0] && reply[r + 1] == w.reply[1];
+	}
+	double ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+	if (answered != lines)
+		std::fprintf(stderr, "%s: %zu of %zu lines answered %s\n", w.name, answered, lines, w.reply);
+	*bytes_per_s = stream.size() / (ns * 1e-9);
+	*ns_per_line = ns / lines;
+}
+
+int main() {
+	const workload workloads[] = {
+		{"short", "NOOP", "FF"},
+		{"unknown", "FROBNICATE", "03"},
+		{"11 args", "FROB 31:ACE 30:BD 29:A 28:E 27:C 26:AB 25:D 24:BE 23:A 22:C 21:E", "03"},
+		{"hex frame", "FROB " + hex_args(), "03"},
+		{"too long", std::string(USB_CMD_MAX_LEN + 32u, 'A'), "01"},
+	};
+	std::printf("parser benchmark, %zu byte frames\n", sim_frame_size());
+	std::printf("  %-10s %10s %10s\n", "workload", "MB/s", "ns/line");
+	for (const workload &w : workloads) {
+		double bytes_per_s = 0, ns_per_line = 0;
+		run(w, &bytes_per_s, &ns_per_line);
+		std::printf("  %-10s %10.1f %10.0f\n", w.name, bytes_per_s * 1e-6, ns_per_line);
+	}
+	return 0;
+}
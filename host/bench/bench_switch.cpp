@@ -0,0 +1,102 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Cost of packing the switch state into a frame, for the table driven
+ * packer and the packer it replaced. A full pack follows CLEAR or SELECT
+ * (every group dirty), a delta update follows SET or DELTA (one or a few
+ * groups dirty).
+ *
+ * Times are host times, so compare runs on the same machine only.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "reference_pack.hpp"
+
+extern "C" {
+#include "switch.h"
+}
+
+using bench_clock = std::chrono::steady_clock;
+
+static const size_t ITERATIONS = 2000000;
+
+// Keep the optimizer from dropping the packs
+static volatile uint8_t sink;
+
+template <typename F>
+static double ns_per(F &&f) {
+	bench_clock::time_point start = bench_clock::now();
+	for (size_t i = 0; i < ITERATIONS; i += 1)
+		f(i);
+	return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / ITERATIONS;
+}
+
+int main() {
+	switches_t sw;
+	uint8_t frame[SWITCHES_FRAME_SIZE];
+	switches_all(&sw, 0x00);
+
+	std::printf("switch packing, %u channels, %u byte frames\n",
+	            unsigned(NUM_SWITCHES), unsigned(SWITCHES_FRAME_SIZE));
+
+	double full = ns_per([&](size_t i) {
+		switches_all(&sw, uint8_t(i));
+		switches_pack(&sw, frame);
+		sink = frame[i % SWITCHES_FRAME_SIZE];
+	});
+	std::printf("  %-28s %8.1f ns\n", "full pack", full);
+
+	double set = ns_per([&](size_t i) {
+		switches_set(&sw, i % NUM_SWITCHES, uint8_t(i >> 5));
+		switches_pack(&sw, frame);
+		sink = frame[i % SWITCHES_FRAME_SIZE];
+	});
+	std::printf("  %-28s %8.1f ns\n", "delta update, 1 channel", set);
+
+	double delta = ns_per([&](size_t i) {
+		uint8_t entries[] = {uint8_t(i % NUM_SWITCHES), uint8_t(i >> 5 & 0x1F),
+		                     uint8_t((i * 7u) % NUM_SWITCHES), uint8_t(i >> 3 & 0x1F),
+		                     uint8_t((i * 13u) % NUM_SWITCHES), uint8_t(i & 0x1F),
+		                     uint8_t((i * 29u) % NUM_SWITCHES), uint8_t(i >> 8 & 0x1F)};
+		switches_apply_delta(&sw, entries, sizeof(entries));
+		switches_pack(&sw, frame);
+		sink = frame[i % SWITCHES_FRAME_SIZE];
+	});
+	std::printf("  %-28s %8.1f ns\n", "delta update, 4 channels", delta);
+
+	if (NUM_SWITCHES == REFERENCE_CHANNELS && SWITCHES_FRAME_SIZE == REFERENCE_FRAME_SIZE) {
+		uint8_t masks[REFERENCE_CHANNELS] = {0};
+		double reference = ns_per([&](size_t i) {
+			masks[i % REFERENCE_CHANNELS] = uint8_t(i >> 5 & 0x1F);
+			reference_pack(masks, frame);
+			sink = frame[i % SWITCHES_FRAME_SIZE];
+		});
+		std::printf("  %-28s %8.1f ns\n", "previous packer, any update", reference);
+	}
+	return 0;
+}
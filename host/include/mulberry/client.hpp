@@ -0,0 +1,213 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __MULBERRY_CLIENT_HPP__
+#define __MULBERRY_CLIENT_HPP__
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "transport.hpp"
+
+namespace mulberry {
+
+/**
+ * Command status codes, as usb_status_t in the firmware's usb_utils.h
+ */
+enum class status : uint8_t {
+	not_ready = 0x00,
+	buf_overflow = 0x01,
+	invalid_buf = 0x02,
+	invalid_cmd = 0x03,
+	invalid_num_args = 0x04,
+	invalid_arg = 0x05,
+	clock_on = 0x06,
+	not_implemented = 0x07,
+	bad_crc = 0x08,
+	seq_running = 0x09,
+	transition_running = 0x0A,
+	other_fail = 0x7F,
+	config_changed = 0x80,
+	timed_out = 0xFE, // Client side only: no reply within the command's timeout
+	success = 0xFF,
+};
+
+/**
+ * Result of a command: its status, and any lines it printed first (i.e.
+ * TIME, STATS or VERIFY)
+ */
+struct reply {
+	status code;
+	std::vector<std::string> lines;
+
+	bool ok() const { return code == status::success; }
+};
+
+/**
+ * Switch masks, as in the firmware: one bit per switch of a channel
+ */
+enum : uint8_t {
+	SWITCH_E = 0x01,
+	SWITCH_D = 0x02,
+	SWITCH_C = 0x04,
+	SWITCH_B = 0x08,
+	SWITCH_A = 0x10,
+};
+
+/**
+ * Asynchronous client for the ASCII command set.
+ *
+ * Commands are queued, and flush sends as many of them back to back as fit
+ * in the window of unanswered bytes, so several commands share each USB
+ * packet. The device is put in ECHO OFF mode, where it replies to every
+ * command with its status in order, so replies are matched to commands
+ * first in, first out. Lines printed by a command before its status are
+ * returned with it, and unsolicited reports (LD/DRAINED events, AT reports
+ * and stream credits) go to the event handler instead.
+ *
+ * Each command has a timeout, counted from when it is sent. A command that
+ * times out completes with status::timed_out, but stays in line so that
+ * its reply, if it comes late, is thrown away rather than matched to the
+ * next command. It no longer counts against the window.
+ *
+ * Channel edits made with set, set_range and select are coalesced: edits
+ * queued between two flushes are merged per channel, dropped if they
+ * restore the last state sent, and sent as one DELTA command (in a
+ * BEGIN/COMMIT transaction if it doesn't fit on a line), so they latch as
+ * a single frame. Raw commands are ordered after any edits queued before
+ * them.
+ */
+class client {
+public:
+	/**
+	 * Connect over a transport. Throws std::runtime_error if the device
+	 * doesn't answer.
+	 * args:
+	 *      channels: number of channels (NUM_SWITCHES in the firmware)
+	 *      window: most bytes sent but not yet answered. The device drops
+	 *          whole USB packets if its 512 byte input ring overflows.
+	 *      timeout: default time to wait for each command's reply
+	 */
+	explicit client(transport &link, size_t channels = 32, size_t window = 256,
+	                std::chrono::milliseconds timeout = std::chrono::milliseconds(1000));
+
+	/**
+	 * Queue a raw command, without the terminator, optionally with its own
+	 * timeout
+	 */
+	std::future<reply> command(const std::string &line);
+	std::future<reply> command(const std::string &line, std::chrono::milliseconds timeout);
+
+	/**
+	 * Queue an edit of one channel, or of an inclusive range of channels
+	 */
+	std::future<reply> set(size_t channel, uint8_t mask);
+	std::future<reply> set_range(size_t first, size_t last, uint8_t mask);
+
+	/**
+	 * Queue the same mask on every channel
+	 */
+	std::future<reply> select(uint8_t mask);
+
+	/**
+	 * Send queued commands, up to the window
+	 */
+	void flush();
+
+	/**
+	 * Read replies for up to timeout, completing their commands, timing out
+	 * those that waited too long, and sending anything the window held
+	 * back. Returns once nothing is outstanding, or on the timeout.
+	 */
+	void poll(std::chrono::milliseconds timeout);
+
+	/**
+	 * Send a command and wait for its reply. Throws std::runtime_error on a
+	 * timeout.
+	 */
+	reply call(const std::string &line);
+
+	/**
+	 * Flush and wait for every outstanding command to be answered or to
+	 * time out
+	 */
+	void sync();
+
+	/**
+	 * Handle unsolicited lines from the device
+	 */
+	void on_event(std::function<void(const std::string &)> handler);
+
+	/**
+	 * Number of commands queued or waiting for a reply, not counting those
+	 * that have timed out
+	 */
+	size_t outstanding() const { return queued.size() + in_flight.size() - expired; }
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct request {
+		std::string line; // Including the terminator
+		std::vector<std::promise<reply>> done;
+		bool edit = false; // Part of a coalesced edit
+		reply result = {status::not_ready, {}};
+		std::chrono::milliseconds timeout{0};
+		clock::time_point deadline; // Set when sent
+		bool expired = false; // Timed out, waiting to throw its reply away
+	};
+
+	void queue_edits();
+	void handle_line(const std::string &line);
+	void complete(request &req);
+	void expire(clock::time_point now);
+	void read_lines(std::chrono::milliseconds timeout);
+	std::future<reply> edit(size_t first, size_t last, uint8_t mask);
+
+	transport &link;
+	size_t window;
+	std::chrono::milliseconds timeout;
+	size_t sent_bytes = 0; // Bytes in flight, not counting timed out commands
+	size_t expired = 0; // Timed out commands still in flight
+	std::deque<request> queued;
+	std::deque<request> in_flight;
+	std::string partial; // Incomplete line received so far
+	std::function<void(const std::string &)> event_handler;
+
+	// Channel edits waiting for the next flush, and the masks last sent
+	std::vector<int> pending; // -1 for no edit
+	std::vector<int> sent; // -1 if unknown
+	std::vector<std::promise<reply>> edit_promises;
+	status edit_failure = status::success; // First failure in a transaction
+};
+
+}
+
+#endif
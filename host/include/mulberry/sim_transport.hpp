@@ -0,0 +1,71 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __MULBERRY_SIM_TRANSPORT_HPP__
+#define __MULBERRY_SIM_TRANSPORT_HPP__
+
+#include <vector>
+
+#include "transport.hpp"
+
+namespace mulberry {
+
+/**
+ * Transport to the in-process device simulator (see sim/sim_device.h),
+ * which runs the real firmware sources. Writes are delivered and run
+ * straight away, so replies are ready as soon as write returns. Only one
+ * simulated device exists per process, and constructing this resets it.
+ */
+class sim_transport : public transport {
+public:
+	explicit sim_transport(bool keep_eeprom = false);
+
+	void write(const uint8_t *data, size_t len) override;
+	size_t read(uint8_t *data, size_t len, std::chrono::milliseconds timeout) override;
+
+	/**
+	 * Advance the device timebase by a number of 1 ms ticks
+	 */
+	void tick(uint32_t ticks);
+
+	/**
+	 * Return the frame latched on a chain's outputs
+	 */
+	std::vector<uint8_t> latched(uint8_t chain = 0) const;
+
+	/**
+	 * Return the number of LD pulses on a chain so far
+	 */
+	uint32_t ld_pulses(uint8_t chain = 0) const;
+
+	/**
+	 * Limit how fast chain 0 can be shifted reliably (see
+	 * sim_set_min_divider)
+	 */
+	void set_min_divider(uint16_t min_divider);
+};
+
+}
+
+#endif
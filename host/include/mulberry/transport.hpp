@@ -0,0 +1,73 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __MULBERRY_TRANSPORT_HPP__
+#define __MULBERRY_TRANSPORT_HPP__
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace mulberry {
+
+/**
+ * Byte stream to a shift register controller
+ */
+class transport {
+public:
+	virtual ~transport() = default;
+
+	/**
+	 * Send bytes to the device. Throws std::runtime_error if the link fails.
+	 */
+	virtual void write(const uint8_t *data, size_t len) = 0;
+
+	/**
+	 * Read whatever the device has sent, waiting up to timeout for the
+	 * first byte. Returns 0 on a timeout.
+	 */
+	virtual size_t read(uint8_t *data, size_t len, std::chrono::milliseconds timeout) = 0;
+};
+
+/**
+ * The USB CDC serial port of a real device, i.e. /dev/ttyACM0
+ */
+class serial_transport : public transport {
+public:
+	explicit serial_transport(const std::string &path);
+	~serial_transport() override;
+	serial_transport(const serial_transport &) = delete;
+	serial_transport &operator=(const serial_transport &) = delete;
+
+	void write(const uint8_t *data, size_t len) override;
+	size_t read(uint8_t *data, size_t len, std::chrono::milliseconds timeout) override;
+
+private:
+	int fd;
+};
+
+}
+
+#endif
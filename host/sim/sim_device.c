@@ -0,0 +1,390 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "hal.h"
+#include "app.h"
+#include "globals.h"
+#include "usb_utils.h"
+#include "switch.h"
+#include "output.h"
+#include "sequence.h"
+#include "schedule.h"
+#include "transition.h"
+#include "stream.h"
+#include "sim_device.h"
+
+#define SIM_TICK_SLOTS (5u)
+#define SIM_TICK_RELOAD (23999u) // 24 MHz SysTick, 1 ms period
+#define SIM_DIVIDER (24u) // Clock_1 divider at power on
+
+/**
+ * Simulated hardware state
+ */
+static struct {
+	// Host side of the USB CDC endpoint. Indices are free running.
+	uint8_t host_in[SIM_HOST_BUFFER_SIZE];
+	size_t in_head, in_tail;
+	uint8_t host_out[SIM_HOST_BUFFER_SIZE];
+	size_t out_head, out_tail;
+
+	// Each chain's shift registers in frame order, with the frame bits that
+	// fall off the far end of the chain (below TOPOLOGY_CHAIN_OFFSET) kept
+	// clear, the bytes shifted back out of them, and the latched outputs
+	uint8_t shift[NUM_CHAINS][SWITCHES_FRAME_SIZE];
+	uint8_t rx[NUM_CHAINS][SWITCHES_FRAME_SIZE];
+	size_t rx_count[NUM_CHAINS];
+	uint8_t fault[NUM_CHAINS];
+	uint8_t latched[NUM_CHAINS][SWITCHES_FRAME_SIZE];
+	uint32_t ld_pulses[NUM_CHAINS];
+	size_t tx_count; // Clock bytes written since the last chain 0 interrupt
+
+	// Clock_1 divider, and the smallest one chain 0 shifts reliably at
+	uint16_t divider;
+	uint16_t min_divider;
+	uint32_t busy_divider_changes; // Divider changed while chain 0 was shifting
+
+	uint8_t spi_pending; // Chains with an SPI done interrupt pending
+	uint8_t spi_held; // Leave SPI done interrupts pending
+	uint8_t critical; // Critical section nesting
+	uint8_t in_isr;
+	uint8_t config_changed; // The host reopened the port
+
+	hal_callback_t tick_callbacks[SIM_TICK_SLOTS];
+	uint32_t cycles;
+	uint8_t eeprom[HAL_EEPROM_ROWS * HAL_EEPROM_ROW_SIZE];
+	sim_ld_hook_t ld_hook;
+} sim;
+
+/**
+ * Run the SPIM TX ISRs of chains with an SPI done interrupt pending
+ */
+static void sim_interrupts(void) {
+	if (sim.in_isr || sim.critical || sim.spi_held)
+		return;
+	sim.in_isr = 1;
+	// Bounded, as a clock that runs forever is always pending
+	for (unsigned pass = 0; sim.spi_pending && pass < 4u * OUTPUT_QUEUE_DEPTH; pass += 1) {
+		for (uint8_t chain = 0; chain < NUM_CHAINS; chain += 1) {
+			uint8_t bit = 1u << chain;
+			if (!(sim.spi_pending & bit))
+				continue;
+			sim.spi_pending &= ~bit;
+			if (chain == 0)
+				sim.tx_count = 0;
+			app_spi_isr(chain);
+		}
+	}
+	sim.in_isr = 0;
+}
+
+/**
+ * Clear the frame bits that have no shift register behind them
+ */
+static void sim_chain_mask(uint8_t *frame) {
+	for (size_t bit = 0; bit < TOPOLOGY_CHAIN_OFFSET; bit += 1)
+		frame[bit / 8u] &= (uint8_t)~(1u << (bit % 8u));
+}
+
+/**
+ * Shift a byte into a chain LSB first, and the 8 bits at its far end back
+ * out
+ */
+static void sim_shift(uint8_t chain, uint8_t byte) {
+	// Shifting chain 0 too fast garbles bits in both directions
+	uint8_t garble = (chain == 0 && sim.divider < sim.min_divider);
+	if (garble)
+		byte ^= 0x80u;
+	uint8_t stream[SWITCHES_FRAME_SIZE + 1];
+	memcpy(stream, sim.shift[chain], SWITCHES_FRAME_SIZE);
+	stream[SWITCHES_FRAME_SIZE] = byte;
+	size_t first = TOPOLOGY_CHAIN_OFFSET / 8u;
+	uint8_t out = stream[first] >> (TOPOLOGY_CHAIN_OFFSET % 8u);
+	if (TOPOLOGY_CHAIN_OFFSET % 8u != 0)
+		out |= (uint8_t)(stream[first + 1] << (8u - TOPOLOGY_CHAIN_OFFSET % 8u));
+	out ^= sim.fault[chain];
+	if (garble)
+		out ^= 0x01u;
+	if (sim.rx_count[chain] < SWITCHES_FRAME_SIZE)
+		sim.rx[chain][sim.rx_count[chain]++] = out;
+	memcpy(sim.shift[chain], stream + 1, SWITCHES_FRAME_SIZE);
+	sim_chain_mask(sim.shift[chain]);
+	sim.spi_pending |= 1u << chain;
+}
+
+/* HAL backend */
+
+void hal_start(uint32_t usb_device) { (void)usb_device; }
+uint8_t hal_usb_config_changed(void) {
+	uint8_t changed = sim.config_changed;
+	sim.config_changed = 0;
+	return changed;
+}
+
+uint8_t hal_usb_configured(void) { return 1; }
+void hal_usb_cdc_init(void) {}
+
+uint8_t hal_usb_tx_ready(void) {
+	return SIM_HOST_BUFFER_SIZE - (sim.out_head - sim.out_tail) >= USBUART_BUFFER_SIZE;
+}
+
+void hal_usb_put(const uint8_t *buf, size_t len) {
+	for (size_t i = 0; i < len; i += 1)
+		sim.host_out[sim.out_head++ & (SIM_HOST_BUFFER_SIZE - 1)] = buf[i];
+}
+
+uint8_t hal_usb_rx_ready(void) {
+	return sim.in_head != sim.in_tail;
+}
+
+size_t hal_usb_get(uint8_t *buf) {
+	size_t len = 0;
+	while (len < USBUART_BUFFER_SIZE && sim.in_tail != sim.in_head)
+		buf[len++] = sim.host_in[sim.in_tail++ & (SIM_HOST_BUFFER_SIZE - 1)];
+	return len;
+}
+
+void hal_spi_put(uint8_t chain, const uint8_t *buf, size_t len) {
+	for (size_t i = 0; i < len; i += 1)
+		sim_shift(chain, buf[i]);
+}
+
+void hal_spi_clear(uint8_t chain) {
+	sim.spi_pending &= ~(1u << chain);
+	if (chain == 0)
+		sim.tx_count = 0;
+}
+
+uint8_t hal_spi_done(uint8_t chain) {
+	return !(sim.spi_pending & (1u << chain));
+}
+
+size_t hal_spi_rx_size(uint8_t chain) { return sim.rx_count[chain]; }
+
+uint8_t hal_spi_read(uint8_t chain) {
+	uint8_t byte = sim.rx[chain][0];
+	sim.rx_count[chain] -= 1;
+	memmove(sim.rx[chain], sim.rx[chain] + 1, sim.rx_count[chain]);
+	return byte;
+}
+
+void hal_spi_rx_clear(uint8_t chain) { sim.rx_count[chain] = 0; }
+size_t hal_spi_tx_size(void) { return sim.tx_count; }
+
+void hal_spi_write(uint8_t byte) {
+	sim_shift(0, byte);
+	sim.tx_count += 1;
+}
+
+void hal_spi_set_divider(uint16_t divider) {
+	if (sim.spi_pending & 1u)
+		sim.busy_divider_changes += 1;
+	sim.divider = divider;
+}
+
+uint16_t hal_spi_divider(void) { return sim.divider; }
+
+void hal_ld_pulse(uint8_t chain) {
+	memcpy(sim.latched[chain], sim.shift[chain], SWITCHES_FRAME_SIZE);
+	sim.ld_pulses[chain] += 1;
+	if (sim.ld_hook != NULL)
+		sim.ld_hook(chain);
+}
+
+void hal_tick_start(void) {}
+
+void hal_tick_callback(uint32_t slot, hal_callback_t cb) {
+	if (slot < SIM_TICK_SLOTS)
+		sim.tick_callbacks[slot] = cb;
+}
+
+uint32_t hal_tick_value(void) { return SIM_TICK_RELOAD; }
+uint32_t hal_tick_reload(void) { return SIM_TICK_RELOAD; }
+void hal_cycles_init(void) { sim.cycles = 0; }
+uint32_t hal_cycles(void) { return sim.cycles += 100u; }
+void hal_eeprom_start(void) {}
+const uint8_t *hal_eeprom_data(void) { return sim.eeprom; }
+
+uint8_t hal_eeprom_write_row(uint16_t row, const uint8_t *data) {
+	if (row >= HAL_EEPROM_ROWS)
+		return 0;
+	memcpy(sim.eeprom + row * HAL_EEPROM_ROW_SIZE, data, HAL_EEPROM_ROW_SIZE);
+	return 1;
+}
+
+void hal_enable_interrupts(void) {}
+
+uint8_t hal_enter_critical(void) {
+	sim.critical += 1;
+	return 0;
+}
+
+void hal_exit_critical(uint8_t state) {
+	(void)state;
+	sim.critical -= 1;
+	sim_interrupts();
+}
+
+void hal_sleep(void) {}
+
+/* Simulator API */
+
+/**
+ * Reset the device, and start the firmware as main() does
+ */
+void sim_init(uint8_t keep_eeprom) {
+	uint8_t eeprom[sizeof(sim.eeprom)];
+	memcpy(eeprom, sim.eeprom, sizeof(eeprom));
+
+	// Stop anything left running by a previous session before the
+	// hardware state goes
+	sequence_stop();
+	schedule_clear();
+	transition_stop();
+	stream_stop();
+	output_stop();
+	transition_configure(TRANSITION_OFF, 0);
+	output_verify_enable(0);
+	output_verify_clear();
+	stream_clear_counts();
+
+	sim_ld_hook_t ld_hook = sim.ld_hook;
+	memset(&sim, 0, sizeof(sim));
+	sim.ld_hook = ld_hook;
+	if (keep_eeprom)
+		memcpy(sim.eeprom, eeprom, sizeof(eeprom));
+	else
+		memset(sim.eeprom, 0xFF, sizeof(sim.eeprom));
+	sim.divider = SIM_DIVIDER;
+
+	// Globals start from their initial values, as after a reset
+	CLK_OUT = 0;
+	PULSE_LD = 0;
+	BINARY_MODE = 0;
+	ECHO_ON = 1;
+	STAGED = 0;
+	CHAIN_SEL = 1u;
+
+	app_init();
+}
+
+/**
+ * Queue host data for the device
+ */
+size_t sim_host_write(const uint8_t *data, size_t len) {
+	size_t n = 0;
+	while (n < len && sim.in_head - sim.in_tail < SIM_HOST_BUFFER_SIZE)
+		sim.host_in[sim.in_head++ & (SIM_HOST_BUFFER_SIZE - 1)] = data[n++];
+	return n;
+}
+
+/**
+ * Take data sent by the device
+ */
+size_t sim_host_read(uint8_t *data, size_t len) {
+	size_t n = 0;
+	while (n < len && sim.out_tail != sim.out_head)
+		data[n++] = sim.host_out[sim.out_tail++ & (SIM_HOST_BUFFER_SIZE - 1)];
+	return n;
+}
+
+/**
+ * Run passes of the main loop
+ */
+unsigned sim_run(unsigned max_passes) {
+	unsigned passes = 0;
+	while (passes < max_passes) {
+		app_poll();
+		passes += 1;
+		if (usb_idle() && (sim.spi_pending == 0 || sim.spi_held))
+			break;
+	}
+	return passes;
+}
+
+/**
+ * Advance the timebase
+ */
+void sim_tick(uint32_t ticks) {
+	for (uint32_t t = 0; t < ticks; t += 1) {
+		sim.in_isr = 1;
+		for (uint8_t slot = 0; slot < SIM_TICK_SLOTS; slot += 1) {
+			if (sim.tick_callbacks[slot] != NULL)
+				sim.tick_callbacks[slot]();
+		}
+		sim.in_isr = 0;
+		sim_interrupts();
+		sim_run(64u);
+	}
+}
+
+size_t sim_frame_size(void) {
+	return SWITCHES_FRAME_SIZE;
+}
+
+size_t sim_chain_offset(void) {
+	return TOPOLOGY_CHAIN_OFFSET;
+}
+
+uint8_t sim_num_chains(void) {
+	return NUM_CHAINS;
+}
+
+const uint8_t *sim_latched(uint8_t chain) {
+	return sim.latched[chain];
+}
+
+uint32_t sim_ld_pulses(uint8_t chain) {
+	return sim.ld_pulses[chain];
+}
+
+uint8_t sim_spi_busy(void) {
+	return sim.spi_pending;
+}
+
+uint32_t sim_busy_divider_changes(void) {
+	return sim.busy_divider_changes;
+}
+
+void sim_set_min_divider(uint16_t min_divider) {
+	sim.min_divider = min_divider;
+}
+
+void sim_set_readback_fault(uint8_t chain, uint8_t xor_mask) {
+	sim.fault[chain] = xor_mask;
+}
+
+void sim_reconnect(void) {
+	sim.config_changed = 1;
+}
+
+void sim_hold_spi(uint8_t hold) {
+	sim.spi_held = hold;
+	sim_interrupts();
+}
+
+void sim_on_ld(sim_ld_hook_t hook) {
+	sim.ld_hook = hook;
+}
@@ -0,0 +1,154 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __SIM_DEVICE_H__
+#define __SIM_DEVICE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * In-process device simulator. The real firmware sources are built with
+ * HAL_SIM and run through app.c, as main() runs them on the device, and
+ * this file provides their HAL: a USB CDC endpoint fed from
+ * the host side, SPIMs that shift into a model of each chain, LD lines
+ * that latch it, and a SysTick that only advances when asked to.
+ *
+ * Interrupts are modelled as well. A transfer started inside a critical
+ * section completes, and runs the firmware's SPI done handling, once the
+ * outermost section ends, as a pending interrupt would on the device.
+ *
+ * The firmware keeps its state in globals, so there is one simulated
+ * device per process.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_HOST_BUFFER_SIZE (4096u)
+
+/**
+ * Reset the simulated device to its power on state, with an erased EEPROM
+ * unless keep_eeprom is set
+ */
+void sim_init(uint8_t keep_eeprom);
+
+/**
+ * Send bytes from the host to the device. Returns the number accepted,
+ * which is less than len if the host to device buffer is full.
+ */
+size_t sim_host_write(const uint8_t *data, size_t len);
+
+/**
+ * Receive up to len bytes sent by the device to the host
+ */
+size_t sim_host_read(uint8_t *data, size_t len);
+
+/**
+ * Run the firmware main loop until it has nothing more to do, or for at
+ * most max_passes passes (e.g. while the fill clock runs forever). Returns
+ * the number of passes run.
+ */
+unsigned sim_run(unsigned max_passes);
+
+/**
+ * Advance the timebase by a number of ticks, running the SysTick callbacks
+ * and the main loop after each one
+ */
+void sim_tick(uint32_t ticks);
+
+/**
+ * Return the size of a packed frame, and the number of chains
+ */
+size_t sim_frame_size(void);
+uint8_t sim_num_chains(void);
+
+/**
+ * Return the number of frame bits below the first shift register of a
+ * chain. They fall off the far end, so they are never latched.
+ */
+size_t sim_chain_offset(void);
+
+/**
+ * Return the frame latched on a chain's outputs
+ */
+const uint8_t *sim_latched(uint8_t chain);
+
+/**
+ * Return the number of LD pulses on a chain since sim_init
+ */
+uint32_t sim_ld_pulses(uint8_t chain);
+
+/**
+ * Return a mask of the chains with a transfer that hasn't finished
+ */
+uint8_t sim_spi_busy(void);
+
+/**
+ * Make chain 0 garble data shifted with a divider below min_divider, as a
+ * long cable would, to exercise speed calibration. Zero removes the limit.
+ */
+void sim_set_min_divider(uint16_t min_divider);
+
+/**
+ * Return the number of times the divider was changed while chain 0 was
+ * shifting, which would garble the frame on real hardware
+ */
+uint32_t sim_busy_divider_changes(void);
+
+/**
+ * Flip bits of what a chain's shift registers shift back out, to exercise
+ * readback verification. Zero restores a clean chain.
+ */
+void sim_set_readback_fault(uint8_t chain, uint8_t xor_mask);
+
+/**
+ * Signal a USB configuration change, as when the host reopens the port.
+ * The next main loop pass starts a new session.
+ */
+void sim_reconnect(void);
+
+/**
+ * Hold SPI done interrupts pending, as if every transfer took until the
+ * hold is released, to fill the output queues. Anything that then waits
+ * for queue space spins forever, so only queue frames that check for it
+ * (i.e. timer steps) while held. A broadcast waits for its chains to be
+ * idle, so only one can be sent while held.
+ */
+void sim_hold_spi(uint8_t hold);
+
+/**
+ * Call a function on every LD pulse, e.g. to timestamp it or to record
+ * what was latched. It runs inside the firmware, so it must not send data
+ * to the device or run it. NULL removes it. The hook is kept across
+ * sim_init.
+ */
+typedef void (*sim_ld_hook_t)(uint8_t chain);
+void sim_on_ld(sim_ld_hook_t hook);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
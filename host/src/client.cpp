@@ -0,0 +1,356 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "mulberry/client.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace mulberry {
+
+namespace {
+
+const char TERMINATOR = '\r';
+const size_t DELTA_MAX_ENTRIES = 8; // Keeps DELTA within the argument limit
+
+/**
+ * Format a mask the way the firmware parses it, i.e. "ace" or "0"
+ */
+std::string format_mask(uint8_t mask) {
+	std::string str;
+	for (char c = 'a'; c <= 'e'; c += 1) {
+		if (mask & (1u << ('e' - c)))
+			str += c;
+	}
+	return str.empty() ? "0" : str;
+}
+
+/**
+ * Check for a status line, i.e. "FF". The firmware writes these as exactly
+ * two upper case hex digits, and everything else it prints starts with a
+ * word, so nothing else can look like one.
+ */
+bool parse_status(const std::string &line, status &code) {
+	static const char digits[] = "0123456789ABCDEF";
+	if (line.size() != 2)
+		return false;
+	const char *hi = std::char_traits<char>::find(digits, 16, line[0]);
+	const char *lo = std::char_traits<char>::find(digits, 16, line[1]);
+	if (hi == nullptr || lo == nullptr)
+		return false;
+	code = static_cast<status>((hi - digits) * 16 + (lo - digits));
+	return true;
+}
+
+/**
+ * Check for an unsolicited report
+ */
+bool is_event(const std::string &line) {
+	static const char *const prefixes[] = {"LD ", "DRAINED ", "AT ", "CREDIT "};
+	for (const char *prefix : prefixes) {
+		if (line.compare(0, std::char_traits<char>::length(prefix), prefix) == 0)
+			return true;
+	}
+	return false;
+}
+
+std::future<reply> ready(status code) {
+	std::promise<reply> done;
+	done.set_value(reply{code, {}});
+	return done.get_future();
+}
+
+}
+
+client::client(transport &link, size_t channels, size_t window,
+               std::chrono::milliseconds timeout)
+	: link(link), window(window), timeout(timeout),
+	  pending(channels, -1), sent(channels, -1) {
+	// Throw away anything left over from a previous session
+	uint8_t discard[256];
+	while (link.read(discard, sizeof(discard), std::chrono::milliseconds(0)) != 0)
+		;
+
+	// Switch to replying with statuses. A device in the default verbose
+	// mode echoes this and then goes quiet, one already in it replies FF.
+	static const std::string hello = "ECHO OFF";
+	std::string line = hello + TERMINATOR;
+	link.write(reinterpret_cast<const uint8_t *>(line.data()), line.size());
+
+	auto deadline = std::chrono::steady_clock::now() + timeout;
+	for (;;) {
+		auto now = std::chrono::steady_clock::now();
+		if (now >= deadline)
+			throw std::runtime_error("mulberry: no reply from device");
+		uint8_t buf[256];
+		size_t len = link.read(buf, sizeof(buf),
+		    std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now));
+		partial.append(reinterpret_cast<const char *>(buf), len);
+
+		size_t end;
+		while ((end = partial.find("\r\n")) != std::string::npos) {
+			line = partial.substr(0, end);
+			partial.erase(0, end + 2);
+			status code;
+			if (line == "Command: \"" + hello + "\"" ||
+			    (parse_status(line, code) && code == status::success))
+				return;
+		}
+	}
+}
+
+std::future<reply> client::command(const std::string &line) {
+	return command(line, timeout);
+}
+
+std::future<reply> client::command(const std::string &line, std::chrono::milliseconds wait) {
+	// Edits queued so far go first, and the command may change channels
+	// behind our back
+	queue_edits();
+	std::fill(sent.begin(), sent.end(), -1);
+
+	request req;
+	req.line = line + TERMINATOR;
+	req.timeout = wait;
+	req.done.emplace_back();
+	std::future<reply> result = req.done.back().get_future();
+	queued.push_back(std::move(req));
+	return result;
+}
+
+std::future<reply> client::edit(size_t first, size_t last, uint8_t mask) {
+	if (first > last || last >= pending.size() || mask > 0x1F)
+		return ready(status::invalid_arg);
+	for (size_t ch = first; ch <= last; ch += 1)
+		pending[ch] = mask;
+	edit_promises.emplace_back();
+	return edit_promises.back().get_future();
+}
+
+std::future<reply> client::set(size_t channel, uint8_t mask) {
+	return edit(channel, channel, mask);
+}
+
+std::future<reply> client::set_range(size_t first, size_t last, uint8_t mask) {
+	return edit(first, last, mask);
+}
+
+std::future<reply> client::select(uint8_t mask) {
+	return edit(0, pending.size() - 1, mask);
+}
+
+/**
+ * Turn pending edits into DELTA commands. Runs of channels set to the same
+ * mask become a single entry.
+ */
+void client::queue_edits() {
+	if (edit_promises.empty())
+		return;
+
+	std::vector<std::string> entries;
+	for (size_t ch = 0; ch < pending.size();) {
+		int mask = pending[ch];
+		if (mask < 0 || mask == sent[ch]) {
+			ch += 1;
+			continue;
+		}
+		size_t last = ch;
+		while (last + 1 < pending.size() && pending[last + 1] == mask &&
+		       sent[last + 1] != mask)
+			last += 1;
+		std::string entry = std::to_string(ch);
+		if (last != ch)
+			entry += "-" + std::to_string(last);
+		entries.push_back(entry + ":" + format_mask(mask));
+		for (; ch <= last; ch += 1)
+			sent[ch] = mask;
+	}
+	std::fill(pending.begin(), pending.end(), -1);
+
+	// Nothing changed
+	if (entries.empty()) {
+		for (auto &done : edit_promises)
+			done.set_value(reply{status::success, {}});
+		edit_promises.clear();
+		return;
+	}
+
+	std::vector<std::string> lines;
+	for (size_t i = 0; i < entries.size(); i += DELTA_MAX_ENTRIES) {
+		std::string line = "DELTA";
+		for (size_t j = i; j < entries.size() && j < i + DELTA_MAX_ENTRIES; j += 1)
+			line += " " + entries[j];
+		lines.push_back(line);
+	}
+	// Latch everything as one frame
+	if (lines.size() > 1) {
+		lines.insert(lines.begin(), "BEGIN");
+		lines.push_back("COMMIT");
+	}
+	for (const auto &line : lines) {
+		request req;
+		req.line = line + TERMINATOR;
+		req.edit = true;
+		req.timeout = timeout;
+		queued.push_back(std::move(req));
+	}
+	queued.back().done = std::move(edit_promises);
+	edit_promises.clear();
+}
+
+void client::flush() {
+	queue_edits();
+	std::string out;
+	clock::time_point now = clock::now();
+	while (!queued.empty()) {
+		const std::string &line = queued.front().line;
+		if ((sent_bytes != 0 || !out.empty()) && sent_bytes + out.size() + line.size() > window)
+			break;
+		out += line;
+		queued.front().deadline = now + queued.front().timeout;
+		in_flight.push_back(std::move(queued.front()));
+		queued.pop_front();
+	}
+	if (out.empty())
+		return;
+	sent_bytes += out.size();
+	link.write(reinterpret_cast<const uint8_t *>(out.data()), out.size());
+}
+
+void client::complete(request &req) {
+	// A timed out command has already been completed, and its bytes taken
+	// off the window
+	if (req.expired) {
+		expired -= 1;
+		return;
+	}
+	sent_bytes -= req.line.size();
+	if (req.edit) {
+		if (req.result.code != status::success) {
+			if (edit_failure == status::success)
+				edit_failure = req.result.code;
+			// The device may not hold what we think it does
+			std::fill(sent.begin(), sent.end(), -1);
+		}
+		if (!req.done.empty()) {
+			req.result.code = edit_failure;
+			edit_failure = status::success;
+		}
+	}
+	for (auto &done : req.done)
+		done.set_value(req.result);
+	req.done.clear();
+}
+
+/**
+ * Time out commands that have waited too long for their reply. They are
+ * completed now, and left in flight to take their reply if it turns up.
+ */
+void client::expire(clock::time_point now) {
+	for (request &req : in_flight) {
+		if (req.expired || now < req.deadline)
+			continue;
+		req.result = reply{status::timed_out, {}};
+		complete(req);
+		req.expired = true;
+		expired += 1;
+	}
+}
+
+void client::handle_line(const std::string &line) {
+	if (is_event(line) || in_flight.empty()) {
+		if (event_handler)
+			event_handler(line);
+		return;
+	}
+	request &req = in_flight.front();
+	status code;
+	if (!parse_status(line, code)) {
+		if (!req.expired)
+			req.result.lines.push_back(line);
+		return;
+	}
+	if (!req.expired)
+		req.result.code = code;
+	request done = std::move(req);
+	in_flight.pop_front();
+	complete(done);
+}
+
+void client::read_lines(std::chrono::milliseconds wait) {
+	uint8_t buf[512];
+	size_t len = link.read(buf, sizeof(buf), wait);
+	partial.append(reinterpret_cast<const char *>(buf), len);
+
+	size_t end;
+	while ((end = partial.find("\r\n")) != std::string::npos) {
+		std::string line = partial.substr(0, end);
+		partial.erase(0, end + 2);
+		handle_line(line);
+	}
+}
+
+void client::poll(std::chrono::milliseconds wait) {
+	clock::time_point deadline = clock::now() + wait;
+	flush();
+	for (;;) {
+		// Wake up for the first command to time out, if that comes sooner
+		clock::time_point until = deadline;
+		for (const request &req : in_flight) {
+			if (!req.expired && req.deadline < until)
+				until = req.deadline;
+		}
+		clock::time_point now = clock::now();
+		read_lines(now < until ?
+		    std::chrono::duration_cast<std::chrono::milliseconds>(until - now) :
+		    std::chrono::milliseconds(0));
+		expire(clock::now());
+		flush();
+		if (outstanding() == 0 || clock::now() >= deadline)
+			return;
+	}
+}
+
+void client::sync() {
+	// Every command sent either completes or times out, which frees the
+	// window for the next
+	flush();
+	while (outstanding() != 0)
+		poll(timeout);
+}
+
+reply client::call(const std::string &line) {
+	std::future<reply> result = command(line);
+	sync();
+	reply answer = result.get();
+	if (answer.code == status::timed_out)
+		throw std::runtime_error("mulberry: timed out waiting for device");
+	return answer;
+}
+
+void client::on_event(std::function<void(const std::string &)> handler) {
+	event_handler = std::move(handler);
+}
+
+}
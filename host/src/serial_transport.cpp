@@ -0,0 +1,104 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "mulberry/transport.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace mulberry {
+
+namespace {
+
+[[noreturn]] void fail(const std::string &what) {
+	throw std::runtime_error("mulberry: " + what + ": " + std::strerror(errno));
+}
+
+}
+
+serial_transport::serial_transport(const std::string &path) {
+	fd = ::open(path.c_str(), O_RDWR | O_NOCTTY);
+	if (fd < 0)
+		fail("opening " + path);
+
+	// Raw bytes in both directions. The baud rate means nothing to a CDC
+	// device, so it is left alone.
+	struct termios tio;
+	if (tcgetattr(fd, &tio) != 0) {
+		::close(fd);
+		fail("reading " + path + " attributes");
+	}
+	cfmakeraw(&tio);
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+		::close(fd);
+		fail("configuring " + path);
+	}
+	tcflush(fd, TCIOFLUSH);
+}
+
+serial_transport::~serial_transport() {
+	::close(fd);
+}
+
+void serial_transport::write(const uint8_t *data, size_t len) {
+	while (len != 0) {
+		ssize_t n = ::write(fd, data, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			fail("write");
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+size_t serial_transport::read(uint8_t *data, size_t len, std::chrono::milliseconds timeout) {
+	struct pollfd pfd = {fd, POLLIN, 0};
+	int ready = ::poll(&pfd, 1, static_cast<int>(timeout.count()));
+	if (ready < 0) {
+		if (errno == EINTR)
+			return 0;
+		fail("poll");
+	}
+	if (ready == 0)
+		return 0;
+	ssize_t n = ::read(fd, data, len);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+		fail("read");
+	}
+	return static_cast<size_t>(n);
+}
+
+}
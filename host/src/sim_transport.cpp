@@ -0,0 +1,77 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "mulberry/sim_transport.hpp"
+
+#include <stdexcept>
+
+#include "../sim/sim_device.h"
+
+namespace mulberry {
+
+// Enough main loop passes to drain the input ring and answer every command
+// in it, without hanging while the fill clock free-runs
+static const unsigned SIM_RUN_PASSES = 4096u;
+
+sim_transport::sim_transport(bool keep_eeprom) {
+	sim_init(keep_eeprom ? 1 : 0);
+}
+
+void sim_transport::write(const uint8_t *data, size_t len) {
+	// Feed the device as fast as it takes data, as the USB link would
+	while (len != 0) {
+		size_t n = sim_host_write(data, len);
+		sim_run(SIM_RUN_PASSES);
+		// The device only stops taking data if nobody reads its replies
+		if (n == 0)
+			throw std::runtime_error("mulberry: simulated device output full");
+		data += n;
+		len -= n;
+	}
+}
+
+size_t sim_transport::read(uint8_t *data, size_t len, std::chrono::milliseconds timeout) {
+	// Nothing arrives while the host waits, replies are all ready
+	(void)timeout;
+	return sim_host_read(data, len);
+}
+
+void sim_transport::tick(uint32_t ticks) {
+	sim_tick(ticks);
+}
+
+std::vector<uint8_t> sim_transport::latched(uint8_t chain) const {
+	const uint8_t *frame = sim_latched(chain);
+	return std::vector<uint8_t>(frame, frame + sim_frame_size());
+}
+
+uint32_t sim_transport::ld_pulses(uint8_t chain) const {
+	return sim_ld_pulses(chain);
+}
+
+void sim_transport::set_min_divider(uint16_t min_divider) {
+	sim_set_min_divider(min_divider);
+}
+
+}
@@ -0,0 +1,60 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "check.hpp"
+
+#include <cstdio>
+#include <exception>
+
+namespace check {
+
+std::vector<test_case> &registry() {
+	static std::vector<test_case> cases;
+	return cases;
+}
+
+void fail(const char *file, int line, const std::string &what) {
+	throw failure{std::string(file) + ":" + std::to_string(line) + ": " + what};
+}
+
+}
+
+int main() {
+	unsigned failed = 0;
+	for (const check::test_case &test : check::registry()) {
+		try {
+			test.run();
+			std::printf("  ok    %s\n", test.name);
+		} catch (const check::skipped &skip) {
+			std::printf("  skip  %s (%s)\n", test.name, skip.why.c_str());
+		} catch (const check::failure &failure) {
+			std::printf("  FAIL  %s\n        %s\n", test.name, failure.what.c_str());
+			failed += 1;
+		} catch (const std::exception &e) {
+			std::printf("  FAIL  %s\n        exception: %s\n", test.name, e.what());
+			failed += 1;
+		}
+	}
+	return failed != 0;
+}
@@ -0,0 +1,115 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __MULBERRY_CHECK_HPP__
+#define __MULBERRY_CHECK_HPP__
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Minimal test harness. Each test file is its own program: TEST defines a
+ * test case, the CHECK macros end it with a failure, and check.cpp provides
+ * a main() that runs every case and returns non-zero if any failed.
+ */
+namespace check {
+
+struct test_case {
+	const char *name;
+	void (*run)();
+};
+
+std::vector<test_case> &registry();
+
+struct registrar {
+	registrar(const char *name, void (*run)()) { registry().push_back({name, run}); }
+};
+
+// Thrown to end a test case
+struct failure {
+	std::string what;
+};
+struct skipped {
+	std::string why;
+};
+
+[[noreturn]] void fail(const char *file, int line, const std::string &what);
+
+template <typename T>
+struct is_vector : std::false_type {};
+template <typename T>
+struct is_vector<std::vector<T>> : std::true_type {};
+
+template <typename T>
+std::string show(const T &value) {
+	std::ostringstream out;
+	if constexpr (std::is_same_v<T, std::vector<uint8_t>>) {
+		out << std::hex;
+		for (uint8_t byte : value)
+			out << (byte < 16 ? "0" : "") << unsigned(byte);
+	} else if constexpr (is_vector<T>::value) {
+		out << '{';
+		for (size_t i = 0; i < value.size(); i += 1)
+			out << (i ? ", " : "") << show(value[i]);
+		out << '}';
+	} else if constexpr (std::is_integral_v<T> && sizeof(T) == 1) {
+		out << unsigned(value);
+	} else if constexpr (std::is_enum_v<T>) {
+		out << static_cast<unsigned long long>(value);
+	} else if constexpr (std::is_convertible_v<T, std::string>) {
+		out << '"' << std::string(value) << '"';
+	} else {
+		out << value;
+	}
+	return out.str();
+}
+
+}
+
+#define TEST(name) \
+	static void test_##name(); \
+	static check::registrar register_##name(#name, test_##name); \
+	static void test_##name()
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) \
+			check::fail(__FILE__, __LINE__, #cond); \
+	} while (0)
+
+#define CHECK_EQ(a, b) \
+	do { \
+		auto check_a = (a); \
+		auto check_b = (b); \
+		if (!(check_a == check_b)) \
+			check::fail(__FILE__, __LINE__, std::string(#a " == " #b ": ") + \
+			            check::show(check_a) + " != " + check::show(check_b)); \
+	} while (0)
+
+#define SKIP(why) throw check::skipped{why}
+
+#endif
@@ -0,0 +1,124 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "device.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+// As sim_transport: enough passes to answer everything in the input ring
+static const unsigned RUN_PASSES = 4096u;
+
+device::device(bool keep_eeprom) {
+	sim_init(keep_eeprom ? 1 : 0);
+	send("ECHO OFF\r");
+}
+
+std::string device::send(const std::string &bytes) {
+	std::string output;
+	uint8_t buf[SIM_HOST_BUFFER_SIZE];
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(bytes.data());
+	size_t len = bytes.size();
+	do {
+		size_t n = sim_host_write(data, len);
+		sim_run(RUN_PASSES);
+		size_t got = sim_host_read(buf, sizeof(buf));
+		output.append(reinterpret_cast<char *>(buf), got);
+		if (n == 0 && got == 0)
+			throw std::runtime_error("simulated device stopped taking data");
+		data += n;
+		len -= n;
+	} while (len != 0);
+	return output;
+}
+
+std::vector<std::string> device::lines(const std::string &command) {
+	return split(send(command + "\r"));
+}
+
+int device::status(const std::string &command) {
+	std::vector<std::string> reply = lines(command);
+	if (reply.empty() || reply.back().size() != 2)
+		return -1;
+	char *end;
+	long code = std::strtol(reply.back().c_str(), &end, 16);
+	return *end == '\0' ? int(code) : -1;
+}
+
+std::vector<std::string> device::tick(uint32_t ticks) {
+	std::string output;
+	uint8_t buf[SIM_HOST_BUFFER_SIZE];
+	for (uint32_t t = 0; t < ticks; t += 1) {
+		sim_tick(1);
+		size_t got = sim_host_read(buf, sizeof(buf));
+		output.append(reinterpret_cast<char *>(buf), got);
+	}
+	return split(output);
+}
+
+std::vector<uint8_t> device::latched(uint8_t chain) const {
+	const uint8_t *frame = sim_latched(chain);
+	return std::vector<uint8_t>(frame, frame + sim_frame_size());
+}
+
+std::vector<uint8_t> device::on_chain(std::vector<uint8_t> frame) {
+	for (size_t bit = 0; bit < sim_chain_offset(); bit += 1)
+		frame[bit / 8] &= static_cast<uint8_t>(~(1u << (bit % 8)));
+	return frame;
+}
+
+std::string device::hex(const std::vector<uint8_t> &frame) {
+	// Most significant byte first, i.e. byte 0 of the frame last
+	std::string out;
+	char digits[3];
+	for (size_t i = frame.size(); i-- > 0;) {
+		std::snprintf(digits, sizeof(digits), "%02X", frame[i]);
+		out += digits;
+	}
+	return out;
+}
+
+std::string device::frame(uint8_t opcode, const std::vector<uint8_t> &payload) {
+	std::string out = {char(0xA5), char(opcode), char(payload.size())};
+	out.append(payload.begin(), payload.end());
+	// CRC-8, poly 0x07, over everything after the sync byte
+	uint8_t crc = 0;
+	for (size_t i = 1; i < out.size(); i += 1) {
+		crc ^= uint8_t(out[i]);
+		for (int bit = 0; bit < 8; bit += 1)
+			crc = (crc & 0x80u) ? uint8_t((crc << 1) ^ 0x07u) : uint8_t(crc << 1);
+	}
+	return out + char(crc);
+}
+
+std::vector<std::string> device::split(const std::string &output) {
+	std::vector<std::string> out;
+	size_t start = 0;
+	for (size_t end; (end = output.find("\r\n", start)) != std::string::npos; start = end + 2)
+		out.push_back(output.substr(start, end - start));
+	if (start < output.size())
+		out.push_back(output.substr(start));
+	return out;
+}
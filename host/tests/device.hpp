@@ -0,0 +1,93 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __MULBERRY_TEST_DEVICE_HPP__
+#define __MULBERRY_TEST_DEVICE_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../sim/sim_device.h"
+
+/**
+ * Raw access to the simulated device for the tests and benchmarks, below
+ * the client library. Constructing one resets the device and turns echo
+ * off, so every command answers with one status line.
+ */
+class device {
+public:
+	explicit device(bool keep_eeprom = false);
+
+	/**
+	 * Deliver bytes to the device, run it until it is idle, and return
+	 * what it sent back
+	 */
+	std::string send(const std::string &bytes);
+
+	/**
+	 * Run a command and return the lines it sent back
+	 */
+	std::vector<std::string> lines(const std::string &command);
+
+	/**
+	 * Run a command and return its status, or -1 if the last line sent
+	 * back isn't one
+	 */
+	int status(const std::string &command);
+
+	/**
+	 * Advance the timebase, returning the lines sent meanwhile
+	 */
+	std::vector<std::string> tick(uint32_t ticks);
+
+	/**
+	 * Return the frame latched on a chain
+	 */
+	std::vector<uint8_t> latched(uint8_t chain = 0) const;
+
+	/**
+	 * Clear the frame bits that have no shift register behind them, which
+	 * is what latching the frame leaves on the outputs
+	 */
+	static std::vector<uint8_t> on_chain(std::vector<uint8_t> frame);
+
+	/**
+	 * Format a frame as the hex argument of WRITE, AT or PUSH
+	 */
+	static std::string hex(const std::vector<uint8_t> &frame);
+
+	/**
+	 * Build a binary protocol frame (see bin_proto.h)
+	 */
+	static std::string frame(uint8_t opcode, const std::vector<uint8_t> &payload = {});
+
+	/**
+	 * Split what the device sent into lines
+	 */
+	static std::vector<std::string> split(const std::string &output);
+};
+
+#endif
@@ -0,0 +1,54 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __MULBERRY_REFERENCE_PACK_HPP__
+#define __MULBERRY_REFERENCE_PACK_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * The packer switches_pack replaced, kept to check the table driven one
+ * against. It packs each group of 8 channels into 40 bits of a 64-bit
+ * word, shifting the first two groups up a bit for the missing shift
+ * register bit before bit 80, and ORs the words into the frame 5 bytes
+ * apart. It only knows the stock two board chain of 32 channels and a
+ * 20 byte frame.
+ */
+static const size_t REFERENCE_CHANNELS = 32;
+static const size_t REFERENCE_FRAME_SIZE = 20;
+
+inline void reference_pack(const uint8_t *masks, uint8_t *out) {
+	std::memset(out, 0x00, REFERENCE_FRAME_SIZE);
+	for (size_t i = 0; i < REFERENCE_CHANNELS / 8; i += 1) {
+		uint64_t data = 0;
+		for (size_t j = 0; j < 8; j += 1)
+			data |= uint64_t(masks[REFERENCE_CHANNELS - (i*8 + j) - 1] & 0x1F) << (j*5 + (1 - i/2));
+		for (size_t j = 0; j < 6 && i*5 + j < REFERENCE_FRAME_SIZE; j += 1)
+			out[i*5 + j] |= uint8_t(data >> (8*j));
+	}
+}
+
+#endif
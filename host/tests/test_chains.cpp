@@ -0,0 +1,106 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Several chains: a broadcast shifts every chain at once and latches them
+ * together once the last transfer is done, and a selected chain is written
+ * on its own. These run in the NUM_CHAINS=3 build.
+ */
+
+#include "check.hpp"
+#include "device.hpp"
+
+struct pulse {
+	uint8_t chain;
+	uint8_t busy; // Chains still shifting when the LD pulse went out
+};
+static std::vector<pulse> pulses;
+static void record_pulse(uint8_t chain) {
+	pulses.push_back(pulse{chain, sim_spi_busy()});
+}
+
+static uint8_t all_chains() {
+	return (uint8_t)((1u << sim_num_chains()) - 1u);
+}
+
+static std::vector<uint8_t> filled(uint8_t byte) {
+	return std::vector<uint8_t>(sim_frame_size(), byte);
+}
+
+TEST(broadcast_shifts_chains_together) {
+	if (sim_num_chains() < 2)
+		SKIP("needs several chains");
+	device dev;
+	CHECK_EQ(dev.status("CHAIN ALL"), 0xFF);
+	sim_hold_spi(1);
+	CHECK_EQ(dev.status("WRITE " + device::hex(filled(0x3C))), 0xFF);
+	// Every transfer has started, and no chain has latched
+	CHECK_EQ(sim_spi_busy(), all_chains());
+	for (uint8_t chain = 0; chain < sim_num_chains(); chain += 1)
+		CHECK_EQ(sim_ld_pulses(chain), 0u);
+	sim_hold_spi(0);
+	for (uint8_t chain = 0; chain < sim_num_chains(); chain += 1) {
+		CHECK_EQ(sim_ld_pulses(chain), 1u);
+		CHECK_EQ(dev.latched(chain), filled(0x3C));
+	}
+}
+
+TEST(broadcast_latched_back_to_back) {
+	// Each group is latched chain after chain, with every transfer done,
+	// before any chain starts on the next frame
+	if (sim_num_chains() < 2)
+		SKIP("needs several chains");
+	device dev;
+	CHECK_EQ(dev.status("CHAIN ALL"), 0xFF);
+	pulses.clear();
+	sim_on_ld(record_pulse);
+	CHECK_EQ(dev.status("WRITE " + device::hex(filled(0x11))), 0xFF);
+	CHECK_EQ(dev.status("WRITE " + device::hex(filled(0x22))), 0xFF);
+	sim_on_ld(NULL);
+	CHECK_EQ(pulses.size(), 2u * sim_num_chains());
+	for (size_t i = 0; i < pulses.size(); i += 1) {
+		CHECK_EQ(pulses[i].chain, i % sim_num_chains());
+		CHECK_EQ(pulses[i].busy, 0);
+	}
+	for (uint8_t chain = 0; chain < sim_num_chains(); chain += 1)
+		CHECK_EQ(dev.latched(chain), filled(0x22));
+}
+
+TEST(selected_chain_written_alone) {
+	if (sim_num_chains() < 2)
+		SKIP("needs several chains");
+	device dev;
+	CHECK_EQ(dev.status("CHAIN 1"), 0xFF);
+	CHECK_EQ(dev.status("WRITE " + device::hex(filled(0x5A))), 0xFF);
+	CHECK_EQ(dev.latched(1), filled(0x5A));
+	for (uint8_t chain = 0; chain < sim_num_chains(); chain += 1) {
+		if (chain != 1)
+			CHECK_EQ(sim_ld_pulses(chain), 0u);
+	}
+}
+
+TEST(chain_index_checked) {
+	device dev;
+	CHECK_EQ(dev.status("CHAIN " + std::to_string(sim_num_chains())), 0x05);
+}
@@ -0,0 +1,156 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * The client library against the simulated device: replies matched to the
+ * right commands, edits coalesced into one frame, reports passed to the
+ * event handler, and commands that time out kept from shifting the replies
+ * of those after them
+ */
+
+#include <stdexcept>
+
+#include "check.hpp"
+#include "device.hpp"
+#include "mulberry/client.hpp"
+#include "mulberry/sim_transport.hpp"
+
+using namespace mulberry;
+using std::chrono::milliseconds;
+
+/**
+ * Simulated device whose replies can be held back, as if the link had
+ * stalled. The device still runs everything it is sent.
+ */
+class stalling_transport : public sim_transport {
+public:
+	bool stalled = false;
+
+	size_t read(uint8_t *data, size_t len, milliseconds timeout) override {
+		if (stalled)
+			return 0;
+		return sim_transport::read(data, len, timeout);
+	}
+};
+
+TEST(replies_matched_in_order) {
+	sim_transport link;
+	client dev(link);
+	std::vector<std::future<reply>> results;
+	std::vector<status> expected;
+	for (int i = 0; i < 200; i += 1) {
+		switch (i % 3) {
+		case 0:
+			results.push_back(dev.command("SET " + std::to_string(i % 32) + " A"));
+			expected.push_back(status::success);
+			break;
+		case 1:
+			results.push_back(dev.command("SET 99 A"));
+			expected.push_back(status::invalid_arg);
+			break;
+		default:
+			results.push_back(dev.command("FROB"));
+			expected.push_back(status::invalid_cmd);
+			break;
+		}
+	}
+	dev.sync();
+	for (size_t i = 0; i < results.size(); i += 1)
+		CHECK_EQ(int(results[i].get().code), int(expected[i]));
+}
+
+TEST(time_not_taken_for_status) {
+	// A tick of 10 to 99 printed bare looks like a status
+	sim_transport link;
+	client dev(link);
+	link.tick(42);
+	reply time = dev.call("TIME");
+	CHECK(time.ok());
+	CHECK_EQ(time.lines, std::vector<std::string>{"TIME 42"});
+	CHECK(dev.call("NOOP").ok());
+}
+
+TEST(edits_latched_as_one_frame) {
+	sim_transport link;
+	client dev(link);
+	uint32_t pulses = link.ld_pulses();
+	std::future<reply> a = dev.set(0, SWITCH_A);
+	std::future<reply> b = dev.set_range(4, 20, SWITCH_B | SWITCH_E);
+	std::future<reply> c = dev.set(31, SWITCH_C);
+	dev.sync();
+	CHECK(a.get().ok());
+	CHECK(b.get().ok());
+	CHECK(c.get().ok());
+	CHECK_EQ(link.ld_pulses(), pulses + 1);
+
+	// Restoring what was sent needs nothing
+	std::future<reply> again = dev.set(0, SWITCH_A);
+	dev.sync();
+	CHECK(again.get().ok());
+	CHECK_EQ(link.ld_pulses(), pulses + 1);
+}
+
+TEST(reports_go_to_event_handler) {
+	sim_transport link;
+	client dev(link);
+	std::vector<std::string> events;
+	dev.on_event([&](const std::string &line) { events.push_back(line); });
+	CHECK(dev.call("AT +2 " + device::hex(std::vector<uint8_t>(sim_frame_size(), 0x0F))).ok());
+	link.tick(2);
+	CHECK(dev.call("NOOP").lines.empty());
+	CHECK_EQ(events.size(), (size_t)1);
+	CHECK_EQ(events[0].compare(0, 3, "AT "), 0);
+}
+
+TEST(late_reply_absorbed) {
+	stalling_transport link;
+	client dev(link);
+	link.stalled = true;
+	std::future<reply> first = dev.command("NOOP", milliseconds(20));
+	dev.poll(milliseconds(100));
+	CHECK_EQ(int(first.get().code), int(status::timed_out));
+	CHECK_EQ(dev.outstanding(), (size_t)0);
+
+	// The NOOP's FF turns up ahead of this command's own status
+	std::future<reply> second = dev.command("SET 99 A");
+	link.stalled = false;
+	dev.sync();
+	CHECK_EQ(int(second.get().code), int(status::invalid_arg));
+	CHECK(dev.call("NOOP").ok());
+}
+
+TEST(call_throws_on_timeout) {
+	stalling_transport link;
+	client dev(link, 32, 256, milliseconds(20));
+	link.stalled = true;
+	bool thrown = false;
+	try {
+		dev.call("NOOP");
+	} catch (const std::runtime_error &) {
+		thrown = true;
+	}
+	CHECK(thrown);
+	link.stalled = false;
+	CHECK(dev.call("NOOP").ok());
+}
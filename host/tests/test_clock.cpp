@@ -0,0 +1,98 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Fill clock: CLOCK shifts a pattern out with no LD pulse until STOP or the
+ * end of a finite run, and a divider given to it only lasts for that run
+ */
+
+#include <cstdlib>
+
+#include "check.hpp"
+#include "device.hpp"
+
+extern "C" {
+#include "globals.h"
+}
+
+/**
+ * Return the divider from a SPEED report, or -1
+ */
+static long divider(const std::vector<std::string> &reply) {
+	for (const std::string &line : reply) {
+		if (line.compare(0, 6, "SPEED ") == 0)
+			return std::strtol(line.c_str() + 6, NULL, 10);
+	}
+	return -1;
+}
+
+TEST(clock_runs_until_stop) {
+	device dev;
+	CHECK_EQ(dev.status("CLOCK 0x55"), 0xFF);
+	dev.tick(5);
+	CHECK_EQ(CLK_OUT, 1);
+	CHECK_EQ(dev.status("CLOCK"), 0x06);
+	CHECK_EQ(dev.status("LOAD"), 0x06);
+	CHECK_EQ(dev.status("STOP"), 0xFF);
+	CHECK_EQ(CLK_OUT, 0);
+	CHECK_EQ(dev.status("LOAD"), 0xFF);
+}
+
+TEST(finite_clock_ends) {
+	device dev;
+	CHECK_EQ(dev.status("CLOCK 0x00 100"), 0xFF);
+	dev.tick(5);
+	CHECK_EQ(CLK_OUT, 0);
+	CHECK_EQ(dev.status("LOAD"), 0xFF);
+}
+
+TEST(divider_restored_on_stop) {
+	device dev;
+	CHECK_EQ(dev.status("SPEED 40"), 0xFF);
+	CHECK_EQ(dev.status("CLOCK 0x00 0 80"), 0xFF);
+	CHECK_EQ(divider(dev.lines("SPEED")), 80);
+	CHECK_EQ(dev.status("STOP"), 0xFF);
+	CHECK_EQ(divider(dev.lines("SPEED")), 40);
+	CHECK_EQ(sim_busy_divider_changes(), 0u);
+}
+
+TEST(divider_restored_after_finite_run) {
+	device dev;
+	CHECK_EQ(dev.status("SPEED 40"), 0xFF);
+	CHECK_EQ(dev.status("CLOCK 0x00 64 80"), 0xFF);
+	dev.tick(5);
+	CHECK_EQ(CLK_OUT, 0);
+	CHECK_EQ(divider(dev.lines("SPEED")), 40);
+	CHECK_EQ(sim_busy_divider_changes(), 0u);
+}
+
+TEST(clock_without_divider_keeps_rate) {
+	device dev;
+	CHECK_EQ(dev.status("SPEED 40"), 0xFF);
+	CHECK_EQ(dev.status("CLOCK 0x00 64"), 0xFF);
+	dev.tick(5);
+	CHECK_EQ(dev.status("CLOCK 0x00 0"), 0xFF);
+	CHECK_EQ(dev.status("STOP"), 0xFF);
+	CHECK_EQ(divider(dev.lines("SPEED")), 40);
+}
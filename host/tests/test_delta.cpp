@@ -0,0 +1,137 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Delta updates, sent as DELTA lines and as BIN_DELTA frames: single
+ * channels, ranges and run bytes land as the equivalent SET and SETRANGE
+ * commands would, and a delta with any bad entry is refused whole
+ */
+
+#include "check.hpp"
+#include "device.hpp"
+
+extern "C" {
+#include "bin_proto.h"
+#include "switch.h"
+}
+
+/**
+ * Return what chain 0 latches after some commands, run one by one on a
+ * fresh device
+ */
+static std::vector<uint8_t> reference(const std::vector<std::string> &commands) {
+	device dev;
+	for (const std::string &command : commands)
+		CHECK_EQ(dev.status(command), 0xFF);
+	return dev.latched();
+}
+
+/**
+ * Send a BIN_DELTA frame from ASCII mode, returning its status
+ */
+static int bin_delta(device &dev, const std::vector<uint8_t> &payload) {
+	CHECK_EQ(dev.send("BINARY\r"), "FF\r\n");
+	std::string reply = dev.send(device::frame(BIN_DELTA, payload));
+	CHECK_EQ(dev.send(device::frame(BIN_ASCII)), device::frame(BIN_ASCII | BIN_REPLY, {0xFF}));
+	if (reply.size() != 5 || uint8_t(reply[1]) != (BIN_DELTA | BIN_REPLY))
+		return -1;
+	return uint8_t(reply[3]);
+}
+
+TEST(single_channels) {
+	const std::string last = std::to_string(NUM_SWITCHES - 1);
+	std::vector<uint8_t> expected = reference({"SET 3 AC", "SET 10 B", "SET " + last + " ABCDE"});
+	{
+		device dev;
+		CHECK_EQ(dev.status("DELTA 3:AC 10:B " + last + ":ABCDE"), 0xFF);
+		CHECK_EQ(dev.latched(), expected);
+	}
+	device dev;
+	CHECK_EQ(bin_delta(dev, {3, 0x14, 10, 0x08, uint8_t(NUM_SWITCHES - 1), 0x1F}), 0xFF);
+	CHECK_EQ(dev.latched(), expected);
+}
+
+TEST(ranges) {
+	const std::string last = std::to_string(NUM_SWITCHES - 1);
+	std::vector<uint8_t> expected = reference({"SETRANGE 4 9 E", "SETRANGE 12 12 AB", "SETRANGE 20 " + last + " C"});
+	device dev;
+	CHECK_EQ(dev.status("DELTA 4-9:E 12-12:AB 20-" + last + ":C"), 0xFF);
+	CHECK_EQ(dev.latched(), expected);
+}
+
+TEST(run_bytes) {
+	// Bit 7 of the mask byte adds a count of further channels
+	std::vector<uint8_t> expected = reference({"SETRANGE 3 8 CD", "SET 15 A", "SETRANGE 0 0 B"});
+	device dev;
+	CHECK_EQ(bin_delta(dev, {3, SWITCHES_DELTA_RUN | 0x06, 5,
+			15, SWITCHES_DELTA_RUN | 0x10, 0,
+			0, 0x08}), 0xFF);
+	CHECK_EQ(dev.latched(), expected);
+	// The whole chain in one entry
+	CHECK_EQ(bin_delta(dev, {0, SWITCHES_DELTA_RUN | 0x1F, uint8_t(NUM_SWITCHES - 1)}), 0xFF);
+	CHECK_EQ(dev.latched(), reference({"SETRANGE 0 " + std::to_string(NUM_SWITCHES - 1) + " ABCDE"}));
+}
+
+TEST(out_of_range_channels_refused) {
+	device dev;
+	CHECK_EQ(dev.status("SET 1 A"), 0xFF);
+	std::vector<uint8_t> before = dev.latched();
+	uint32_t pulses = sim_ld_pulses(0);
+	const std::string last = std::to_string(NUM_SWITCHES - 1);
+	const std::string past = std::to_string(NUM_SWITCHES);
+	CHECK_EQ(dev.status("DELTA " + past + ":A"), 0x05);
+	CHECK_EQ(dev.status("DELTA 20-" + past + ":A"), 0x05);
+	CHECK_EQ(dev.status("DELTA 2:B " + past + ":A"), 0x05);
+	CHECK_EQ(bin_delta(dev, {uint8_t(NUM_SWITCHES), 0x01}), 0x05);
+	// A run that starts in range and ends past the chain
+	CHECK_EQ(bin_delta(dev, {uint8_t(NUM_SWITCHES - 2), SWITCHES_DELTA_RUN | 0x01, 2}), 0x05);
+	CHECK_EQ(bin_delta(dev, {2, 0x02, 255, SWITCHES_DELTA_RUN | 0x01, 255}), 0x05);
+	CHECK_EQ(sim_ld_pulses(0), pulses);
+	CHECK_EQ(dev.latched(), before);
+	CHECK_EQ(dev.status("DELTA " + last + ":A"), 0xFF);
+}
+
+TEST(malformed_entries_refused) {
+	device dev;
+	CHECK_EQ(dev.status("SET 1 A"), 0xFF);
+	std::vector<uint8_t> before = dev.latched();
+	uint32_t pulses = sim_ld_pulses(0);
+	CHECK_EQ(dev.status("DELTA"), 0x04);
+	CHECK_EQ(dev.status("DELTA 3"), 0x05);
+	CHECK_EQ(dev.status("DELTA 3:"), 0x05);
+	CHECK_EQ(dev.status("DELTA :A"), 0x05);
+	CHECK_EQ(dev.status("DELTA 3:X"), 0x05);
+	CHECK_EQ(dev.status("DELTA 5-3:A"), 0x05);
+	CHECK_EQ(dev.status("DELTA 3-:A"), 0x05);
+	// The good entry before the bad one isn't applied either
+	CHECK_EQ(dev.status("DELTA 1:0 3:Q"), 0x05);
+	// Odd lengths, a run without its count, and masks past switch A
+	CHECK_EQ(bin_delta(dev, {3}), 0x05);
+	CHECK_EQ(bin_delta(dev, {3, 0x01, 4}), 0x05);
+	CHECK_EQ(bin_delta(dev, {3, SWITCHES_DELTA_RUN | 0x01}), 0x05);
+	CHECK_EQ(bin_delta(dev, {3, 0x20}), 0x05);
+	CHECK_EQ(bin_delta(dev, {1, 0x00, 3, 0x40}), 0x05);
+	CHECK_EQ(sim_ld_pulses(0), pulses);
+	CHECK_EQ(dev.latched(), before);
+}
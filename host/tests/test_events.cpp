@@ -0,0 +1,156 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Completion events: an LD line per latch and a DRAINED line once nothing
+ * is left to shift, numbered so the host can spot the ones dropped while
+ * the queue was full
+ */
+
+#include <cstdlib>
+#include <sstream>
+
+#include "check.hpp"
+#include "device.hpp"
+
+extern "C" {
+#include "events.h"
+#include "usb_utils.h"
+}
+
+struct event {
+	std::string type;
+	unsigned long seq;
+	unsigned long chains;
+};
+
+/**
+ * Pick the event lines out of what the device sent
+ */
+static std::vector<event> events(const std::vector<std::string> &lines) {
+	std::vector<event> out;
+	for (const std::string &line : lines) {
+		std::istringstream in(line);
+		event e{};
+		unsigned long tick, us;
+		in >> e.type;
+		if (e.type != "LD" && e.type != "DRAINED")
+			continue;
+		in >> e.seq >> tick >> us;
+		CHECK(!in.fail());
+		if (e.type == "LD")
+			in >> e.chains;
+		CHECK(!in.fail());
+		out.push_back(e);
+	}
+	return out;
+}
+
+static std::string write(uint8_t byte) {
+	return "WRITE " + device::hex(std::vector<uint8_t>(sim_frame_size(), byte));
+}
+
+TEST(latch_then_drain) {
+	device dev;
+	CHECK_EQ(dev.status("EVENTS ON"), 0xFF);
+	std::vector<std::string> lines = dev.lines(write(0x11));
+	std::vector<std::string> later = dev.tick(1);
+	lines.insert(lines.end(), later.begin(), later.end());
+	std::vector<event> seen = events(lines);
+	CHECK_EQ(seen.size(), (size_t)2);
+	if (seen.size() == 2) {
+		CHECK_EQ(seen[0].type, "LD");
+		CHECK_EQ(seen[0].chains, 1ul);
+		CHECK_EQ(seen[1].type, "DRAINED");
+		CHECK_EQ(seen[1].seq, seen[0].seq + 1);
+	}
+}
+
+TEST(sequence_numbers_count_every_event) {
+	device dev;
+	CHECK_EQ(dev.status("EVENTS ON"), 0xFF);
+	std::vector<std::string> lines;
+	for (uint8_t byte = 1; byte <= 4; byte += 1) {
+		std::vector<std::string> reply = dev.lines(write(uint8_t(0x10u * byte)));
+		lines.insert(lines.end(), reply.begin(), reply.end());
+	}
+	std::vector<std::string> later = dev.tick(1);
+	lines.insert(lines.end(), later.begin(), later.end());
+	std::vector<event> seen = events(lines);
+	CHECK(!seen.empty());
+	unsigned latches = 0;
+	for (size_t i = 0; i < seen.size(); i += 1) {
+		CHECK_EQ(seen[i].seq, seen[0].seq + i);
+		latches += (seen[i].type == "LD");
+	}
+	CHECK_EQ(latches, 4u);
+	CHECK(!seen.empty() && seen.back().type == "DRAINED");
+
+	// Turning events off and on again carries on numbering
+	CHECK_EQ(dev.status("EVENTS OFF"), 0xFF);
+	CHECK(events(dev.lines(write(0x77))).empty());
+	CHECK_EQ(dev.status("EVENTS ON"), 0xFF);
+	std::vector<event> next = events(dev.lines(write(0x66)));
+	CHECK(!next.empty() && next[0].seq == seen.back().seq + 1);
+}
+
+TEST(gap_reported_after_drops) {
+	// A timed sequence latches every tick while the host isn't reading.
+	// Once the output backs up, events are dropped from the full queue,
+	// and the next event after them jumps over their numbers.
+	device dev;
+	CHECK_EQ(dev.status("SEQCLEAR"), 0xFF);
+	CHECK_EQ(dev.status("SEQADD " + device::hex(std::vector<uint8_t>(sim_frame_size(), 0x0F))), 0xFF);
+	CHECK_EQ(dev.status("SEQADD " + device::hex(std::vector<uint8_t>(sim_frame_size(), 0xF0))), 0xFF);
+	CHECK_EQ(dev.status("EVENTS ON"), 0xFF);
+	CHECK_EQ(dev.status("SEQRUN TIMER 0 1"), 0xFF);
+	sim_tick(600);
+	const std::string stop = "STOP\r";
+	CHECK_EQ(sim_host_write(reinterpret_cast<const uint8_t *>(stop.data()), stop.size()), stop.size());
+
+	std::string output;
+	uint8_t buf[SIM_HOST_BUFFER_SIZE];
+	for (size_t got; (got = sim_host_read(buf, sizeof(buf))) != 0 || !usb_idle(); sim_run(64))
+		output.append(reinterpret_cast<char *>(buf), got);
+	std::vector<std::string> lines = device::split(output);
+	CHECK(!lines.empty() && lines.back() == "FF");
+	std::vector<std::string> more = dev.lines(write(0x3C));
+	lines.insert(lines.end(), more.begin(), more.end());
+	more = dev.tick(1);
+	lines.insert(lines.end(), more.begin(), more.end());
+	std::vector<event> seen = events(lines);
+	CHECK(seen.size() > EVENT_QUEUE_SIZE);
+	unsigned long gaps = 0, dropped = 0;
+	for (size_t i = 1; i < seen.size(); i += 1) {
+		CHECK(seen[i].seq > seen[i - 1].seq);
+		if (seen[i].seq != seen[i - 1].seq + 1) {
+			gaps += 1;
+			dropped += seen[i].seq - seen[i - 1].seq - 1;
+		}
+	}
+	CHECK_EQ(gaps, 1ul);
+	// Every latch was numbered, sent or not
+	CHECK(dropped > 0);
+	CHECK(seen.back().seq - seen.front().seq + 1 >= sim_ld_pulses(0));
+}
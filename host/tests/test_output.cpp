@@ -0,0 +1,86 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * The output queue: frames are packed into their own buffers while earlier
+ * ones are still shifting, and each is latched in order from the SPI done
+ * interrupt
+ */
+
+#include "check.hpp"
+#include "device.hpp"
+
+static std::vector<std::vector<uint8_t>> latches;
+static void record_latch(uint8_t chain) {
+	if (chain == 0)
+		latches.push_back(std::vector<uint8_t>(sim_latched(0), sim_latched(0) + sim_frame_size()));
+}
+
+static const char *const commands[] = {"SET 0 A", "SET 9 BC", "SELECT E", "SETRANGE 3 20 AD"};
+
+TEST(commands_answered_while_shifting) {
+	// Every command gets its reply straight away, rather than waiting on
+	// the frame before it to be latched
+	device dev;
+	uint32_t pulses = sim_ld_pulses(0);
+	sim_hold_spi(1);
+	for (const char *command : commands)
+		CHECK_EQ(dev.status(command), 0xFF);
+	CHECK_EQ(sim_ld_pulses(0), pulses);
+	sim_hold_spi(0);
+	CHECK_EQ(sim_ld_pulses(0), pulses + 4);
+}
+
+TEST(queued_frames_latched_in_order) {
+	// The frames latched from a full queue are the same as those latched
+	// one at a time, so no frame was packed into a buffer still in use
+	std::vector<std::vector<uint8_t>> expected;
+	{
+		device dev;
+		for (const char *command : commands) {
+			CHECK_EQ(dev.status(command), 0xFF);
+			expected.push_back(dev.latched());
+		}
+	}
+
+	device dev;
+	latches.clear();
+	sim_on_ld(record_latch);
+	sim_hold_spi(1);
+	for (const char *command : commands)
+		dev.status(command);
+	sim_hold_spi(0);
+	sim_on_ld(NULL);
+	CHECK_EQ(latches.size(), expected.size());
+	for (size_t i = 0; i < expected.size(); i += 1)
+		CHECK_EQ(latches[i], expected[i]);
+}
+
+TEST(unchanged_frame_not_resent) {
+	device dev;
+	CHECK_EQ(dev.status("SET 4 C"), 0xFF);
+	uint32_t pulses = sim_ld_pulses(0);
+	CHECK_EQ(dev.status("SET 4 C"), 0xFF);
+	CHECK_EQ(sim_ld_pulses(0), pulses);
+}
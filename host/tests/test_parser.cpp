@@ -0,0 +1,160 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Fuzzing the ASCII parser: random command streams, cut up at random, give
+ * the same replies however they arrive, every line gets exactly one status,
+ * and no input leaves the parser unable to take the next command
+ */
+
+#include <cctype>
+#include <random>
+
+#include "check.hpp"
+#include "device.hpp"
+
+extern "C" {
+#include "usb_utils.h"
+}
+
+// Verbs the fuzzer picks from. BINARY leaves the ASCII parser, CLOCK can
+// run forever, and STATS reports cycle counts that depend on how the input
+// was cut up, so those are left out.
+static const char *const verbs[] = {
+	"NOOP", "CLEAR", "WRITE", "SELECT", "LOAD", "STOP", "SET", "SETRANGE",
+	"DELTA", "SEQCLEAR", "SEQADD", "SEQRUN", "STEP", "ECHO", "AT", "TIME",
+	"CHAIN", "SAVE", "RECALL", "POWERON", "BEGIN", "COMMIT", "VERIFY",
+	"EVENTS", "TRANSITION", "PUSH", "STREAM", "WEAR", "set", "Noop", "NOPE",
+};
+
+static const char *const words[] = {
+	"0", "1", "7", "31", "32", "255", "4294967296", "A", "ABCDE", "0x", "0xFF",
+	"ON", "OFF", "ALL", "+3", "3:A", "9:BE", "-1", "BBM", "MBB", "STOP",
+};
+
+/**
+ * Build a random line: mostly a verb and arguments, sometimes junk, and
+ * sometimes longer than the parser will take
+ */
+static std::string random_line(std::mt19937 &rng) {
+	std::string line;
+	switch (rng() % 8u) {
+	case 0: // Junk, anything but the terminator
+		for (size_t n = rng() % 40u; n > 0; n -= 1) {
+			char c = char(1u + rng() % 255u);
+			line += (c == '\r') ? ' ' : c;
+		}
+		return line;
+	case 1: // Too long
+		return std::string(USB_CMD_MAX_LEN + rng() % 100u, "AB 1"[rng() % 4u]);
+	default:
+		break;
+	}
+	line = verbs[rng() % (sizeof(verbs) / sizeof(verbs[0]))];
+	for (size_t n = rng() % 14u; n > 0; n -= 1) {
+		line += std::string(1u + rng() % 3u, " \t\n"[rng() % 3u]);
+		if (rng() % 4u == 0) {
+			std::vector<uint8_t> frame(rng() % 2u ? sim_frame_size() : 1u + rng() % 8u);
+			for (uint8_t &b : frame)
+				b = uint8_t(rng());
+			line += device::hex(frame);
+		} else {
+			line += words[rng() % (sizeof(words) / sizeof(words[0]))];
+		}
+	}
+	return line;
+}
+
+static std::string random_stream(std::mt19937 &rng, size_t lines) {
+	std::string stream;
+	for (size_t i = 0; i < lines; i += 1)
+		stream += random_line(rng) + "\r";
+	return stream;
+}
+
+TEST(replies_independent_of_packets) {
+	std::mt19937 rng(1);
+	for (int round = 0; round < 20; round += 1) {
+		std::string stream = random_stream(rng, 40);
+
+		std::string whole;
+		{
+			device dev;
+			whole = dev.send(stream);
+		}
+		std::string bytes;
+		{
+			device dev;
+			for (char c : stream)
+				bytes += dev.send(std::string(1, c));
+		}
+		std::string chunks;
+		{
+			device dev;
+			for (size_t offset = 0; offset < stream.size();) {
+				size_t len = 1u + rng() % 100u;
+				chunks += dev.send(stream.substr(offset, len));
+				offset += len;
+			}
+		}
+		CHECK_EQ(bytes, whole);
+		CHECK_EQ(chunks, whole);
+	}
+}
+
+TEST(every_line_answered_once) {
+	// Lines that aren't commands print nothing else, so there is one
+	// status line per line sent, whatever is in it
+	std::mt19937 rng(2);
+	device dev;
+	for (int round = 0; round < 50; round += 1) {
+		std::string stream;
+		size_t lines = 1u + rng() % 30u;
+		for (size_t i = 0; i < lines; i += 1) {
+			std::string line;
+			for (size_t n = rng() % (USB_CMD_MAX_LEN + 40u); n > 0; n -= 1) {
+				char c = char(1u + rng() % 255u);
+				line += std::isalpha((unsigned char)c) || c == '\r' ? '.' : c;
+			}
+			stream += line + "\r";
+		}
+		std::vector<std::string> reply = device::split(dev.send(stream));
+		CHECK_EQ(reply.size(), lines);
+		for (const std::string &status : reply)
+			CHECK(status == "01" || status == "03" || status == "04");
+	}
+}
+
+TEST(parser_recovers_from_anything) {
+	std::mt19937 rng(3);
+	for (int round = 0; round < 100; round += 1) {
+		device dev;
+		std::string junk = random_stream(rng, 10);
+		// Leave the last line unterminated
+		junk += random_line(rng);
+		dev.send(junk);
+		dev.send("\rSTOP\rECHO OFF\r");
+		CHECK_EQ(dev.status("NOOP"), 0xFF);
+	}
+}
@@ -0,0 +1,121 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Presets: SAVE stores the selected chain's state in an EEPROM slot and
+ * RECALL writes it back out, refusing slots that are empty, out of range
+ * or fail their check
+ */
+
+#include <cstring>
+
+#include "check.hpp"
+#include "device.hpp"
+
+extern "C" {
+#include "hal.h"
+#include "preset.h"
+}
+
+/**
+ * Flip a byte of a slot's stored rows, header first
+ */
+static void corrupt(uint8_t slot, size_t offset) {
+	uint16_t row = PRESET_FIRST_ROW + 1u + slot * PRESET_SLOT_ROWS + offset / HAL_EEPROM_ROW_SIZE;
+	uint8_t data[HAL_EEPROM_ROW_SIZE];
+	std::memcpy(data, hal_eeprom_data() + row * HAL_EEPROM_ROW_SIZE, sizeof(data));
+	data[offset % HAL_EEPROM_ROW_SIZE] ^= 0x01u;
+	CHECK(hal_eeprom_write_row(row, data));
+}
+
+TEST(save_recall_round_trip) {
+	std::vector<uint8_t> saved, expected;
+	{
+		device dev;
+		CHECK_EQ(dev.status("SET 1 ACE"), 0xFF);
+		CHECK_EQ(dev.status("SETRANGE 10 20 B"), 0xFF);
+		CHECK_EQ(dev.status("SET 1 0"), 0xFF);
+		expected = dev.latched();
+	}
+	{
+		device dev;
+		CHECK_EQ(dev.status("SET 1 ACE"), 0xFF);
+		CHECK_EQ(dev.status("SETRANGE 10 20 B"), 0xFF);
+		saved = dev.latched();
+		CHECK_EQ(dev.status("SAVE 3"), 0xFF);
+		CHECK_EQ(dev.status("CLEAR"), 0xFF);
+		CHECK(dev.latched() != saved);
+		CHECK_EQ(dev.status("RECALL 3"), 0xFF);
+		CHECK_EQ(dev.latched(), saved);
+	}
+	// The slot outlives a restart, and the recalled state is built on
+	device dev(true);
+	CHECK_EQ(dev.status("RECALL 3"), 0xFF);
+	CHECK_EQ(dev.latched(), saved);
+	CHECK_EQ(dev.status("SET 1 0"), 0xFF);
+	CHECK_EQ(dev.latched(), expected);
+}
+
+TEST(recall_empty_slot_refused) {
+	device dev;
+	CHECK_EQ(dev.status("SET 4 AB"), 0xFF);
+	std::vector<uint8_t> before = dev.latched();
+	uint32_t pulses = sim_ld_pulses(0);
+	CHECK_EQ(dev.status("RECALL 5"), 0x05);
+	CHECK_EQ(dev.status("POWERON 5"), 0x05);
+	CHECK_EQ(sim_ld_pulses(0), pulses);
+	CHECK_EQ(dev.latched(), before);
+}
+
+TEST(slot_out_of_range_refused) {
+	device dev;
+	const std::string slot = std::to_string(PRESET_SLOTS);
+	CHECK_EQ(dev.status("SAVE " + slot), 0x05);
+	CHECK_EQ(dev.status("RECALL " + slot), 0x05);
+	CHECK_EQ(dev.status("POWERON " + slot), 0x05);
+	CHECK_EQ(dev.status("RECALL 255"), 0x05);
+	CHECK_EQ(dev.status("RECALL"), 0x04);
+}
+
+TEST(corrupted_slot_refused) {
+	device dev;
+	CHECK_EQ(dev.status("SET 7 CD"), 0xFF);
+	for (uint8_t slot = 0; slot < 4; slot += 1)
+		CHECK_EQ(dev.status("SAVE " + std::to_string(slot)), 0xFF);
+	corrupt(0, 0); // Magic
+	corrupt(1, 1); // Frame size
+	corrupt(2, 2); // CRC
+	corrupt(3, PRESET_HEADER_SIZE + 1); // Frame
+	CHECK_EQ(dev.status("CLEAR"), 0xFF);
+	std::vector<uint8_t> cleared = dev.latched();
+	for (uint8_t slot = 0; slot < 4; slot += 1)
+		CHECK_EQ(dev.status("RECALL " + std::to_string(slot)), 0x05);
+	CHECK_EQ(dev.latched(), cleared);
+	// Saving again repairs the slot
+	CHECK_EQ(dev.status("SET 7 CD"), 0xFF);
+	CHECK_EQ(dev.status("SAVE 2"), 0xFF);
+	CHECK_EQ(dev.status("CLEAR"), 0xFF);
+	CHECK_EQ(dev.status("RECALL 2"), 0xFF);
+	CHECK(dev.latched() != cleared);
+}
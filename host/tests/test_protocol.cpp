@@ -0,0 +1,154 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Framing of the ASCII and binary command sets, and switching between them
+ */
+
+#include "check.hpp"
+#include "device.hpp"
+
+extern "C" {
+#include "bin_proto.h"
+}
+
+TEST(binary_round_trip) {
+	device dev;
+	CHECK_EQ(dev.send("BINARY\r"), "FF\r\n");
+	CHECK_EQ(dev.send(device::frame(BIN_NOOP)), device::frame(BIN_NOOP | BIN_REPLY, {0xFF}));
+	CHECK_EQ(dev.send(device::frame(BIN_ASCII)), device::frame(BIN_ASCII | BIN_REPLY, {0xFF}));
+	CHECK_EQ(dev.send("NOOP\r"), "FF\r\n");
+}
+
+TEST(mode_switches_in_one_buffer) {
+	// Fill the input ring with mode switches, which once nested the two
+	// parsers a level per switch
+	device dev;
+	std::string round = "BINARY\r" + device::frame(BIN_ASCII);
+	std::string expected = "FF\r\n" + device::frame(BIN_ASCII | BIN_REPLY, {0xFF});
+	std::string input, output;
+	while (input.size() + round.size() <= 512) {
+		input += round;
+		output += expected;
+	}
+	sim_host_write(reinterpret_cast<const uint8_t *>(input.data()), input.size());
+	CHECK_EQ(dev.send("NOOP\r"), output + "FF\r\n");
+}
+
+TEST(sync_bytes_outside_frames_not_answered) {
+	// Sync bytes in noise, or followed by an opcode the host can't send or
+	// a length the opcode doesn't take, are skipped without a reply
+	device dev;
+	CHECK_EQ(dev.send("BINARY\r"), "FF\r\n");
+	std::string noise = {char(BIN_SYNC), 'x', char(BIN_SYNC), char(BIN_SYNC),
+	                     char(BIN_SYNC), char(BIN_WRITE), char(200),
+	                     char(BIN_SYNC), char(0x55), char(0),
+	                     char(BIN_SYNC), char(BIN_CREDIT), char(1)};
+	CHECK_EQ(dev.send(noise + device::frame(BIN_NOOP)), device::frame(BIN_NOOP | BIN_REPLY, {0xFF}));
+	// nor are sync bytes inside the payload of a frame
+	std::vector<uint8_t> payload(sim_frame_size(), BIN_SYNC);
+	CHECK_EQ(dev.send(device::frame(BIN_SEQ_ADD, payload)), device::frame(BIN_SEQ_ADD | BIN_REPLY, {0xFF}));
+}
+
+TEST(bad_crc_answered_once) {
+	device dev;
+	CHECK_EQ(dev.send("BINARY\r"), "FF\r\n");
+	std::string bad = device::frame(BIN_SELECT, {0x1F});
+	bad.back() ^= 0x01;
+	CHECK_EQ(dev.send(bad + device::frame(BIN_NOOP)),
+	         device::frame(BIN_SELECT | BIN_REPLY, {USB_BAD_CRC}) + device::frame(BIN_NOOP | BIN_REPLY, {0xFF}));
+}
+
+TEST(truncated_frame_times_out) {
+	// A valid header holds the parser until its payload arrives, at most
+	// BIN_FRAME_TIMEOUT ticks
+	device dev;
+	CHECK_EQ(dev.send("BINARY\r"), "FF\r\n");
+	std::string partial = device::frame(BIN_WRITE, std::vector<uint8_t>(sim_frame_size(), 0)).substr(0, 8);
+	CHECK_EQ(dev.send(partial), "");
+	CHECK(dev.tick(BIN_FRAME_TIMEOUT - 2).empty());
+	CHECK_EQ(dev.tick(2), std::vector<std::string>{device::frame(BIN_WRITE | BIN_REPLY, {USB_BAD_CRC})});
+	CHECK_EQ(dev.send(device::frame(BIN_NOOP)), device::frame(BIN_NOOP | BIN_REPLY, {0xFF}));
+}
+
+TEST(host_that_stops_reading) {
+	// Replies pile up in the device while the host doesn't read them. The
+	// main loop keeps running, and once the host reads again every command
+	// has a status, after only whole lines of its output.
+	device dev;
+	const std::string command = "WEAR\r";
+	const unsigned commands = 60;
+	for (unsigned i = 0; i < commands; i += 1) {
+		CHECK_EQ(sim_host_write(reinterpret_cast<const uint8_t *>(command.data()), command.size()), command.size());
+		sim_run(64);
+	}
+	sim_tick(5);
+
+	std::string output;
+	uint8_t buf[SIM_HOST_BUFFER_SIZE];
+	for (size_t got; (got = sim_host_read(buf, sizeof(buf))) != 0 || !usb_idle(); sim_run(64))
+		output.append(reinterpret_cast<char *>(buf), got);
+	unsigned statuses = 0, truncated = 0;
+	for (const std::string &line : device::split(output)) {
+		if (line == "FF" || line == "01") {
+			statuses += 1;
+			truncated += (line == "01");
+		} else {
+			CHECK_EQ(line.compare(0, 5, "WEAR "), 0);
+			CHECK(line.find(" E=") != std::string::npos);
+		}
+	}
+	CHECK_EQ(statuses, commands);
+	CHECK(truncated > 0);
+	CHECK_EQ(dev.status("NOOP"), 0xFF);
+}
+
+TEST(input_held_while_ring_full) {
+	// More commands than the input ring holds, sent while the host isn't
+	// reading replies. The parser stalls on output room, the input backs up
+	// into the endpoint, and once the host reads again every command is
+	// answered exactly once.
+	device dev;
+	std::string input;
+	const unsigned commands = 1500;
+	for (unsigned i = 0; i < commands; i += 1)
+		input += "NOOP\r";
+	for (size_t sent = 0; sent < input.size(); sim_run(256))
+		sent += sim_host_write(reinterpret_cast<const uint8_t *>(input.data()) + sent, input.size() - sent);
+
+	std::string output;
+	uint8_t buf[SIM_HOST_BUFFER_SIZE];
+	for (size_t got; (got = sim_host_read(buf, sizeof(buf))) != 0 || !usb_idle(); sim_run(64))
+		output.append(reinterpret_cast<char *>(buf), got);
+	std::vector<std::string> lines = device::split(output);
+	CHECK_EQ(lines.size(), commands);
+	for (const std::string &line : lines)
+		CHECK_EQ(line, "FF");
+}
+
+TEST(overflowed_line_answered) {
+	device dev;
+	std::string output = dev.send(std::string(300, 'A') + "\rNOOP\r");
+	CHECK_EQ(output, "01\r\nFF\r\n"); // USB_BUF_OVERFLOW, then the NOOP
+}
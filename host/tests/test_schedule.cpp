@@ -0,0 +1,101 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Timed output: frames queued with AT latch on their due tick, are reported
+ * with how late they latched, and only reach the switch state once they
+ * have gone out
+ */
+
+#include <cstdlib>
+
+#include "check.hpp"
+#include "device.hpp"
+
+static std::vector<uint8_t> filled(uint8_t byte) {
+	return std::vector<uint8_t>(sim_frame_size(), byte);
+}
+
+/**
+ * Return the lateness from an AT report line, or -1 if it isn't one
+ */
+static long report_late(const std::string &line) {
+	if (line.compare(0, 3, "AT ") != 0)
+		return -1;
+	return std::strtol(line.c_str() + line.rfind(' ') + 1, NULL, 10);
+}
+
+TEST(frame_latched_on_due_tick) {
+	device dev;
+	CHECK_EQ(dev.status("AT +5 " + device::hex(filled(0x5A))), 0xFF);
+	dev.tick(4);
+	CHECK(dev.latched() != filled(0x5A));
+	std::vector<std::string> reports = dev.tick(1);
+	CHECK_EQ(dev.latched(), filled(0x5A));
+	CHECK_EQ(reports.size(), (size_t)1);
+	CHECK(report_late(reports[0]) >= 0);
+	CHECK(report_late(reports[0]) < 1000);
+}
+
+TEST(lateness_measured_at_latch) {
+	// The frame starts on its due tick but can't latch until the SPI
+	// transfer finishes, and the report covers the whole delay
+	device dev;
+	CHECK_EQ(dev.status("AT +2 " + device::hex(filled(0xA5))), 0xFF);
+	sim_hold_spi(1);
+	CHECK(dev.tick(5).empty());
+	CHECK(dev.latched() != filled(0xA5));
+	sim_hold_spi(0);
+	std::vector<std::string> reports = dev.tick(1);
+	CHECK_EQ(dev.latched(), device::on_chain(filled(0xA5)));
+	CHECK_EQ(reports.size(), (size_t)1);
+	CHECK(report_late(reports[0]) >= 3000);
+}
+
+TEST(direct_writes_refused_while_pending) {
+	device dev;
+	CHECK_EQ(dev.status("AT +3 " + device::hex(filled(0xFF))), 0xFF);
+	CHECK_EQ(dev.status("SET 0 A"), 0x09);
+	CHECK_EQ(dev.status("WRITE " + device::hex(filled(0x11))), 0x09);
+	CHECK_EQ(dev.status("STREAM 10"), 0x09);
+	dev.tick(3);
+	CHECK_EQ(dev.status("SET 0 A"), 0xFF);
+}
+
+TEST(state_follows_latched_frame) {
+	// A pending entry doesn't touch the state, so stopping it leaves the
+	// switches as they were, while one that went out is built on
+	device dev;
+	CHECK_EQ(dev.status("AT +3 " + device::hex(filled(0xFF))), 0xFF);
+	CHECK_EQ(dev.status("STOP"), 0xFF);
+	CHECK_EQ(dev.status("SETRANGE 0 7 0"), 0xFF);
+	CHECK_EQ(dev.latched(), filled(0x00));
+
+	CHECK_EQ(dev.status("AT +1 " + device::hex(filled(0xFF))), 0xFF);
+	dev.tick(1);
+	CHECK_EQ(dev.latched(), device::on_chain(filled(0xFF)));
+	CHECK_EQ(dev.status("SET 0 0"), 0xFF);
+	CHECK(dev.latched() != device::on_chain(filled(0xFF)));
+	CHECK_EQ(dev.latched()[sim_frame_size() / 2], 0xFF);
+}
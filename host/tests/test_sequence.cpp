@@ -0,0 +1,135 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Sequences stepped from the timebase
+ */
+
+#include "check.hpp"
+#include "device.hpp"
+
+static std::vector<uint8_t> step_frame(size_t step) {
+	std::vector<uint8_t> frame(sim_frame_size());
+	frame[1] = uint8_t(step + 1);
+	frame[frame.size() - 1] = uint8_t(0x10u * step);
+	return frame;
+}
+
+static void load_steps(device &dev, size_t steps) {
+	CHECK_EQ(dev.status("SEQCLEAR"), 0xFF);
+	for (size_t step = 0; step < steps; step += 1)
+		CHECK_EQ(dev.status("SEQADD " + device::hex(step_frame(step))), 0xFF);
+}
+
+TEST(timer_steps_on_period) {
+	device dev;
+	load_steps(dev, 3);
+	uint32_t pulses = sim_ld_pulses(0);
+	CHECK_EQ(dev.status("SEQRUN TIMER 1 5"), 0xFF);
+	for (size_t step = 0; step < 3; step += 1) {
+		dev.tick(4);
+		CHECK_EQ(sim_ld_pulses(0), pulses + step);
+		dev.tick(1);
+		CHECK_EQ(sim_ld_pulses(0), pulses + step + 1);
+		CHECK_EQ(dev.latched(), step_frame(step));
+	}
+	// One pass, so the sequence has finished
+	CHECK_EQ(dev.status("STEP"), 0x03); // USB_INVALID_CMD
+}
+
+TEST(busy_output_skips_timer_step) {
+	// With the SPI held up, the output queue fills after 4 steps, and the
+	// next two are skipped rather than pushing every later step back
+	device dev;
+	load_steps(dev, 6);
+	uint32_t pulses = sim_ld_pulses(0);
+	CHECK_EQ(dev.status("SEQRUN TIMER 1 1"), 0xFF);
+	sim_hold_spi(1);
+	dev.tick(6);
+	sim_hold_spi(0);
+	dev.tick(1);
+	CHECK_EQ(sim_ld_pulses(0), pulses + 4);
+	CHECK_EQ(dev.latched(), step_frame(3));
+	CHECK_EQ(dev.status("STEP"), 0x03); // Finished on time
+}
+
+TEST(seqrun_refused_while_streaming) {
+	device dev;
+	load_steps(dev, 2);
+	CHECK_EQ(dev.status("STREAM 10"), 0xFF);
+	CHECK_EQ(dev.status("SEQRUN TIMER 1 1"), 0x09); // USB_SEQ_RUNNING
+	CHECK_EQ(dev.status("STREAM STOP"), 0xFF);
+	CHECK_EQ(dev.status("SEQRUN TIMER 1 1"), 0xFF);
+}
+
+TEST(edits_after_sequence_keep_its_steps) {
+	// Steps go into the switch state, so an edit after them doesn't take
+	// the other channels back to what they were before the sequence
+	device dev;
+	CHECK_EQ(dev.status("SET 0 A"), 0xFF);
+	CHECK_EQ(dev.status("SET 1 B"), 0xFF);
+	CHECK_EQ(dev.status("SET 2 C"), 0xFF);
+	std::vector<uint8_t> expected = dev.latched();
+	CHECK_EQ(dev.status("CLEAR"), 0xFF);
+	CHECK_EQ(dev.status("SEQCLEAR"), 0xFF);
+	CHECK_EQ(dev.status("SET 0 A"), 0xFF);
+	CHECK_EQ(dev.status("SEQADD"), 0xFF);
+	CHECK_EQ(dev.status("SET 1 B"), 0xFF);
+	CHECK_EQ(dev.status("SEQADD"), 0xFF);
+	CHECK_EQ(dev.status("CLEAR"), 0xFF);
+
+	CHECK_EQ(dev.status("SEQRUN TIMER 1 1"), 0xFF);
+	dev.tick(2);
+	CHECK_EQ(dev.status("SET 2 C"), 0xFF);
+	CHECK_EQ(dev.latched(), expected);
+
+	// Manual steps, with the edit in the same buffer
+	CHECK_EQ(dev.status("CLEAR"), 0xFF);
+	CHECK_EQ(dev.status("SEQRUN MANUAL"), 0xFF);
+	CHECK_EQ(dev.send("STEP\rSTEP\rSET 2 C\r"), "FF\r\nFF\r\nFF\r\n");
+	CHECK_EQ(dev.latched(), expected);
+}
+
+TEST(step_refused_while_output_owned) {
+	device dev;
+	load_steps(dev, 2);
+	CHECK_EQ(dev.status("SEQRUN MANUAL 0"), 0xFF);
+	CHECK_EQ(dev.status("AT +5 " + device::hex(step_frame(1))), 0xFF);
+	CHECK_EQ(dev.status("STEP"), 0x09); // USB_SEQ_RUNNING
+	dev.tick(5);
+	CHECK_EQ(dev.status("STEP"), 0xFF);
+	CHECK_EQ(dev.latched(), step_frame(0));
+
+	CHECK_EQ(dev.status("STREAM 10"), 0xFF);
+	CHECK_EQ(dev.status("STEP"), 0x09);
+	CHECK_EQ(dev.status("STREAM STOP"), 0xFF);
+
+	CHECK_EQ(dev.status("TRANSITION BBM 5"), 0xFF);
+	CHECK_EQ(dev.status("SET 0 ABCDE"), 0xFF);
+	CHECK_EQ(dev.status("STEP"), 0x0A); // USB_TRANSITION_RUNNING
+	CHECK_EQ(dev.status("SEQRUN TIMER 1 1"), 0x0A);
+	dev.tick(10);
+	CHECK_EQ(dev.status("STEP"), 0xFF);
+	CHECK_EQ(dev.latched(), step_frame(1));
+}
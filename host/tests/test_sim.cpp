@@ -0,0 +1,89 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * The simulator runs the firmware through app.c as the device does: the
+ * start up order, one status line per command, and the SPI done interrupt
+ * latching frames.
+ */
+
+#include "check.hpp"
+#include "device.hpp"
+
+TEST(write_latches_frame) {
+	device dev;
+	std::vector<uint8_t> frame(sim_frame_size());
+	for (size_t i = 0; i < frame.size(); i += 1)
+		frame[i] = uint8_t(0x11u * i + 3u);
+	uint32_t pulses = sim_ld_pulses(0);
+	CHECK_EQ(dev.status("WRITE " + device::hex(frame)), 0xFF);
+	CHECK_EQ(dev.latched(), device::on_chain(frame));
+	CHECK_EQ(sim_ld_pulses(0), pulses + 1);
+}
+
+TEST(one_status_per_command) {
+	device dev;
+	std::vector<std::string> reply = device::split(dev.send("NOOP\rSET 3 ACE\rBOGUS\rSET 99 A\r"));
+	CHECK_EQ(reply.size(), size_t(4));
+	CHECK_EQ(reply[0], "FF");
+	CHECK_EQ(reply[1], "FF");
+	CHECK_EQ(reply[2], "03"); // USB_INVALID_CMD
+	CHECK_EQ(reply[3], "05"); // USB_INVALID_ARG
+}
+
+TEST(set_changes_only_its_channel) {
+	device dev;
+	CHECK_EQ(dev.status("CLEAR"), 0xFF);
+	std::vector<uint8_t> cleared = dev.latched();
+	CHECK_EQ(dev.status("SET 5 ABCDE"), 0xFF);
+	std::vector<uint8_t> set = dev.latched();
+	unsigned changed = 0;
+	for (size_t i = 0; i < set.size(); i += 1)
+		changed += __builtin_popcount(set[i] ^ cleared[i]);
+	CHECK_EQ(changed, 5u);
+	CHECK_EQ(dev.status("SET 5 0"), 0xFF);
+	CHECK_EQ(dev.latched(), cleared);
+}
+
+TEST(power_on_preset_restored_at_start_up) {
+	std::vector<uint8_t> saved;
+	{
+		device dev;
+		CHECK_EQ(dev.status("SETRANGE 4 9 BD"), 0xFF);
+		saved = dev.latched();
+		CHECK_EQ(dev.status("SAVE 2"), 0xFF);
+		CHECK_EQ(dev.status("POWERON 2"), 0xFF);
+	}
+	device dev(true);
+	CHECK_EQ(dev.latched(), saved);
+	device erased;
+	CHECK(erased.latched() != saved);
+}
+
+TEST(input_split_across_packets) {
+	device dev;
+	CHECK(dev.send("SET 1").empty());
+	CHECK(dev.send("0 A").empty());
+	CHECK_EQ(device::split(dev.send("\r")), std::vector<std::string>{"FF"});
+}
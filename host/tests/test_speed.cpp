@@ -0,0 +1,127 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Shift clock rate: SPEED sets the divider, and SPEED CAL finds the fastest
+ * rate the chain reads back at, on a simulated chain that garbles data
+ * shifted below a minimum divider
+ */
+
+#include <cstdlib>
+
+#include "check.hpp"
+#include "device.hpp"
+
+extern "C" {
+#include "speed.h"
+}
+
+/**
+ * Return the divider from a SPEED report, or -1
+ */
+static long divider(const std::vector<std::string> &reply) {
+	for (const std::string &line : reply) {
+		if (line.compare(0, 6, "SPEED ") == 0)
+			return std::strtol(line.c_str() + 6, NULL, 10);
+	}
+	return -1;
+}
+
+TEST(divider_set_and_reported) {
+	device dev;
+	CHECK_EQ(dev.status("SPEED 40"), 0xFF);
+	CHECK_EQ(divider(dev.lines("SPEED")), 40);
+	CHECK_EQ(dev.status("SPEED " + std::to_string(SPEED_MIN_DIVIDER - 1)), 0x05);
+	CHECK_EQ(dev.status("SPEED 65536"), 0x05);
+	CHECK_EQ(divider(dev.lines("SPEED")), 40);
+}
+
+TEST(calibration_finds_limit) {
+	device dev;
+	sim_set_min_divider(12);
+	CHECK_EQ(dev.status("SPEED 200"), 0xFF);
+	std::vector<std::string> reply = dev.lines("SPEED CAL");
+	CHECK_EQ(reply.back(), "FF");
+	// The fastest rate that passed is within a step of 12, and gets a
+	// margin on top
+	long found = divider(reply);
+	CHECK(found >= 12 + 12 * (long)SPEED_MARGIN_PERCENT / 100);
+	CHECK(found <= 14 + 14 * (long)SPEED_MARGIN_PERCENT / 100 + 1);
+	CHECK_EQ(divider(dev.lines("SPEED")), found);
+	CHECK_EQ(sim_busy_divider_changes(), 0u);
+	sim_set_min_divider(0);
+}
+
+TEST(calibration_on_short_chain) {
+	// The stock chain has no shift register for frame bit 0, so the probes
+	// read back one bit along, and readback verification carries on
+	// cleanly at the calibrated rate
+	CHECK(sim_chain_offset() != 0);
+	device dev;
+	sim_set_min_divider(20);
+	CHECK_EQ(dev.status("SPEED 60"), 0xFF);
+	CHECK_EQ(dev.status("VERIFY ON"), 0xFF);
+	CHECK_EQ(dev.status("WRITE " + device::hex(std::vector<uint8_t>(sim_frame_size(), 0x0F))), 0xFF);
+	CHECK_EQ(dev.status("WRITE " + device::hex(std::vector<uint8_t>(sim_frame_size(), 0xF1))), 0xFF);
+	std::vector<std::string> reply = dev.lines("SPEED CAL");
+	CHECK_EQ(reply.back(), "FF");
+	CHECK(divider(reply) >= 20);
+	CHECK(divider(reply) < 60);
+	CHECK_EQ(dev.status("WRITE " + device::hex(std::vector<uint8_t>(sim_frame_size(), 0x3C))), 0xFF);
+	CHECK_EQ(dev.lines("VERIFY").front(), "VERIFY ON checked=2 mismatches=0 bits=0");
+	sim_set_min_divider(0);
+}
+
+TEST(calibration_fails_when_start_is_bad) {
+	device dev;
+	sim_set_min_divider(100);
+	CHECK_EQ(dev.status("SPEED 50"), 0xFF);
+	CHECK_EQ(dev.status("SPEED CAL"), 0x7F);
+	CHECK_EQ(divider(dev.lines("SPEED")), 50);
+	sim_set_min_divider(0);
+}
+
+TEST(calibration_leaves_outputs) {
+	// Probes are never latched, and the latched frame is shifted back in
+	// so LOAD latches it again
+	device dev;
+	CHECK_EQ(dev.status("SET 2 ACE"), 0xFF);
+	std::vector<uint8_t> latched = dev.latched();
+	uint32_t pulses = sim_ld_pulses(0);
+	sim_set_min_divider(8);
+	CHECK_EQ(dev.lines("SPEED CAL").back(), "FF");
+	CHECK_EQ(sim_ld_pulses(0), pulses);
+	CHECK_EQ(dev.latched(), latched);
+	CHECK_EQ(dev.status("LOAD"), 0xFF);
+	CHECK_EQ(dev.latched(), latched);
+	sim_set_min_divider(0);
+}
+
+TEST(calibration_refused_while_output_owned) {
+	device dev;
+	CHECK_EQ(dev.status("AT +5 " + device::hex(std::vector<uint8_t>(sim_frame_size(), 0))), 0xFF);
+	CHECK_EQ(dev.status("SPEED CAL"), 0x09);
+	dev.tick(5);
+	CHECK_EQ(dev.lines("SPEED CAL").back(), "FF");
+}
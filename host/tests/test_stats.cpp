@@ -0,0 +1,69 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Command path statistics: each interval is counted once for a command
+ * that writes a frame, and not at all past TERM for one that doesn't
+ */
+
+#include <cstdlib>
+
+#include "check.hpp"
+#include "device.hpp"
+
+/**
+ * Return the count of an interval from the STATS dump
+ */
+static long interval_count(device &dev, const std::string &name) {
+	for (const std::string &line : dev.lines("STATS")) {
+		if (line.compare(0, name.size() + 7, name + " count=") == 0)
+			return std::strtol(line.c_str() + name.size() + 7, NULL, 10);
+	}
+	return -1;
+}
+
+TEST(frame_counted_once_along_path) {
+	device dev;
+	CHECK_EQ(dev.status("STATSCLEAR"), 0xFF);
+	CHECK_EQ(dev.status("SET 3 A"), 0xFF);
+	CHECK_EQ(interval_count(dev, "DISPATCH"), 1);
+	CHECK_EQ(interval_count(dev, "SHIFT"), 1);
+	CHECK_EQ(interval_count(dev, "LATCH"), 1);
+	CHECK_EQ(interval_count(dev, "TOTAL"), 1);
+}
+
+TEST(no_dispatch_without_frame) {
+	device dev;
+	CHECK_EQ(dev.status("STATSCLEAR"), 0xFF);
+	CHECK_EQ(dev.status("NOOP"), 0xFF);
+	CHECK_EQ(interval_count(dev, "DISPATCH"), 0);
+	CHECK_EQ(interval_count(dev, "SHIFT"), 0);
+	CHECK_EQ(interval_count(dev, "TOTAL"), 0);
+
+	// A write of the frame already latched puts nothing out either
+	CHECK_EQ(dev.status("SET 3 A"), 0xFF);
+	CHECK_EQ(dev.status("SET 3 A"), 0xFF);
+	CHECK_EQ(interval_count(dev, "DISPATCH"), 1);
+	CHECK_EQ(interval_count(dev, "TOTAL"), 1);
+}
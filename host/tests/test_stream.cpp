@@ -0,0 +1,135 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Stream credits: every frame pushed is credited back once it has been
+ * popped or dropped, and a new session starts with no stream and no
+ * credits owed
+ */
+
+#include <cstdlib>
+
+#include "check.hpp"
+#include "device.hpp"
+
+static const uint8_t BIN_PUSH = 0x40;
+static const uint8_t BIN_STREAM = 0x41;
+static const uint8_t BIN_CREDIT = 0x42;
+static const uint8_t BIN_REPLY = 0x80;
+
+static std::string push(uint8_t byte) {
+	return "PUSH " + device::hex(std::vector<uint8_t>(sim_frame_size(), byte));
+}
+
+/**
+ * Add up the credits in CREDIT lines
+ */
+static long credits(const std::vector<std::string> &lines) {
+	long total = 0;
+	for (const std::string &line : lines) {
+		if (line.compare(0, 7, "CREDIT ") == 0)
+			total += std::strtol(line.c_str() + 7, NULL, 10);
+	}
+	return total;
+}
+
+TEST(popped_frames_credited) {
+	device dev;
+	for (int i = 0; i < 12; i += 1)
+		CHECK_EQ(dev.status(push(uint8_t(i))), 0xFF);
+	CHECK_EQ(dev.status("STREAM 1"), 0xFF);
+	CHECK_EQ(credits(dev.tick(20)), 12);
+	CHECK_EQ(dev.latched(), device::on_chain(std::vector<uint8_t>(sim_frame_size(), 11)));
+}
+
+TEST(dropped_frames_credited_on_stop) {
+	device dev;
+	for (int i = 0; i < 5; i += 1)
+		CHECK_EQ(dev.status(push(uint8_t(i))), 0xFF);
+	CHECK_EQ(dev.status("STREAM 1"), 0xFF);
+	long returned = credits(dev.tick(2));
+	std::vector<std::string> reply = dev.lines("STREAM STOP");
+	CHECK_EQ(returned + credits(reply), 5);
+	CHECK_EQ(reply.front(), "FF");
+	CHECK_EQ(credits(dev.tick(5)), 0);
+}
+
+TEST(binary_credits_not_replies) {
+	// Credits have their own opcode, so they can't be taken for the
+	// status of a push
+	device dev;
+	CHECK_EQ(dev.send("BINARY\r"), "FF\r\n");
+	std::vector<uint8_t> frames(2 * sim_frame_size(), 0x0F);
+	CHECK_EQ(dev.send(device::frame(BIN_PUSH, frames)), device::frame(BIN_PUSH | BIN_REPLY, {0xFF}));
+	CHECK_EQ(dev.send(device::frame(BIN_STREAM, {0})),
+	         device::frame(BIN_STREAM | BIN_REPLY, {0xFF}) + device::frame(BIN_CREDIT | BIN_REPLY, {2}));
+	// and the host can't send one, so it isn't taken as a frame at all
+	CHECK_EQ(dev.send(device::frame(BIN_CREDIT, {1})), "");
+}
+
+TEST(new_session_resets_stream) {
+	device dev;
+	for (int i = 0; i < 5; i += 1)
+		CHECK_EQ(dev.status(push(uint8_t(i))), 0xFF);
+	CHECK_EQ(dev.status("STREAM 10"), 0xFF);
+	sim_reconnect();
+	// The new session starts with echo on
+	dev.send("ECHO OFF\r");
+	CHECK_EQ(credits(dev.tick(60)), 0);
+	std::vector<std::string> status = dev.lines("STREAM");
+	CHECK_EQ(status.front().compare(0, 23, "STREAM STOPPED queued=0"), 0);
+	// and the full FIFO to push into
+	for (unsigned i = 0; i < 32; i += 1)
+		CHECK_EQ(dev.status(push(uint8_t(i))), 0xFF);
+}
+
+TEST(edits_after_stream_keep_its_frame) {
+	// SET after a stream builds on the last frame streamed, not on the
+	// state from before it
+	device dev;
+	CHECK_EQ(dev.status("SET 0 0"), 0xFF);
+	for (int i = 0; i < 3; i += 1)
+		CHECK_EQ(dev.status(push(0xFF)), 0xFF);
+	CHECK_EQ(dev.status("STREAM 1"), 0xFF);
+	dev.tick(10);
+	CHECK_EQ(dev.status("STREAM STOP"), 0xFF);
+	CHECK_EQ(dev.status("SET 0 0"), 0xFF);
+	CHECK(dev.latched() != device::on_chain(std::vector<uint8_t>(sim_frame_size(), 0xFF)));
+	CHECK_EQ(dev.latched()[sim_frame_size() / 2], 0xFF);
+}
+
+TEST(edit_right_after_stop_keeps_stream_frame) {
+	// The stop and the edit arrive together, while frames are still being
+	// popped
+	device dev;
+	for (int i = 0; i < 12; i += 1)
+		CHECK_EQ(dev.status(push(0xFF)), 0xFF);
+	CHECK_EQ(dev.status("STREAM 1"), 0xFF);
+	dev.tick(4);
+	std::vector<std::string> reply = device::split(dev.send("STREAM STOP\rSET 0 0\r"));
+	CHECK(reply.size() >= 2);
+	CHECK_EQ(reply[0], "FF");
+	CHECK_EQ(reply[1], "FF");
+	CHECK_EQ(dev.latched()[sim_frame_size() / 2], 0xFF);
+}
@@ -0,0 +1,153 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * The table driven packer against the packer it replaced: exhaustively over
+ * every mask of every channel, and every pair of masks on neighbouring
+ * channels (which is where channels share a bit), then over a long run of
+ * random incremental updates.
+ */
+
+#include <random>
+
+#include "check.hpp"
+#include "reference_pack.hpp"
+
+extern "C" {
+#include "switch.h"
+}
+
+static std::vector<uint8_t> masks_of(const switches_t &sw) {
+	std::vector<uint8_t> masks(NUM_SWITCHES);
+	for (size_t c = 0; c < NUM_SWITCHES; c += 1)
+		masks[c] = sw.switches[c].byte & 0x1F;
+	return masks;
+}
+
+static void check_pack(switches_t &sw) {
+	std::vector<uint8_t> packed(SWITCHES_FRAME_SIZE), expected(REFERENCE_FRAME_SIZE);
+	switches_pack(&sw, packed.data());
+	reference_pack(masks_of(sw).data(), expected.data());
+	CHECK_EQ(packed, expected);
+}
+
+static void require_stock_chain() {
+	if (NUM_SWITCHES != REFERENCE_CHANNELS || SWITCHES_FRAME_SIZE != REFERENCE_FRAME_SIZE)
+		SKIP("the reference packer only knows the stock chain");
+}
+
+TEST(every_mask_of_every_channel) {
+	require_stock_chain();
+	switches_t sw;
+	for (uint8_t background : {0x00, 0x1F, 0x0A}) {
+		for (size_t c = 0; c < NUM_SWITCHES; c += 1) {
+			switches_all(&sw, background);
+			check_pack(sw);
+			for (uint8_t mask = 0; mask < 32; mask += 1) {
+				switches_set(&sw, c, mask);
+				check_pack(sw);
+			}
+		}
+	}
+}
+
+TEST(every_mask_pair_of_neighbours) {
+	require_stock_chain();
+	switches_t sw;
+	switches_all(&sw, 0x00);
+	for (size_t c = 0; c + 1 < NUM_SWITCHES; c += 1) {
+		for (uint8_t low = 0; low < 32; low += 1) {
+			for (uint8_t high = 0; high < 32; high += 1) {
+				switches_set(&sw, c, low);
+				switches_set(&sw, c + 1, high);
+				check_pack(sw);
+			}
+		}
+		switches_set(&sw, c, 0);
+		switches_set(&sw, c + 1, 0);
+	}
+}
+
+TEST(random_incremental_updates) {
+	require_stock_chain();
+	std::mt19937 rng(12345);
+	switches_t sw;
+	switches_all(&sw, 0x00);
+	for (int n = 0; n < 200000; n += 1) {
+		uint32_t op = rng() % 16;
+		uint8_t mask = rng() % 32;
+		if (op == 0) {
+			switches_all(&sw, mask);
+		} else if (op < 3) {
+			size_t first = rng() % NUM_SWITCHES;
+			size_t last = first + rng() % (NUM_SWITCHES - first);
+			switches_range(&sw, first, last, mask);
+		} else if (op < 5) {
+			uint8_t delta[] = {uint8_t(rng() % NUM_SWITCHES), mask,
+			                   uint8_t(rng() % NUM_SWITCHES), uint8_t(rng() % 32)};
+			CHECK(switches_check_delta(delta, sizeof(delta)));
+			switches_apply_delta(&sw, delta, sizeof(delta));
+		} else {
+			switches_set(&sw, rng() % NUM_SWITCHES, mask);
+		}
+		// Pack only some of the time, so several edits build up in the
+		// dirty groups between packs
+		if (rng() % 3 == 0)
+			check_pack(sw);
+	}
+	check_pack(sw);
+}
+
+TEST(unpack_round_trip) {
+	std::mt19937 rng(54321);
+	switches_t sw, copy;
+	std::vector<uint8_t> frame(SWITCHES_FRAME_SIZE), again(SWITCHES_FRAME_SIZE);
+	for (int n = 0; n < 10000; n += 1) {
+		switches_all(&sw, 0x00);
+		for (size_t c = 0; c < NUM_SWITCHES; c += 1)
+			switches_set(&sw, c, rng() % 32);
+		switches_pack(&sw, frame.data());
+		switches_unpack(&copy, frame.data());
+		switches_pack(&copy, again.data());
+		CHECK_EQ(again, frame);
+	}
+}
+
+TEST(channels_placed_by_board_table) {
+	// Each channel lands on the 5 bits the board table gives it, on any
+	// chain (i.e. make test CHAIN_BOARDS=3)
+	switches_t sw;
+	std::vector<uint8_t> frame(SWITCHES_FRAME_SIZE);
+	for (size_t c = 0; c < NUM_SWITCHES; c += 1) {
+		size_t board = (NUM_SWITCHES - c - 1) / CHANNELS_PER_BOARD;
+		size_t bit = TOPOLOGY_FIRST_BIT(board) + ((NUM_SWITCHES - c - 1) % CHANNELS_PER_BOARD) * 5;
+		switches_all(&sw, 0x00);
+		switches_set(&sw, c, 0x1F);
+		switches_pack(&sw, frame.data());
+		std::vector<uint8_t> expected(SWITCHES_FRAME_SIZE);
+		for (size_t b = bit; b < bit + 5; b += 1)
+			expected[b / 8] |= uint8_t(1u << (b % 8));
+		CHECK_EQ(frame, expected);
+	}
+}
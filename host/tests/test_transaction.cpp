@@ -0,0 +1,137 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Transactions: edits between BEGIN and COMMIT are staged in the switch
+ * state and go out as one frame per chain on COMMIT, latched together
+ * across the selected chains
+ */
+
+#include "check.hpp"
+#include "device.hpp"
+
+static std::vector<uint8_t> pulses;
+static void record_pulse(uint8_t chain) {
+	pulses.push_back(chain);
+}
+
+static uint32_t total_pulses() {
+	uint32_t total = 0;
+	for (uint8_t chain = 0; chain < sim_num_chains(); chain += 1)
+		total += sim_ld_pulses(chain);
+	return total;
+}
+
+/**
+ * Return what chain 0 latches after some commands, run one by one on a
+ * fresh device
+ */
+static std::vector<uint8_t> reference(const std::vector<std::string> &commands) {
+	device dev;
+	for (const std::string &command : commands)
+		CHECK_EQ(dev.status(command), 0xFF);
+	return dev.latched();
+}
+
+TEST(staged_edits_latched_on_commit) {
+	std::vector<uint8_t> expected = reference({"SET 0 A", "SET 3 CE", "SETRANGE 8 11 B"});
+	device dev;
+	std::vector<uint8_t> before = dev.latched();
+	uint32_t start = sim_ld_pulses(0);
+	CHECK_EQ(dev.status("BEGIN"), 0xFF);
+	CHECK_EQ(dev.status("SET 0 A"), 0xFF);
+	CHECK_EQ(dev.status("SET 3 CE"), 0xFF);
+	CHECK_EQ(dev.status("SETRANGE 8 11 B"), 0xFF);
+	dev.tick(5);
+	CHECK_EQ(sim_ld_pulses(0), start);
+	CHECK_EQ(dev.latched(), before);
+	CHECK_EQ(dev.status("COMMIT"), 0xFF);
+	CHECK_EQ(sim_ld_pulses(0), start + 1);
+	CHECK_EQ(dev.latched(), expected);
+}
+
+TEST(commit_latches_chains_together) {
+	if (sim_num_chains() < 2)
+		SKIP("needs several chains");
+	device dev;
+	CHECK_EQ(dev.status("CHAIN ALL"), 0xFF);
+	CHECK_EQ(dev.status("BEGIN"), 0xFF);
+	CHECK_EQ(dev.status("SET 1 AB"), 0xFF);
+	CHECK_EQ(dev.status("SET 20 E"), 0xFF);
+	CHECK_EQ(total_pulses(), 0u);
+	pulses.clear();
+	sim_on_ld(record_pulse);
+	CHECK_EQ(dev.status("COMMIT"), 0xFF);
+	sim_on_ld(NULL);
+	// One pulse per chain, back to back
+	CHECK_EQ(pulses.size(), (size_t)sim_num_chains());
+	for (size_t i = 0; i < pulses.size(); i += 1)
+		CHECK_EQ(pulses[i], i);
+	for (uint8_t chain = 1; chain < sim_num_chains(); chain += 1)
+		CHECK_EQ(dev.latched(chain), dev.latched(0));
+}
+
+TEST(redundant_commit_suppressed) {
+	device dev;
+	CHECK_EQ(dev.status("SET 2 AC"), 0xFF);
+	uint32_t start = total_pulses();
+	// Nothing staged
+	CHECK_EQ(dev.status("BEGIN"), 0xFF);
+	CHECK_EQ(dev.status("COMMIT"), 0xFF);
+	CHECK_EQ(total_pulses(), start);
+	// Edits that end where they started
+	CHECK_EQ(dev.status("BEGIN"), 0xFF);
+	CHECK_EQ(dev.status("SET 2 0"), 0xFF);
+	CHECK_EQ(dev.status("SET 2 AC"), 0xFF);
+	CHECK_EQ(dev.status("COMMIT"), 0xFF);
+	CHECK_EQ(total_pulses(), start);
+	// A second COMMIT after a real one
+	CHECK_EQ(dev.status("BEGIN"), 0xFF);
+	CHECK_EQ(dev.status("SET 2 B"), 0xFF);
+	CHECK_EQ(dev.status("COMMIT"), 0xFF);
+	CHECK_EQ(total_pulses(), start + 1);
+	CHECK_EQ(dev.status("COMMIT"), 0xFF);
+	CHECK_EQ(total_pulses(), start + 1);
+}
+
+TEST(begin_without_commit) {
+	// Staged edits stay in the state, and a second BEGIN doesn't drop
+	// them. A new session ends the transaction, and the next write takes
+	// the staged edits with it.
+	std::vector<uint8_t> expected = reference({"SET 0 A", "SET 1 B", "SET 2 C"});
+	device dev;
+	std::vector<uint8_t> before = dev.latched();
+	CHECK_EQ(dev.status("BEGIN"), 0xFF);
+	CHECK_EQ(dev.status("SET 0 A"), 0xFF);
+	CHECK_EQ(dev.status("BEGIN"), 0xFF);
+	CHECK_EQ(dev.status("SET 1 B"), 0xFF);
+	dev.tick(20);
+	CHECK_EQ(dev.latched(), before);
+
+	sim_reconnect();
+	dev.send("ECHO OFF\r");
+	CHECK_EQ(dev.latched(), before);
+	CHECK_EQ(dev.status("SET 2 C"), 0xFF);
+	CHECK_EQ(dev.latched(), expected);
+}
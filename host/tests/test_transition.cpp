@@ -0,0 +1,158 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Transitions: the intermediate frame latched between the old and new
+ * states. A set bit is an open switch, so break before make latches
+ * old | new and make before break latches old & new.
+ */
+
+#include "check.hpp"
+#include "device.hpp"
+
+extern "C" {
+#include "bin_proto.h"
+#include "timebase.h"
+}
+
+static std::vector<std::vector<uint8_t>> latches;
+static void record_latch(uint8_t chain) {
+	if (chain == 0)
+		latches.push_back(std::vector<uint8_t>(sim_latched(0), sim_latched(0) + sim_frame_size()));
+}
+
+static std::vector<uint8_t> filled(uint8_t byte) {
+	return std::vector<uint8_t>(sim_frame_size(), byte);
+}
+
+/**
+ * Latch old directly, then go to new through a transition, returning the
+ * frames latched on the way
+ */
+static std::vector<std::vector<uint8_t>> transition(device &dev, const char *mode, uint8_t old, uint8_t next) {
+	CHECK_EQ(dev.status("WRITE " + device::hex(filled(old))), 0xFF);
+	CHECK_EQ(dev.status(std::string("TRANSITION ") + mode + " 2"), 0xFF);
+	latches.clear();
+	sim_on_ld(record_latch);
+	CHECK_EQ(dev.status("WRITE " + device::hex(filled(next))), 0xFF);
+	dev.tick(8);
+	sim_on_ld(NULL);
+	return latches;
+}
+
+TEST(break_before_make_opens_first) {
+	device dev;
+	std::vector<std::vector<uint8_t>> seen = transition(dev, "BBM", 0x0F, 0x3C);
+	CHECK_EQ(seen.size(), (size_t)2);
+	CHECK_EQ(seen[0], device::on_chain(filled(0x3F)));
+	CHECK_EQ(seen[1], filled(0x3C));
+}
+
+TEST(make_before_break_closes_first) {
+	device dev;
+	std::vector<std::vector<uint8_t>> seen = transition(dev, "MBB", 0x0F, 0x3C);
+	CHECK_EQ(seen.size(), (size_t)2);
+	CHECK_EQ(seen[0], filled(0x0C));
+	CHECK_EQ(seen[1], filled(0x3C));
+}
+
+TEST(intermediate_skipped_when_unneeded) {
+	// Only switches opening: the make before break frame is the old state
+	device dev;
+	std::vector<std::vector<uint8_t>> seen = transition(dev, "MBB", 0x0F, 0x1F);
+	CHECK_EQ(seen.size(), (size_t)1);
+	CHECK_EQ(seen[0], device::on_chain(filled(0x1F)));
+}
+
+TEST(unknown_state_opens_everything) {
+	// After STOP the chain contents are unknown
+	device dev;
+	CHECK_EQ(dev.status("TRANSITION BBM 2"), 0xFF);
+	CHECK_EQ(dev.status("STOP"), 0xFF);
+	latches.clear();
+	sim_on_ld(record_latch);
+	CHECK_EQ(dev.status("WRITE " + device::hex(filled(0x3C))), 0xFF);
+	dev.tick(8);
+	sim_on_ld(NULL);
+	CHECK_EQ(latches.size(), (size_t)2);
+	CHECK_EQ(latches[0], device::on_chain(filled(0xFF)));
+	CHECK_EQ(latches[1], filled(0x3C));
+}
+
+static std::vector<uint32_t> latch_ticks;
+static void record_latch_tick(uint8_t chain) {
+	if (chain == 0)
+		latch_ticks.push_back(timebase_now());
+}
+
+TEST(dwell_starts_at_intermediate_latch) {
+	// The intermediate frame is held up in the SPI, and the new state still
+	// waits out the whole dwell once it has latched
+	device dev;
+	CHECK_EQ(dev.status("WRITE " + device::hex(filled(0x0F))), 0xFF);
+	CHECK_EQ(dev.status("TRANSITION BBM 3"), 0xFF);
+	sim_hold_spi(1);
+	CHECK_EQ(dev.status("WRITE " + device::hex(filled(0x3C))), 0xFF);
+	dev.tick(6);
+	latch_ticks.clear();
+	sim_on_ld(record_latch_tick);
+	sim_hold_spi(0);
+	dev.tick(10);
+	sim_on_ld(NULL);
+	CHECK_EQ(latch_ticks.size(), (size_t)2);
+	if (latch_ticks.size() == 2)
+		CHECK(latch_ticks[1] - latch_ticks[0] >= 3);
+	CHECK_EQ(dev.latched(), filled(0x3C));
+}
+
+TEST(write_during_transition_refused) {
+	device dev;
+	CHECK_EQ(dev.status("WRITE " + device::hex(filled(0x0F))), 0xFF);
+	CHECK_EQ(dev.status("TRANSITION BBM 5"), 0xFF);
+	CHECK_EQ(dev.status("WRITE " + device::hex(filled(0x3C))), 0xFF);
+	CHECK_EQ(dev.status("WRITE " + device::hex(filled(0xF0))), 0x0A);
+	dev.tick(10);
+	CHECK_EQ(dev.latched(), filled(0x3C));
+	CHECK_EQ(dev.status("WRITE " + device::hex(filled(0xF0))), 0xFF);
+}
+
+TEST(schedule_during_transition_refused) {
+	device dev;
+	CHECK_EQ(dev.status("WRITE " + device::hex(filled(0x0F))), 0xFF);
+	CHECK_EQ(dev.status("TRANSITION BBM 5"), 0xFF);
+	CHECK_EQ(dev.status("WRITE " + device::hex(filled(0x3C))), 0xFF);
+	CHECK_EQ(dev.status("AT +2 " + device::hex(filled(0xF0))), 0x0A);
+
+	std::vector<uint8_t> entry = {1, 2, 0, 0, 0};
+	std::vector<uint8_t> frame = filled(0xF0);
+	entry.insert(entry.end(), frame.begin(), frame.end());
+	CHECK_EQ(dev.send("BINARY\r"), "FF\r\n");
+	CHECK_EQ(dev.send(device::frame(BIN_SCHEDULE, entry)),
+	         device::frame(BIN_SCHEDULE | BIN_REPLY, {USB_TRANSITION_RUNNING}));
+	CHECK_EQ(dev.send(device::frame(BIN_ASCII)), device::frame(BIN_ASCII | BIN_REPLY, {0xFF}));
+
+	dev.tick(10);
+	CHECK_EQ(dev.latched(), filled(0x3C));
+	CHECK_EQ(dev.status("AT +2 " + device::hex(filled(0xF0))), 0xFF);
+}
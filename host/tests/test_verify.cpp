@@ -0,0 +1,73 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Readback verification on the stock chain, which is shorter than a frame:
+ * the frame bits below the first board fall off the far end, so the
+ * readback is the previous frame offset by them
+ */
+
+#include "check.hpp"
+#include "device.hpp"
+
+static std::vector<uint8_t> pattern(uint8_t seed) {
+	std::vector<uint8_t> frame(sim_frame_size());
+	for (size_t i = 0; i < frame.size(); i += 1)
+		frame[i] = uint8_t(0x3Bu * i + seed);
+	return frame;
+}
+
+static std::string report(uint32_t checked, uint32_t mismatches, uint32_t bits) {
+	return "VERIFY ON checked=" + std::to_string(checked) + " mismatches=" +
+			std::to_string(mismatches) + " bits=" + std::to_string(bits);
+}
+
+TEST(stock_chain_is_short) {
+	CHECK_EQ(sim_chain_offset(), (size_t)1);
+}
+
+TEST(clean_chain_verifies) {
+	// Frames with bit 0 set and clear, which never comes back
+	device dev;
+	CHECK_EQ(dev.status("VERIFY ON"), 0xFF);
+	const uint8_t seeds[] = {0xFF, 0x00, 0x01, 0xA5, 0x5A, 0x80};
+	for (uint8_t seed : seeds)
+		CHECK_EQ(dev.status("WRITE " + device::hex(pattern(seed))), 0xFF);
+	CHECK_EQ(dev.lines("VERIFY"), (std::vector<std::string>{report(5, 0, 0), "FF"}));
+}
+
+TEST(readback_fault_counted) {
+	device dev;
+	CHECK_EQ(dev.status("VERIFY ON"), 0xFF);
+	CHECK_EQ(dev.status("WRITE " + device::hex(pattern(1))), 0xFF);
+	sim_set_readback_fault(0, 0x10);
+	CHECK_EQ(dev.status("WRITE " + device::hex(pattern(2))), 0xFF);
+	CHECK_EQ(dev.status("WRITE " + device::hex(pattern(3))), 0xFF);
+	sim_set_readback_fault(0, 0x00);
+	CHECK_EQ(dev.status("WRITE " + device::hex(pattern(4))), 0xFF);
+	uint32_t bits = 2 * uint32_t(sim_frame_size());
+	CHECK_EQ(dev.lines("VERIFY"), (std::vector<std::string>{report(3, 2, bits), "FF"}));
+	CHECK_EQ(dev.status("VERIFY CLEAR"), 0xFF);
+	CHECK_EQ(dev.lines("VERIFY"), (std::vector<std::string>{report(0, 0, 0), "FF"}));
+}
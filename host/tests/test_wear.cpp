@@ -0,0 +1,134 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+ * Wear counting: each switch that changes state on a latch is counted once,
+ * and the counters survive a restart once checkpointed or saved
+ */
+
+#include <cstdlib>
+#include <cstring>
+
+#include "check.hpp"
+#include "device.hpp"
+
+extern "C" {
+#include "wear.h"
+}
+
+/**
+ * Return the A-E counters of a channel on chain 0
+ */
+static std::vector<long> wear(device &dev, unsigned channel) {
+	std::vector<std::string> reply = dev.lines("WEAR " + std::to_string(channel));
+	std::vector<long> counts;
+	if (reply.size() != 2 || reply[1] != "FF")
+		return counts;
+	const char *p = reply[0].c_str();
+	for (const char *name : {" A=", " B=", " C=", " D=", " E="}) {
+		const char *at = std::strstr(p, name);
+		if (at == NULL)
+			return std::vector<long>();
+		counts.push_back(std::strtol(at + 3, NULL, 10));
+	}
+	return counts;
+}
+
+TEST(changed_switches_counted) {
+	device dev;
+	CHECK_EQ(dev.status("SET 3 A"), 0xFF);
+	std::vector<long> before = wear(dev, 3);
+	CHECK_EQ(before.size(), (size_t)5);
+
+	CHECK_EQ(dev.status("SET 3 AB"), 0xFF);
+	CHECK_EQ(dev.status("SET 3 B"), 0xFF);
+	CHECK_EQ(dev.status("SET 3 B"), 0xFF); // Not sent, not counted
+	std::vector<long> after = wear(dev, 3);
+	CHECK_EQ(after[0], before[0] + 1); // A opened
+	CHECK_EQ(after[1], before[1] + 1); // B
+	CHECK_EQ(after[2], before[2]);
+	CHECK_EQ(after[3], before[3]);
+	CHECK_EQ(after[4], before[4]);
+	CHECK_EQ(wear(dev, 4), std::vector<long>(5, 0));
+}
+
+TEST(unknown_outputs_only_taken_as_reference) {
+	// After LOAD the outputs hold whatever was in the shift registers
+	device dev;
+	CHECK_EQ(dev.status("SET 3 A"), 0xFF);
+	std::vector<long> before = wear(dev, 3);
+	CHECK_EQ(dev.status("LOAD"), 0xFF);
+	CHECK_EQ(dev.status("SET 3 C"), 0xFF);
+	CHECK_EQ(wear(dev, 3), before);
+	CHECK_EQ(dev.status("SET 3 0"), 0xFF);
+	CHECK_EQ(wear(dev, 3)[2], before[2] + 1);
+}
+
+TEST(checkpoint_survives_restart) {
+	std::vector<long> saved;
+	{
+		device dev;
+		CHECK_EQ(dev.status("WEAR CLEAR"), 0xFF);
+		CHECK_EQ(dev.status("SET 5 ABCDE"), 0xFF);
+		CHECK_EQ(dev.status("SET 5 0"), 0xFF);
+		dev.tick(WEAR_CHECKPOINT_TICKS);
+		saved = wear(dev, 5);
+		// Counted after the checkpoint, and lost
+		CHECK_EQ(dev.status("SET 5 E"), 0xFF);
+	}
+	device dev(true);
+	CHECK_EQ(wear(dev, 5), saved);
+}
+
+TEST(no_checkpoint_before_due) {
+	{
+		device dev;
+		CHECK_EQ(dev.status("WEAR CLEAR"), 0xFF);
+		CHECK_EQ(dev.status("SET 6 A"), 0xFF);
+		CHECK_EQ(dev.status("SET 6 0"), 0xFF);
+		dev.tick(WEAR_CHECKPOINT_TICKS / 2);
+	}
+	device dev(true);
+	CHECK_EQ(wear(dev, 6), std::vector<long>(5, 0));
+}
+
+TEST(save_and_clear_persist) {
+	std::vector<long> saved;
+	{
+		device dev;
+		CHECK_EQ(dev.status("WEAR CLEAR"), 0xFF);
+		CHECK_EQ(dev.status("SET 7 D"), 0xFF);
+		CHECK_EQ(dev.status("SET 7 0"), 0xFF);
+		CHECK_EQ(dev.status("WEAR SAVE"), 0xFF);
+		saved = wear(dev, 7);
+		CHECK(saved[3] > 0);
+	}
+	{
+		device dev(true);
+		CHECK_EQ(wear(dev, 7), saved);
+		CHECK_EQ(dev.status("WEAR CLEAR"), 0xFF);
+	}
+	device dev(true);
+	CHECK_EQ(wear(dev, 7), std::vector<long>(5, 0));
+}
@@ -22,76 +22,42 @@ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
 DEALINGS IN THE SOFTWARE.
 */
 
-#include <stdio.h>
+// Hardware access goes through the HAL, which includes the generated headers
+#include "hal.h"
 
-// Include generated header files
-#include "project.h"
-
-#include "globals.h"
-#include "usb_utils.h"
-#include "switch.h"
-
-/**
- * Global clock output state
- */
-uint8_t CLK_OUT = 0;
-uint8_t PULSE_LD = 0;
-const char *term = "\r";
+#include "app.h"
 
 /**
- * Write out a pulse on the LD line once the buffer has been cleared
+ * Run the SPI done handling of each chain from its SPIM TX interrupt
  */
 void SPIM_TX_ISR_ExitCallback(void) {
-    if ((SPIM_TX_STATUS_REG & SPIM_STS_SPI_DONE) && (PULSE_LD == 1)) {
-        LD_PulseGen_Write(1u);
-        PULSE_LD = 0;
-    }
+    app_spi_isr(0);
 }
 
+#if NUM_CHAINS > 1
+void SPIM_1_TX_ISR_ExitCallback(void) {
+    app_spi_isr(1);
+}
+#endif
+#if NUM_CHAINS > 2
+void SPIM_2_TX_ISR_ExitCallback(void) {
+    app_spi_isr(2);
+}
+#endif
+#if NUM_CHAINS > 3
+void SPIM_3_TX_ISR_ExitCallback(void) {
+    app_spi_isr(3);
+}
+#endif
+
 
 int main(void)
 {
-    // Buffer used to store current switch state
-    switches_t switch_states;
-    switches_all(&switch_states, 0x00); // Set all closed initially
-
-    // Buffer used to store USB commands
-    usb_buf_t usb_input_buffer;
-    /* Empty the USB input buffer */
-    init_usb_buffer(&usb_input_buffer);
-
-    CyGlobalIntEnable; /* Enable global interrupts. */
-
-    /* Start the SPI interface */
-    SPIM_Start();
-    /* Start USBFS operation with 5-V operation. */
-    USBUART_Start(USBFS_DEVICE, USBUART_5V_OPERATION);
+    app_init();
 
     for(;;)
     {
-        // Check for a USB UART config change
-        // 
-        // If it has changed, reset the buffer, this is an indication
-        // that the connected has restarted
-        if (check_usb_uart_config_change() == USB_CONFIG_CHANGED) {
-            init_usb_buffer(&usb_input_buffer);
-        }
-
-        // Read in USB data
-        if (USBUART_GetConfiguration() != USB_NOT_CONFIGURED) {
-            read_usb_data(&usb_input_buffer);
-
-            // Check whether there is a command terminator in the buffer
-            parse_usb_buffer(&usb_input_buffer, &switch_states);
-        }
-
-        // If the clock output is enabled, constantly fill the TX buffer with
-        // blank bytes
-        if (CLK_OUT) {
-            if (SPIM_GetTxBufferSize() < 4) {
-                SPIM_WriteTxData(0x00);
-            }
-        }
+        app_poll();
     }
 }
 
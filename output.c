@@ -0,0 +1,527 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stddef.h>
+#include <string.h>
+
+#include "hal.h"
+#include "globals.h"
+#include "switch.h"
+#include "output.h"
+#include "stats.h"
+#include "events.h"
+#include "wear.h"
+#include "schedule.h"
+#include "transition.h"
+
+/**
+ * Frame queue of each chain. The frame at the tail is the one being shifted,
+ * and the indices are free running. Each entry has a buffer to pack into,
+ * but may point at a frame stored elsewhere instead.
+ */
+static uint8_t frames[NUM_CHAINS][OUTPUT_QUEUE_DEPTH][SWITCHES_FRAME_SIZE];
+static const uint8_t *queue[NUM_CHAINS][OUTPUT_QUEUE_DEPTH];
+static volatile uint8_t head[NUM_CHAINS] = {0}; // Moved by output_queue
+static volatile uint8_t tail[NUM_CHAINS] = {0}; // Moved by output_next, from the interrupt
+
+/**
+ * Return the frame being shifted out on a chain, or NULL if it is idle
+ */
+static inline const uint8_t *output_active(uint8_t chain) {
+	if (head[chain] == tail[chain])
+		return NULL;
+	return queue[chain][tail[chain] & (OUTPUT_QUEUE_DEPTH - 1)];
+}
+
+/**
+ * Number of frames queued on a chain, including the one being shifted
+ */
+static inline uint8_t output_count(uint8_t chain) {
+	return (uint8_t)(head[chain] - tail[chain]);
+}
+
+/**
+ * Chains started together by output_queue_group, and those of them still
+ * shifting. None of them are latched until all are done.
+ */
+static volatile uint8_t group = 0;
+static volatile uint8_t group_left = 0;
+
+/**
+ * Clock fill pattern, and the number of bytes left to queue in a finite run
+ */
+static uint8_t clock_pattern = 0x00;
+static uint8_t clock_forever = 0;
+static volatile uint16_t clock_left = 0;
+
+#ifdef HAL_HAS_SPI_DIVIDER
+/**
+ * Divider in use before a clock run that set its own, or 0 if the run kept it
+ */
+static uint16_t clock_divider_saved = 0;
+#endif
+
+/**
+ * End a clock run, putting back the divider it replaced. Chain 0 has
+ * stopped shifting by the time this is called.
+ */
+static void output_clock_end(void) {
+	CLK_OUT = 0;
+#ifdef HAL_HAS_SPI_DIVIDER
+	if (clock_divider_saved != 0) {
+		hal_spi_set_divider(clock_divider_saved);
+		clock_divider_saved = 0;
+	}
+#endif
+}
+
+/**
+ * Readback verification. The part of the last frame shifted in that stayed
+ * in the chain is what should come back out of it during the next transfer,
+ * followed by the start of the frame being shifted.
+ */
+static uint8_t verify_on = 0;
+static uint8_t expect[SWITCHES_FRAME_SIZE];
+static uint8_t expect_valid = 0;
+static uint8_t readback[SWITCHES_FRAME_SIZE];
+static output_verify_t verify = {0};
+
+/**
+ * Copy of the last frame queued on each chain, which is what the outputs
+ * hold once it has been latched. Frames matching it don't need to be sent.
+ */
+static uint8_t latched[NUM_CHAINS][SWITCHES_FRAME_SIZE];
+static uint8_t latched_valid[NUM_CHAINS] = {0};
+
+/**
+ * Probe frames, flagged per queue entry of chain 0. They are shifted and
+ * verified, but never latched. The verification state is set aside while
+ * probing.
+ */
+static uint8_t probe[OUTPUT_QUEUE_DEPTH] = {0};
+static uint8_t probe_verify_on = 0;
+static output_verify_t probe_verify;
+
+/*
+ * A frame is put into the SPIM software TX buffer in one go from a critical
+ * section or the SPI interrupt, where SPIM_PutArray would wait forever for
+ * room, so the buffer must hold a whole frame.
+ */
+#ifndef HAL_SIM
+#if SWITCHES_FRAME_SIZE > SPIM_TX_BUFFER_SIZE
+#error "The SPIM TX buffer must hold a whole frame"
+#endif
+#if NUM_CHAINS > 1 && SWITCHES_FRAME_SIZE > SPIM_1_TX_BUFFER_SIZE
+#error "The SPIM_1 TX buffer must hold a whole frame"
+#endif
+#if NUM_CHAINS > 2 && SWITCHES_FRAME_SIZE > SPIM_2_TX_BUFFER_SIZE
+#error "The SPIM_2 TX buffer must hold a whole frame"
+#endif
+#if NUM_CHAINS > 3 && SWITCHES_FRAME_SIZE > SPIM_3_TX_BUFFER_SIZE
+#error "The SPIM_3 TX buffer must hold a whole frame"
+#endif
+#endif
+
+/**
+ * Start shifting out a frame
+ */
+static void output_start(uint8_t chain, const uint8_t *frame) {
+	PULSE_LD |= (1u << chain);
+	// Drop anything received outside of a frame, so the readback lines up
+	hal_spi_rx_clear(chain);
+	hal_spi_put(chain, frame, SWITCHES_FRAME_SIZE);
+}
+
+/**
+ * Return a free frame buffer
+ */
+uint8_t *output_buffer(uint8_t chain) {
+	// Wait for room in the queue. The buffer of the next entry is then free,
+	// as the frame that last used it has been latched.
+	while (output_count(chain) >= OUTPUT_QUEUE_DEPTH);
+	return frames[chain][head[chain] & (OUTPUT_QUEUE_DEPTH - 1)];
+}
+
+/**
+ * Queue a frame to be shifted out
+ */
+void output_queue(uint8_t chain, const uint8_t *frame) {
+	while (output_count(chain) >= OUTPUT_QUEUE_DEPTH);
+	// Frames are queued from the timebase interrupt as well as the main loop,
+	// so only the producers need to hold each other off
+	uint8_t intr = hal_enter_critical();
+	memcpy(latched[chain], frame, SWITCHES_FRAME_SIZE);
+	latched_valid[chain] = 1;
+	if (chain == 0)
+		probe[head[0] & (OUTPUT_QUEUE_DEPTH - 1)] = 0;
+	uint8_t idle = (head[chain] == tail[chain]);
+	queue[chain][head[chain] & (OUTPUT_QUEUE_DEPTH - 1)] = frame;
+	head[chain] += 1;
+	if (idle)
+		output_start(chain, frame);
+	hal_exit_critical(intr);
+}
+
+/**
+ * Shift a frame out on each chain in the mask at once, and latch them
+ * together
+ */
+void output_queue_group(uint8_t mask, const uint8_t *const *group_frames) {
+	// Wait for all of the chains to be idle, so they start together
+	for (uint8_t chain = 0; chain < NUM_CHAINS; chain += 1) {
+		if (mask & (1u << chain))
+			while (output_count(chain) != 0);
+	}
+	uint8_t intr = hal_enter_critical();
+	group = mask;
+	group_left = mask;
+	for (uint8_t chain = 0; chain < NUM_CHAINS; chain += 1) {
+		if (!(mask & (1u << chain)))
+			continue;
+		memcpy(latched[chain], group_frames[chain], SWITCHES_FRAME_SIZE);
+		latched_valid[chain] = 1;
+		if (chain == 0)
+			probe[head[0] & (OUTPUT_QUEUE_DEPTH - 1)] = 0;
+		queue[chain][head[chain] & (OUTPUT_QUEUE_DEPTH - 1)] = group_frames[chain];
+		head[chain] += 1;
+		output_start(chain, group_frames[chain]);
+	}
+	hal_exit_critical(intr);
+}
+
+/**
+ * Start probing chain 0
+ */
+void output_probe_begin(void) {
+	while (output_count(0) != 0);
+	uint8_t intr = hal_enter_critical();
+	probe_verify_on = verify_on;
+	probe_verify = verify;
+	verify_on = 1;
+	verify.checked = 0;
+	verify.mismatches = 0;
+	verify.bit_errors = 0;
+	hal_exit_critical(intr);
+}
+
+/**
+ * Queue a probe frame
+ */
+void output_probe(const uint8_t *frame) {
+	while (output_count(0) >= OUTPUT_QUEUE_DEPTH);
+	uint8_t intr = hal_enter_critical();
+	uint8_t idle = (head[0] == tail[0]);
+	probe[head[0] & (OUTPUT_QUEUE_DEPTH - 1)] = 1;
+	queue[0][head[0] & (OUTPUT_QUEUE_DEPTH - 1)] = frame;
+	head[0] += 1;
+	if (idle)
+		output_start(0, frame);
+	hal_exit_critical(intr);
+}
+
+/**
+ * Finish probing, and return the number of probe frames that didn't read
+ * back correctly
+ */
+uint32_t output_probe_end(void) {
+	while (output_count(0) != 0);
+	uint8_t intr = hal_enter_critical();
+	uint32_t mismatches = verify.mismatches;
+	verify_on = probe_verify_on;
+	verify = probe_verify;
+	hal_exit_critical(intr);
+	return mismatches;
+}
+
+/**
+ * Check a frame against the last one queued
+ */
+uint8_t output_is_latched(uint8_t chain, const uint8_t *frame) {
+	return latched_valid[chain] && memcmp(latched[chain], frame, SWITCHES_FRAME_SIZE) == 0;
+}
+
+/**
+ * Return the last frame queued, if known
+ */
+const uint8_t *output_last(uint8_t chain) {
+	return latched_valid[chain] ? latched[chain] : NULL;
+}
+
+/**
+ * Forget the last frame queued on each chain in the mask
+ */
+void output_invalidate(uint8_t mask) {
+	for (uint8_t chain = 0; chain < NUM_CHAINS; chain += 1) {
+		if (mask & (1u << chain))
+			latched_valid[chain] = 0;
+	}
+}
+
+/**
+ * Return 1 if a frame can be queued without waiting
+ */
+uint8_t output_ready(uint8_t chain) {
+	return output_count(chain) < OUTPUT_QUEUE_DEPTH;
+}
+
+/**
+ * Return 1 if the chains in the mask are idle
+ */
+uint8_t output_idle(uint8_t mask) {
+	for (uint8_t chain = 0; chain < NUM_CHAINS; chain += 1) {
+		if ((mask & (1u << chain)) && output_count(chain) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Abort any transfer in progress
+ */
+void output_stop(void) {
+	uint8_t intr = hal_enter_critical();
+	for (uint8_t chain = 0; chain < NUM_CHAINS; chain += 1) {
+		hal_spi_clear(chain);
+		tail[chain] = head[chain];
+		// The chain contents are unknown after an abort
+		latched_valid[chain] = 0;
+	}
+	group = 0;
+	group_left = 0;
+	PULSE_LD = 0;
+	output_clock_end();
+	clock_left = 0;
+	expect_valid = 0;
+	hal_exit_critical(intr);
+}
+
+/**
+ * Byte k of the bit stream shifted into chain 0: the frame shifted in before
+ * the last transfer, followed by the frame of the last transfer
+ */
+static uint8_t output_stream_byte(const uint8_t *current, size_t k) {
+	if (k < SWITCHES_FRAME_SIZE)
+		return expect[k];
+	k -= SWITCHES_FRAME_SIZE;
+	return (k < SWITCHES_FRAME_SIZE) ? current[k] : 0u;
+}
+
+/**
+ * Compare the bytes read back during the last transfer with what the chain
+ * held before it. The readback starts TOPOLOGY_CHAIN_OFFSET bits into the
+ * frame shifted in before, and ends with that many bits of the last frame.
+ */
+static void output_verify(void) {
+	size_t n = hal_spi_rx_size(0);
+	if (n != SWITCHES_FRAME_SIZE) {
+		// Readback didn't line up with the frame, count it as a mismatch
+		// without comparing
+		hal_spi_rx_clear(0);
+		verify.checked += 1;
+		verify.mismatches += 1;
+		return;
+	}
+	for (size_t i = 0; i < SWITCHES_FRAME_SIZE; i += 1)
+		readback[i] = hal_spi_read(0);
+	const uint8_t *current = output_active(0);
+	uint32_t bits = 0;
+	for (size_t i = 0; i < SWITCHES_FRAME_SIZE; i += 1) {
+		size_t k = i + TOPOLOGY_CHAIN_OFFSET / 8u;
+		uint8_t want = output_stream_byte(current, k) >> (TOPOLOGY_CHAIN_OFFSET % 8u);
+#if TOPOLOGY_CHAIN_OFFSET % 8u != 0
+		want |= (uint8_t)(output_stream_byte(current, k + 1u) << (8u - TOPOLOGY_CHAIN_OFFSET % 8u));
+#endif
+		bits += __builtin_popcount(readback[i] ^ want);
+	}
+	verify.checked += 1;
+	if (bits != 0) {
+		verify.mismatches += 1;
+		verify.bit_errors += bits;
+	}
+}
+
+/**
+ * Finish with the frame that has just been latched on a chain, and start
+ * the next one
+ */
+static void output_next(uint8_t chain) {
+	if (chain == 0) {
+		if (verify_on && expect_valid)
+			output_verify();
+		memcpy(expect, output_active(0), SWITCHES_FRAME_SIZE);
+		expect_valid = 1;
+	}
+	if (chain != 0 || !probe[tail[0] & (OUTPUT_QUEUE_DEPTH - 1)])
+		wear_latch(chain, output_active(chain));
+	PULSE_LD &= ~(1u << chain);
+	tail[chain] += 1;
+	const uint8_t *next = output_active(chain);
+	if (next != NULL)
+		output_start(chain, next);
+}
+
+/**
+ * Report the latch, and report the queue draining if nothing else is left
+ * to shift out
+ */
+static void output_latched(uint8_t chains) {
+	events_record(EVENT_LATCHED, chains);
+	if (chains & 1u)
+		schedule_latched();
+	transition_latched(chains);
+	for (uint8_t c = 0; c < NUM_CHAINS; c += 1) {
+		if (output_count(c) != 0)
+			return;
+	}
+	events_record(EVENT_DRAINED, 0);
+}
+
+/**
+ * Latch the frame that has just been shifted, and start the next one. A
+ * chain in a group waits for the rest of the group, and the last one to
+ * finish latches them all.
+ */
+void output_done(uint8_t chain) {
+	uint8_t bit = 1u << chain;
+	if (chain == 0 && probe[tail[0] & (OUTPUT_QUEUE_DEPTH - 1)]) {
+		output_next(0);
+		return;
+	}
+	if (!(group & bit)) {
+		hal_ld_pulse(chain);
+		if (chain == 0)
+			stats_mark(STAT_MARK_LD);
+		output_next(chain);
+		output_latched(bit);
+		return;
+	}
+
+	group_left &= ~bit;
+	if (group_left != 0)
+		return;
+	uint8_t done = group;
+	group = 0;
+	// Pulse the LD lines back to back before doing anything else
+	for (uint8_t c = 0; c < NUM_CHAINS; c += 1) {
+		if (done & (1u << c))
+			hal_ld_pulse(c);
+	}
+	stats_mark(STAT_MARK_LD);
+	for (uint8_t c = 0; c < NUM_CHAINS; c += 1) {
+		if (done & (1u << c))
+			output_next(c);
+	}
+	output_latched(done);
+}
+
+/**
+ * Queue pattern bytes into the SPIM software buffer, which the SPIM interrupt
+ * drains into the FIFO
+ */
+static void output_clock_refill(void) {
+	while (hal_spi_tx_size() < OUTPUT_CLOCK_REFILL) {
+		if (!clock_forever) {
+			if (clock_left == 0)
+				break;
+			clock_left -= 1;
+		}
+		hal_spi_write(clock_pattern);
+	}
+}
+
+/**
+ * Start clocking out the fill pattern. The SPIM interrupt keeps the software
+ * buffer topped up from then on.
+ */
+uint8_t output_clock_start(uint8_t pattern, uint16_t count, uint16_t divider) {
+	uint8_t intr = hal_enter_critical();
+	if (output_count(0) != 0) {
+		hal_exit_critical(intr);
+		return 0;
+	}
+#ifdef HAL_HAS_SPI_DIVIDER
+	// Chain 0 is idle, so the rate can change here
+	if (divider != 0) {
+		clock_divider_saved = hal_spi_divider();
+		hal_spi_set_divider(divider);
+	}
+#else
+	(void)divider;
+#endif
+	clock_pattern = pattern;
+	clock_forever = (count == 0);
+	expect_valid = 0;
+	clock_left = count;
+	CLK_OUT = 1;
+	output_clock_refill();
+	hal_exit_critical(intr);
+	return 1;
+}
+
+/**
+ * Keep the clock running, and finish a finite run once the last byte has
+ * been shifted out
+ */
+void output_clock_isr(void) {
+	output_clock_refill();
+	if (!clock_forever && clock_left == 0 && hal_spi_done(0))
+		output_clock_end();
+}
+
+/**
+ * Turn readback verification on or off
+ */
+void output_verify_enable(uint8_t enable) {
+	uint8_t intr = hal_enter_critical();
+	// A frame already in flight wasn't captured
+	if (enable && !verify_on)
+		expect_valid = 0;
+	verify_on = enable;
+	hal_exit_critical(intr);
+}
+
+/**
+ * Return 1 if readback verification is on
+ */
+uint8_t output_verify_enabled(void) {
+	return verify_on;
+}
+
+/**
+ * Reset the readback verification counters
+ */
+void output_verify_clear(void) {
+	uint8_t intr = hal_enter_critical();
+	verify.checked = 0;
+	verify.mismatches = 0;
+	verify.bit_errors = 0;
+	hal_exit_critical(intr);
+}
+
+/**
+ * Return the readback verification counters
+ */
+const output_verify_t *output_verify_counts(void) {
+	return &verify;
+}
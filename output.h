@@ -0,0 +1,186 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <stdint.h>
+
+/**
+ * SPI frame output. Each chain has a ring of OUTPUT_QUEUE_DEPTH frames: the
+ * main loop packs and queues frames at the head while the SPI interrupt
+ * shifts and latches them from the tail, so a burst of commands doesn't wait
+ * on the SPI. The interrupt only ever moves the tail, and needs no lock. Each
+ * frame is put into the SPIM software buffer in one go, and the SPIM
+ * interrupt feeds it to the FIFO. The LD line is pulsed from the SPI done
+ * interrupt once each frame has been shifted.
+ *
+ * With the chain's serial output wired back to MISO, the bytes received
+ * while a frame is shifted in are what the chain held: the frame shifted in
+ * before it, from TOPOLOGY_CHAIN_OFFSET on, followed by the start of the
+ * new frame (see topology.h). Readback verification compares the two as
+ * each frame is latched, so the SPIM RX software buffer must hold at least
+ * a full frame.
+ *
+ * Each of the NUM_CHAINS chains has its own buffers and is shifted and
+ * latched independently, except for frames queued as a group, which are
+ * started together and latched together once the slowest has finished.
+ * The fill clock and readback verification are only on chain 0.
+ */
+#define OUTPUT_QUEUE_DEPTH (4u) // Must be a power of two
+
+/**
+ * Readback verification counters
+ */
+typedef struct {
+	uint32_t checked; // Frames compared against the readback
+	uint32_t mismatches; // Frames where the readback differed
+	uint32_t bit_errors; // Total number of differing bits
+} output_verify_t;
+
+/**
+ * Longest finite clock run, in bytes
+ */
+#define OUTPUT_CLOCK_MAX_COUNT (4095u)
+
+/**
+ * Number of bytes kept queued in the SPIM software buffer while the clock
+ * runs, refilled from the SPIM interrupt
+ */
+#define OUTPUT_CLOCK_REFILL (8u)
+
+/**
+ * Return a free frame buffer of a chain to pack the next frame into. If the
+ * queue is full, this waits until the frame being shifted out has been
+ * latched.
+ */
+uint8_t *output_buffer(uint8_t chain);
+
+/**
+ * Queue a frame to be shifted out and latched on a chain. The frame must stay
+ * valid until it has been sent, i.e. a buffer from output_buffer or a stored
+ * table.
+ */
+void output_queue(uint8_t chain, const uint8_t *frame);
+
+/**
+ * Shift out a frame on each chain in the mask concurrently, and latch them
+ * all together. group_frames is indexed by chain. This waits for the chains
+ * to go idle first, so use buffers from output_buffer.
+ */
+void output_queue_group(uint8_t mask, const uint8_t *const *group_frames);
+
+/**
+ * Probe chain 0 by shifting frames through it without latching them, i.e.
+ * to test the link at a new bit rate. Each probe frame is checked against
+ * the readback of the next transfer, as by readback verification, which
+ * must be wired. The verification counters are kept out of it.
+ *
+ * output_probe_begin waits for the chain to go idle, and output_probe_end
+ * waits for the probe frames to be shifted and returns the number that
+ * didn't read back correctly. The shift registers are left holding the
+ * last probe frame, so shift the latched frame back in as the last probe.
+ * Probe frames must stay valid until output_probe_end.
+ */
+void output_probe_begin(void);
+void output_probe(const uint8_t *frame);
+uint32_t output_probe_end(void);
+
+/**
+ * Return 1 if the frame is identical to the last one queued on the chain, so
+ * sending it would leave the outputs unchanged
+ */
+uint8_t output_is_latched(uint8_t chain, const uint8_t *frame);
+
+/**
+ * Forget the last frame queued on each chain in the mask, i.e. after LD has
+ * been pulsed on whatever the shift registers held. The next frame is always
+ * sent.
+ */
+void output_invalidate(uint8_t mask);
+
+/**
+ * Return the last frame queued on a chain, or NULL if it isn't known (i.e.
+ * after output_invalidate)
+ */
+const uint8_t *output_last(uint8_t chain);
+
+/**
+ * Return 1 if another frame can be queued on the chain without waiting
+ */
+uint8_t output_ready(uint8_t chain);
+
+/**
+ * Return 1 if no frame is being shifted out on any chain in the mask
+ */
+uint8_t output_idle(uint8_t mask);
+
+/**
+ * Abort any transfer or clock run in progress on every chain, and drop the
+ * queued frames
+ */
+void output_stop(void);
+
+/**
+ * Called from the SPI done interrupt of a chain. Pulses the LD line, then
+ * starts the next queued frame.
+ */
+void output_done(uint8_t chain);
+
+/**
+ * Start clocking out a fill pattern with no LD pulse. A count of 0 runs until
+ * output_stop, otherwise count bytes (at most OUTPUT_CLOCK_MAX_COUNT) are
+ * sent and CLK_OUT is cleared once they have been shifted. A nonzero divider
+ * sets the shift rate for this run only, and the previous one is put back
+ * when it ends. Returns 0 if a frame is still being shifted out.
+ */
+uint8_t output_clock_start(uint8_t pattern, uint16_t count, uint16_t divider);
+
+/**
+ * Turn readback verification on or off
+ */
+void output_verify_enable(uint8_t enable);
+
+/**
+ * Return 1 if readback verification is on
+ */
+uint8_t output_verify_enabled(void);
+
+/**
+ * Reset the readback verification counters
+ */
+void output_verify_clear(void);
+
+/**
+ * Return the readback verification counters
+ */
+const output_verify_t *output_verify_counts(void);
+
+/**
+ * Called from the SPIM TX interrupt while the clock is running. Tops up the
+ * TX buffer, and ends finite runs.
+ */
+void output_clock_isr(void);
+
+#endif
@@ -0,0 +1,116 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "hal.h"
+#include "preset.h"
+#include "bin_proto.h"
+
+#if PRESET_FIRST_ROW + PRESET_ROWS > HAL_EEPROM_ROWS
+#error "Presets don't fit in the EEPROM"
+#endif
+
+/**
+ * Return the start of a preset row in the EEPROM
+ */
+static inline const uint8_t *preset_row(uint16_t row) {
+	return hal_eeprom_data() + (PRESET_FIRST_ROW + row) * HAL_EEPROM_ROW_SIZE;
+}
+
+/**
+ * Power up the EEPROM
+ */
+void preset_init(void) {
+	hal_eeprom_start();
+}
+
+/**
+ * Store a packed frame in a slot
+ */
+usb_status_t preset_save(uint8_t slot, const uint8_t *frame) {
+	uint8_t rows[PRESET_SLOT_ROWS * HAL_EEPROM_ROW_SIZE];
+
+	if (slot >= PRESET_SLOTS)
+		return USB_INVALID_ARG;
+	memset(rows, 0xFF, sizeof(rows));
+	rows[0] = PRESET_MAGIC;
+	rows[1] = SWITCHES_FRAME_SIZE;
+	rows[2] = bin_crc8(frame, SWITCHES_FRAME_SIZE);
+	rows[3] = 0;
+	memcpy(rows + PRESET_HEADER_SIZE, frame, SWITCHES_FRAME_SIZE);
+
+	uint16_t first = PRESET_FIRST_ROW + 1u + slot * PRESET_SLOT_ROWS;
+	for (uint16_t i = 0; i < PRESET_SLOT_ROWS; i += 1) {
+		// Skip rows that already hold the right data, to save on wear
+		const uint8_t *row = preset_row(1u + slot * PRESET_SLOT_ROWS + i);
+		if (memcmp(row, rows + i * HAL_EEPROM_ROW_SIZE, HAL_EEPROM_ROW_SIZE) == 0)
+			continue;
+		if (!hal_eeprom_write_row(first + i, rows + i * HAL_EEPROM_ROW_SIZE))
+			return USB_OTHER_FAIL;
+	}
+	return USB_SUCCESS;
+}
+
+/**
+ * Return the frame stored in a slot
+ */
+const uint8_t *preset_get(uint8_t slot) {
+	if (slot >= PRESET_SLOTS)
+		return NULL;
+	const uint8_t *data = preset_row(1u + slot * PRESET_SLOT_ROWS);
+	if (data[0] != PRESET_MAGIC || data[1] != SWITCHES_FRAME_SIZE)
+		return NULL;
+	if (bin_crc8(data + PRESET_HEADER_SIZE, SWITCHES_FRAME_SIZE) != data[2])
+		return NULL;
+	return data + PRESET_HEADER_SIZE;
+}
+
+/**
+ * Choose the power on slot
+ */
+usb_status_t preset_set_power_on(uint8_t slot) {
+	uint8_t row[HAL_EEPROM_ROW_SIZE];
+
+	if (slot != PRESET_NONE && preset_get(slot) == NULL)
+		return USB_INVALID_ARG;
+	memset(row, 0xFF, sizeof(row));
+	row[0] = PRESET_MAGIC;
+	row[1] = slot;
+	if (memcmp(preset_row(0), row, sizeof(row)) == 0)
+		return USB_SUCCESS;
+	if (!hal_eeprom_write_row(PRESET_FIRST_ROW, row))
+		return USB_OTHER_FAIL;
+	return USB_SUCCESS;
+}
+
+/**
+ * Return the power on frame
+ */
+const uint8_t *preset_power_on(void) {
+	const uint8_t *config = preset_row(0);
+	if (config[0] != PRESET_MAGIC)
+		return NULL;
+	return preset_get(config[1]);
+}
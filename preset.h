@@ -0,0 +1,79 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __PRESET_H__
+#define __PRESET_H__
+
+#include <stdint.h>
+
+#include "hal.h"
+#include "switch.h"
+#include "usb_utils.h"
+
+/**
+ * Preset slots in EEPROM. Each slot holds an already packed frame, so a
+ * recall is a straight copy into an output buffer. One slot can be chosen
+ * to be shifted out on all chains at power on.
+ *
+ * EEPROM layout, from PRESET_FIRST_ROW:
+ *      row 0: [PRESET_MAGIC] [power on slot, or PRESET_NONE]
+ *      rows 1 + PRESET_SLOT_ROWS*n: slot n,
+ *          [PRESET_MAGIC] [SWITCHES_FRAME_SIZE] [crc8 of frame] [0] [frame]
+ */
+#define PRESET_SLOTS (16u)
+#define PRESET_NONE (0xFFu)
+#define PRESET_MAGIC (0x5Au)
+#define PRESET_FIRST_ROW (0u)
+#define PRESET_HEADER_SIZE (4u)
+#define PRESET_SLOT_ROWS ((PRESET_HEADER_SIZE + SWITCHES_FRAME_SIZE + HAL_EEPROM_ROW_SIZE - 1u) / HAL_EEPROM_ROW_SIZE)
+#define PRESET_ROWS (1u + PRESET_SLOTS * PRESET_SLOT_ROWS)
+
+/**
+ * Power up the EEPROM
+ */
+void preset_init(void);
+
+/**
+ * Store a packed frame in a slot
+ */
+usb_status_t preset_save(uint8_t slot, const uint8_t *frame);
+
+/**
+ * Return the packed frame stored in a slot, or NULL if the slot is empty
+ * or out of range
+ */
+const uint8_t *preset_get(uint8_t slot);
+
+/**
+ * Choose the slot shifted out at power on, or PRESET_NONE to start with all
+ * switches clear
+ */
+usb_status_t preset_set_power_on(uint8_t slot);
+
+/**
+ * Return the power on frame, or NULL if there isn't one
+ */
+const uint8_t *preset_power_on(void);
+
+#endif
@@ -0,0 +1,202 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "hal.h"
+#include "globals.h"
+#include "timebase.h"
+#include "schedule.h"
+#include "output.h"
+
+/**
+ * Queued entries, kept sorted by due tick so the interrupt only ever looks
+ * at the first one
+ */
+typedef struct {
+	uint32_t due;
+	uint8_t frame[SWITCHES_FRAME_SIZE];
+} sched_entry_t;
+
+static sched_entry_t entries[SCHED_MAX_ENTRIES];
+static volatile uint8_t num_entries = 0;
+
+/**
+ * Frame currently being shifted out by the schedule. Entries are popped
+ * before they go out, so the frame is copied here to stay valid. The due
+ * tick is kept until the frame latches, which is when the report is made.
+ */
+static uint8_t frame_out[SWITCHES_FRAME_SIZE];
+static volatile uint8_t in_flight = 0;
+static uint32_t in_flight_due;
+
+/**
+ * Last frame latched by the schedule, waiting to be copied into the switch
+ * state by the main loop
+ */
+static uint8_t frame_latched[SWITCHES_FRAME_SIZE];
+static volatile uint8_t latched_new = 0;
+
+/**
+ * Reports for executed entries, written by the interrupt and read by the
+ * main loop
+ */
+static sched_report_t reports[SCHED_MAX_ENTRIES];
+static volatile uint8_t report_head = 0;
+static volatile uint8_t report_tail = 0;
+
+/**
+ * Compare ticks allowing for the counter wrapping around
+ */
+static inline uint8_t tick_before(uint32_t a, uint32_t b) {
+	return (int32_t)(a - b) < 0;
+}
+
+/**
+ * Queue a frame to be output at the given tick
+ */
+usb_status_t schedule_add(uint32_t due, const uint8_t *frame) {
+	uint8_t intr = hal_enter_critical();
+	if (num_entries >= SCHED_MAX_ENTRIES) {
+		hal_exit_critical(intr);
+		return USB_BUF_OVERFLOW;
+	}
+	// Insert after any entries due at or before this one, so that entries
+	// for the same tick keep the order they were sent in
+	uint8_t i = num_entries;
+	while (i > 0 && tick_before(due, entries[i - 1].due)) {
+		entries[i] = entries[i - 1];
+		i -= 1;
+	}
+	entries[i].due = due;
+	memcpy(entries[i].frame, frame, SWITCHES_FRAME_SIZE);
+	num_entries += 1;
+	hal_exit_critical(intr);
+	return USB_SUCCESS;
+}
+
+/**
+ * Drop all queued entries. The output is stopped along with the schedule,
+ * so a frame in flight never latches and is forgotten too.
+ */
+void schedule_clear(void) {
+	uint8_t intr = hal_enter_critical();
+	num_entries = 0;
+	in_flight = 0;
+	report_tail = report_head;
+	hal_exit_critical(intr);
+}
+
+/**
+ * Return the number of entries waiting to run
+ */
+uint8_t schedule_pending(void) {
+	return num_entries;
+}
+
+/**
+ * Return whether the schedule owns the output
+ */
+uint8_t schedule_busy(void) {
+	return num_entries != 0 || in_flight;
+}
+
+/**
+ * Copy the last latched frame into the switch state
+ */
+void schedule_sync(switches_t *state) {
+	uint8_t frame[SWITCHES_FRAME_SIZE];
+	uint8_t intr = hal_enter_critical();
+	uint8_t fresh = latched_new;
+	if (fresh) {
+		memcpy(frame, frame_latched, SWITCHES_FRAME_SIZE);
+		latched_new = 0;
+	}
+	hal_exit_critical(intr);
+	if (fresh)
+		switches_unpack(state, frame);
+}
+
+/**
+ * Take the oldest report
+ */
+uint8_t schedule_report(sched_report_t *report) {
+	if (report_tail == report_head)
+		return 0;
+	*report = reports[report_tail];
+	report_tail = (report_tail + 1) % SCHED_MAX_ENTRIES;
+	return 1;
+}
+
+/**
+ * Timebase callback, outputs the first entry once it falls due. Only one
+ * frame can be started per tick, so entries due on the same tick are
+ * spread over consecutive ticks, and show up as late.
+ */
+static void schedule_tick(void) {
+	if (num_entries == 0)
+		return;
+	uint32_t now = timebase_now();
+	if (tick_before(now, entries[0].due))
+		return;
+	// Wait for the output to be free
+	if (CLK_OUT || (PULSE_LD & 1u))
+		return;
+
+	memcpy(frame_out, entries[0].frame, SWITCHES_FRAME_SIZE);
+	in_flight_due = entries[0].due;
+	in_flight = 1;
+	output_queue(0, frame_out);
+
+	num_entries -= 1;
+	memmove(&entries[0], &entries[1], num_entries * sizeof(sched_entry_t));
+}
+
+/**
+ * Called from the SPI interrupt when chain 0 latches. Nothing else may write
+ * chain 0 while the schedule is busy, so the latch after a frame is queued
+ * is always that frame.
+ */
+void schedule_latched(void) {
+	if (!in_flight)
+		return;
+	in_flight = 0;
+	memcpy(frame_latched, frame_out, SWITCHES_FRAME_SIZE);
+	latched_new = 1;
+
+	uint8_t next = (report_head + 1) % SCHED_MAX_ENTRIES;
+	if (next != report_tail) {
+		reports[report_head].due = in_flight_due;
+		reports[report_head].late_us = (timebase_now() - in_flight_due) * (1000000u / TIMEBASE_HZ)
+				+ timebase_subtick_us();
+		report_head = next;
+	}
+}
+
+/**
+ * Register the schedule with the timebase
+ */
+void schedule_init(void) {
+	hal_tick_callback(TIMEBASE_SLOT_SCHEDULE, schedule_tick);
+}
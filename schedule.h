@@ -0,0 +1,95 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __SCHEDULE_H__
+#define __SCHEDULE_H__
+
+#include <stdint.h>
+
+#include "switch.h"
+#include "usb_utils.h"
+
+/**
+ * Timed frame output. Frames are queued against the free running timebase
+ * and shifted out from the timebase interrupt on the tick they fall due,
+ * rather than whenever the command happens to be parsed. Each executed
+ * entry leaves a report of how late it actually latched, which the main
+ * loop sends back to the host. While entries are pending the schedule owns
+ * chain 0, and direct writes are refused.
+ */
+#define SCHED_MAX_ENTRIES (32u)
+
+/**
+ * Report for an executed entry
+ */
+typedef struct {
+	uint32_t due; // Tick the entry was scheduled for
+	uint32_t late_us; // Time between the due tick and the frame being latched
+} sched_report_t;
+
+/**
+ * Queue a packed frame to be output at the given tick. Entries may be added
+ * in any order, and an entry that is already due runs on the next tick.
+ */
+usb_status_t schedule_add(uint32_t due, const uint8_t *frame);
+
+/**
+ * Drop all queued entries, the frame in flight and undelivered reports
+ */
+void schedule_clear(void);
+
+/**
+ * Return the number of entries still waiting to run
+ */
+uint8_t schedule_pending(void);
+
+/**
+ * Return whether entries are pending or a scheduled frame has not latched
+ * yet. Nothing else may write chain 0 while this is set.
+ */
+uint8_t schedule_busy(void);
+
+/**
+ * Copy the last frame latched by the schedule into the switch state, if
+ * there is a new one. Called from the main loop, so the state only changes
+ * once a frame has actually gone out.
+ */
+void schedule_sync(switches_t *state);
+
+/**
+ * Called from the SPI interrupt whenever chain 0 latches
+ */
+void schedule_latched(void);
+
+/**
+ * Take the oldest report for an executed entry. Returns 0 if there are none.
+ */
+uint8_t schedule_report(sched_report_t *report);
+
+/**
+ * Register the schedule with the timebase
+ */
+void schedule_init(void);
+
+#endif
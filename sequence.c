@@ -0,0 +1,261 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "hal.h"
+#include "globals.h"
+#include "timebase.h"
+#include "sequence.h"
+#include "output.h"
+#include "stream.h"
+#include "schedule.h"
+#include "transition.h"
+
+/**
+ * Sequence table, stored as packed frames so that each step is a straight
+ * copy into the SPI buffer
+ */
+static uint8_t seq_frames[SEQ_MAX_STEPS][SWITCHES_FRAME_SIZE];
+
+static struct {
+	volatile uint8_t armed;
+	seq_source_t source;
+	size_t length;
+	volatile size_t index;
+	uint32_t count;
+	volatile uint32_t remaining;
+	uint32_t period;
+	volatile uint32_t ticks;
+	uint8_t trig_last;
+} seq = {0};
+
+/**
+ * Copy of the last step queued, which may be from the timebase or trigger
+ * interrupt, until sequence_sync picks it up
+ */
+static uint8_t frame_stepped[SWITCHES_FRAME_SIZE];
+static volatile uint8_t stepped_new = 0;
+
+/**
+ * Empty the sequence table
+ */
+void sequence_clear(void) {
+	sequence_stop();
+	seq.length = 0;
+}
+
+/**
+ * Append a packed frame to the sequence table
+ */
+usb_status_t sequence_add(const uint8_t *frame) {
+	if (seq.armed)
+		return USB_SEQ_RUNNING;
+	if (seq.length >= SEQ_MAX_STEPS)
+		return USB_BUF_OVERFLOW;
+	memcpy(seq_frames[seq.length], frame, SWITCHES_FRAME_SIZE);
+	seq.length += 1;
+	return USB_SUCCESS;
+}
+
+/**
+ * Arm the sequence
+ */
+usb_status_t sequence_run(seq_source_t source, uint32_t count, uint32_t period) {
+	if (seq.length == 0)
+		return USB_INVALID_ARG;
+	if (source == SEQ_TIMER && period == 0)
+		return USB_INVALID_ARG;
+#ifndef HAL_HAS_TRIGGER
+	if (source == SEQ_TRIGGER)
+		return USB_NOT_IMPLEMENTED;
+#endif
+	if (CLK_OUT)
+		return USB_CLOCK_ON;
+	// The stream owns the output until it is stopped, and the schedule
+	// until its entries have gone out
+	if (stream_running() || schedule_busy())
+		return USB_SEQ_RUNNING;
+	if (transition_running())
+		return USB_TRANSITION_RUNNING;
+
+	seq.armed = 0;
+	seq.source = source;
+	seq.index = 0;
+	seq.count = count;
+	seq.remaining = count;
+	seq.period = period;
+	seq.ticks = period;
+#ifdef HAL_HAS_TRIGGER
+	seq.trig_last = hal_trigger_read();
+#endif
+	seq.armed = 1;
+	return USB_SUCCESS;
+}
+
+/**
+ * Stop a running sequence
+ */
+void sequence_stop(void) {
+	seq.armed = 0;
+}
+
+/**
+ * Move on to the next step, ending the sequence after its last pass
+ */
+static void sequence_advance(void) {
+	seq.index += 1;
+	if (seq.index >= seq.length) {
+		seq.index = 0;
+		if (seq.count != 0) {
+			seq.remaining -= 1;
+			if (seq.remaining == 0)
+				seq.armed = 0;
+		}
+	}
+}
+
+/**
+ * Shift out the next frame in the sequence, and advance the index
+ */
+static usb_status_t sequence_next(void) {
+	if (!seq.armed)
+		return USB_INVALID_CMD;
+	if (CLK_OUT)
+		return USB_CLOCK_ON;
+	if (!output_ready(0)) {
+		// The output queue is full. A manual step can be retried, but a
+		// timer or trigger step is skipped, so that the steps after it
+		// still go out on their own ticks or edges.
+		if (seq.source != SEQ_MANUAL)
+			sequence_advance();
+		return USB_BUF_OVERFLOW;
+	}
+
+	// Frames are sent straight out of the table
+	output_queue(0, seq_frames[seq.index]);
+	memcpy(frame_stepped, seq_frames[seq.index], SWITCHES_FRAME_SIZE);
+	stepped_new = 1;
+	sequence_advance();
+	return USB_SUCCESS;
+}
+
+/**
+ * Manually step the sequence
+ */
+usb_status_t sequence_step(void) {
+	if (seq.armed && seq.source == SEQ_MANUAL) {
+		// Another source owns chain 0
+		if (stream_running() || schedule_busy())
+			return USB_SEQ_RUNNING;
+		if (transition_running())
+			return USB_TRANSITION_RUNNING;
+	}
+	return sequence_next();
+}
+
+/**
+ * Copy the last step queued into the switch state
+ */
+void sequence_sync(switches_t *state) {
+	uint8_t frame[SWITCHES_FRAME_SIZE];
+	uint8_t intr = hal_enter_critical();
+	uint8_t fresh = stepped_new;
+	if (fresh) {
+		memcpy(frame, frame_stepped, SWITCHES_FRAME_SIZE);
+		stepped_new = 0;
+	}
+	hal_exit_critical(intr);
+	if (fresh)
+		switches_unpack(state, frame);
+}
+
+/**
+ * Return 1 if the sequence is being stepped outside of the main loop
+ */
+uint8_t sequence_running(void) {
+	// Until its last step is in the switch state, so an edit can't be
+	// packed from the state before it
+	return (seq.armed || stepped_new) && seq.source != SEQ_MANUAL;
+}
+
+/**
+ * Step the sequence on a rising edge of the trigger pin
+ */
+void sequence_poll(void) {
+#if defined(HAL_HAS_TRIGGER) && !defined(HAL_HAS_TRIGGER_ISR)
+	if (!seq.armed || seq.source != SEQ_TRIGGER)
+		return;
+	uint8_t trig = hal_trigger_read();
+	if (trig && !seq.trig_last)
+		sequence_next();
+	seq.trig_last = trig;
+#endif
+}
+
+/**
+ * Return 1 if the trigger input needs polling
+ */
+uint8_t sequence_polling(void) {
+#if defined(HAL_HAS_TRIGGER) && !defined(HAL_HAS_TRIGGER_ISR)
+	return seq.armed && seq.source == SEQ_TRIGGER;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Timebase callback, steps the sequence every period ticks
+ */
+static void sequence_tick(void) {
+	if (!seq.armed || seq.source != SEQ_TIMER)
+		return;
+	seq.ticks -= 1;
+	if (seq.ticks == 0) {
+		seq.ticks = seq.period;
+		sequence_next();
+	}
+}
+
+#ifdef HAL_HAS_TRIGGER_ISR
+/**
+ * Trigger interrupt, steps the sequence on the rising edge itself
+ */
+static void sequence_trigger_isr(void) {
+	hal_trigger_clear();
+	if (seq.armed && seq.source == SEQ_TRIGGER)
+		sequence_next();
+}
+#endif
+
+/**
+ * Register the sequence timer with the timebase, and the trigger interrupt
+ * if there is one
+ */
+void sequence_init(void) {
+	hal_tick_callback(TIMEBASE_SLOT_SEQUENCE, sequence_tick);
+#ifdef HAL_HAS_TRIGGER_ISR
+	hal_trigger_isr(sequence_trigger_isr);
+#endif
+}
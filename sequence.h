@@ -0,0 +1,113 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __SEQUENCE_H__
+#define __SEQUENCE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "switch.h"
+#include "usb_utils.h"
+
+#define SEQ_MAX_STEPS (256u)
+
+/**
+ * Sources that can advance a running sequence by one step
+ */
+typedef enum {
+	SEQ_MANUAL, // Only on the STEP command
+	SEQ_TIMER, // Every period ticks of the timebase
+	SEQ_TRIGGER // On a rising edge of the TRIG pin (if present in the design)
+} seq_source_t;
+
+/**
+ * Empty the sequence table, stopping any running sequence
+ */
+void sequence_clear(void);
+
+/**
+ * Append a packed frame to the sequence table
+ */
+usb_status_t sequence_add(const uint8_t *frame);
+
+/**
+ * Arm the sequence, starting from the first step.
+ * args:
+ *      source: what advances the sequence
+ *      count: number of passes through the table, 0 to loop forever
+ *      period: ticks between steps for SEQ_TIMER
+ * A timer or trigger step that finds the output queue full is skipped, so
+ * later steps stay on time. Fails with USB_SEQ_RUNNING while a stream is
+ * running or the schedule is busy, and USB_TRANSITION_RUNNING while a
+ * transition is.
+ */
+usb_status_t sequence_run(seq_source_t source, uint32_t count, uint32_t period);
+
+/**
+ * Stop a running sequence
+ */
+void sequence_stop(void);
+
+/**
+ * Manually output the next step of an armed sequence. Fails as
+ * sequence_run does if another source owns chain 0.
+ */
+usb_status_t sequence_step(void);
+
+/**
+ * Copy the last step queued into the switch state, if there is a new one.
+ * Called from the main loop as for schedule_sync, and after a manual step,
+ * so that edits after a sequence start from what it left on the outputs.
+ * A step goes out before anything queued after it, so the state can take
+ * it as soon as it is queued.
+ */
+void sequence_sync(switches_t *state);
+
+/**
+ * Return 1 if a sequence is armed on the timer or trigger, or its last step
+ * hasn't been synced into the switch state yet. While this is the case, the
+ * main loop must not write frames itself.
+ */
+uint8_t sequence_running(void);
+
+/**
+ * Poll the trigger input, called from the main loop. Does nothing if the
+ * trigger has its own interrupt.
+ */
+void sequence_poll(void);
+
+/**
+ * Return 1 if the sequence is waiting on the trigger input, which has to be
+ * polled, so the main loop can't sleep
+ */
+uint8_t sequence_polling(void);
+
+/**
+ * Register the sequence timer with the timebase, and the trigger interrupt
+ * if there is one
+ */
+void sequence_init(void);
+
+#endif
@@ -0,0 +1,159 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "hal.h"
+#include "globals.h"
+#include "switch.h"
+#include "output.h"
+#include "sequence.h"
+#include "schedule.h"
+#include "transition.h"
+#include "stream.h"
+#include "speed.h"
+
+#ifdef HAL_HAS_SPI_DIVIDER
+/**
+ * Test patterns: alternating bits both ways round, then two pseudo-random
+ * frames. These have to stay valid until they are shifted out.
+ */
+static uint8_t patterns[SPEED_TEST_FRAMES][SWITCHES_FRAME_SIZE];
+
+/**
+ * Fill in the test patterns
+ */
+static void speed_patterns(void) {
+	uint8_t lfsr = 0xE1;
+	memset(patterns[0], 0x55, SWITCHES_FRAME_SIZE);
+	memset(patterns[1], 0xAA, SWITCHES_FRAME_SIZE);
+	for (size_t f = 2; f < SPEED_TEST_FRAMES; f += 1) {
+		for (size_t i = 0; i < SWITCHES_FRAME_SIZE; i += 1) {
+			// x^8 + x^6 + x^5 + x^4 + 1
+			lfsr = (lfsr >> 1) ^ ((lfsr & 1u) ? 0xB8u : 0x00u);
+			patterns[f][i] = lfsr;
+		}
+	}
+}
+
+/**
+ * Shift the test patterns through chain 0 at a divider, returning 1 if they
+ * all read back. The first pattern is repeated at the end, so the readback
+ * of every pattern is checked at this rate.
+ */
+static uint8_t speed_test(uint16_t divider) {
+	// Wait for chain 0 to be idle before changing the rate
+	output_probe_begin();
+	hal_spi_set_divider(divider);
+	for (size_t f = 0; f < SPEED_TEST_FRAMES; f += 1)
+		output_probe(patterns[f]);
+	output_probe(patterns[0]);
+	return output_probe_end() == 0;
+}
+#endif
+
+/**
+ * Return the current divider
+ */
+uint16_t speed_divider(void) {
+#ifdef HAL_HAS_SPI_DIVIDER
+	return hal_spi_divider();
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Set the divider
+ */
+usb_status_t speed_set(uint32_t divider) {
+#ifdef HAL_HAS_SPI_DIVIDER
+	if (divider < SPEED_MIN_DIVIDER || divider > 0xFFFFu)
+		return USB_INVALID_ARG;
+	if (CLK_OUT)
+		return USB_CLOCK_ON;
+	// Change the rate between frames, not in the middle of one
+	while (!output_idle(1u));
+	hal_spi_set_divider(divider);
+	return USB_SUCCESS;
+#else
+	(void)divider;
+	return USB_NOT_IMPLEMENTED;
+#endif
+}
+
+/**
+ * Calibrate the divider
+ */
+usb_status_t speed_calibrate(void) {
+#ifdef HAL_HAS_SPI_DIVIDER
+	if (CLK_OUT)
+		return USB_CLOCK_ON;
+	// Nothing else may shift or latch while the probes go out
+	if (sequence_running() || stream_running() || transition_running() || schedule_busy())
+		return USB_SEQ_RUNNING;
+
+	const uint16_t start = hal_spi_divider();
+	const uint8_t *latched = output_last(0);
+	uint8_t restore[SWITCHES_FRAME_SIZE];
+	if (latched != NULL)
+		memcpy(restore, latched, SWITCHES_FRAME_SIZE);
+
+	speed_patterns();
+	uint16_t good = 0;
+	if (speed_test(start)) {
+		good = start;
+		while (good > SPEED_MIN_DIVIDER) {
+			uint16_t step = good / 8u;
+			uint16_t next = good - (step ? step : 1u);
+			if (next < SPEED_MIN_DIVIDER)
+				next = SPEED_MIN_DIVIDER;
+			if (!speed_test(next))
+				break;
+			good = next;
+		}
+	}
+
+	usb_status_t status = USB_SUCCESS;
+	uint16_t divider = start;
+	if (good == 0) {
+		status = USB_OTHER_FAIL;
+	} else {
+		uint32_t margin = ((uint32_t)good * SPEED_MARGIN_PERCENT + 99u) / 100u;
+		divider = (good + margin > 0xFFFFu) ? 0xFFFFu : good + margin;
+	}
+	hal_spi_set_divider(divider);
+
+	// Put back what the shift registers held, so a LOAD latches the same
+	// state again. If that wasn't known, neither is it now.
+	if (latched != NULL) {
+		output_probe_begin();
+		output_probe(restore);
+		output_probe_end();
+	}
+	return status;
+#else
+	return USB_NOT_IMPLEMENTED;
+#endif
+}
@@ -0,0 +1,68 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __SPEED_H__
+#define __SPEED_H__
+
+#include <stdint.h>
+
+#include "usb_utils.h"
+
+/**
+ * Shift clock rate. The SPIM of chain 0 is clocked by Clock_1, and its bit
+ * rate is the clock divided down by the divider set here, with a smaller
+ * divider shifting faster. How fast a chain can be shifted depends on its
+ * cabling, so rather than a fixed rate for every rig, the rate can be set
+ * at run time or calibrated.
+ *
+ * Calibration needs the chain's serial output wired back to MISO, as for
+ * readback verification. Starting from the current rate, the divider is
+ * stepped down by an eighth at a time, and at each step a set of test
+ * patterns is shifted through the chain without being latched. Once a
+ * pattern fails to read back, the fastest rate that passed is slowed down
+ * by SPEED_MARGIN_PERCENT and kept. The outputs are never touched, and the
+ * latched frame is shifted back in at the end.
+ */
+#define SPEED_MIN_DIVIDER (2u) // The SPIM needs at least two clocks per bit
+#define SPEED_MARGIN_PERCENT (25u)
+#define SPEED_TEST_FRAMES (4u)
+
+/**
+ * Return the current divider, or 0 if the rate can't be changed
+ */
+uint16_t speed_divider(void);
+
+/**
+ * Set the divider, once chain 0 is idle
+ */
+usb_status_t speed_set(uint32_t divider);
+
+/**
+ * Find the fastest reliable rate, and switch to it. Fails with
+ * USB_OTHER_FAIL, leaving the rate as it was, if the test patterns don't
+ * read back even at the current rate.
+ */
+usb_status_t speed_calibrate(void);
+
+#endif
@@ -0,0 +1,144 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "hal.h"
+#include "stats.h"
+#include "usb_utils.h"
+
+const char *stat_interval_names[STAT_NUM_INTERVALS] = {
+	"PARSE",
+	"DISPATCH",
+	"SHIFT",
+	"LATCH",
+	"TOTAL"
+};
+
+static stats_t stats;
+
+/**
+ * Cycle count of the last time each mark was hit. A mark is only valid
+ * while the mark before it in the path has been hit since, so that the
+ * intervals for frames that weren't started by a command (i.e. sequences)
+ * are not counted against a stale dispatch.
+ */
+static volatile uint32_t marks[STAT_NUM_MARKS];
+static volatile uint8_t valid[STAT_NUM_MARKS];
+
+/**
+ * Packet arrival time of the command being followed down the path
+ */
+static volatile uint32_t cmd_rx;
+
+/**
+ * Start the cycle counter
+ */
+void stats_init(void) {
+	hal_cycles_init();
+	stats_clear();
+}
+
+/**
+ * Clear all counters
+ */
+void stats_clear(void) {
+	uint8_t intr = hal_enter_critical();
+	memset(&stats, 0, sizeof(stats));
+	for (size_t i = 0; i < STAT_NUM_INTERVALS; i += 1)
+		stats.intervals[i].min = UINT32_MAX;
+	memset((void *)valid, 0, sizeof(valid));
+	hal_exit_critical(intr);
+}
+
+/**
+ * Add an interval to a histogram
+ */
+static void stats_record(stat_interval_t interval, uint32_t cycles) {
+	stat_hist_t *h = &stats.intervals[interval];
+	uint8_t bucket = 0;
+	while ((cycles >> bucket) > 1 && bucket < STATS_HIST_BUCKETS - 1)
+		bucket += 1;
+	h->count += 1;
+	if (cycles < h->min)
+		h->min = cycles;
+	if (cycles > h->max)
+		h->max = cycles;
+	h->hist[bucket] += 1;
+}
+
+/**
+ * Stamp a point on the command path. Marks are made from both the main
+ * loop and the SPI interrupt, so the update is done with interrupts off.
+ */
+void stats_mark(stat_mark_t mark) {
+	uint8_t intr = hal_enter_critical();
+	uint32_t now = hal_cycles();
+	marks[mark] = now;
+	valid[mark] = 1;
+	if (mark == STAT_MARK_RX) {
+		hal_exit_critical(intr);
+		return;
+	}
+	if (!valid[mark - 1]) {
+		valid[mark] = 0;
+		hal_exit_critical(intr);
+		return;
+	}
+	// Each interval ends on the mark after its start. A packet can hold
+	// several commands, so RX stays valid until the next one arrives.
+	stats_record((stat_interval_t)(mark - 1), now - marks[mark - 1]);
+	if (mark == STAT_MARK_TERM) {
+		cmd_rx = marks[STAT_MARK_RX];
+	} else {
+		valid[mark - 1] = 0;
+		if (mark == STAT_MARK_LD) {
+			stats_record(STAT_TOTAL, now - cmd_rx);
+			valid[mark] = 0;
+		}
+	}
+	hal_exit_critical(intr);
+}
+
+/**
+ * Count USB input being held off
+ */
+void stats_rx_overflow(void) {
+	stats.rx_overflows += 1;
+}
+
+/**
+ * Count a failed command
+ */
+void stats_status(uint8_t status) {
+	if (status != USB_SUCCESS && status < STATS_NUM_STATUS)
+		stats.status[status] += 1;
+}
+
+/**
+ * Return the counters
+ */
+const stats_t *stats_get(void) {
+	return &stats;
+}
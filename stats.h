@@ -0,0 +1,108 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+
+/**
+ * Hot path instrumentation. Each stage of a command's path is stamped with
+ * the DWT cycle counter, and the time between consecutive stages feeds a
+ * min/max/histogram counter. The histogram is binned by powers of two, i.e.
+ * bucket n counts intervals of 2^n to 2^(n+1)-1 cycles.
+ */
+#define STATS_HIST_BUCKETS (24u)
+#define STATS_NUM_STATUS (16u) // Status codes below this are counted
+
+/**
+ * Points along the path of a command
+ */
+typedef enum {
+	STAT_MARK_RX, // USB packet copied into the input ring
+	STAT_MARK_TERM, // Complete command found by the parser
+	STAT_MARK_DISPATCH, // Frame for the command queued on chain 0
+	STAT_MARK_SPI_DONE, // Frame shifted out
+	STAT_MARK_LD, // LD pulsed
+	STAT_NUM_MARKS
+} stat_mark_t;
+
+/**
+ * Intervals between marks
+ */
+typedef enum {
+	STAT_PARSE, // RX to TERM
+	STAT_DISPATCH, // TERM to DISPATCH, for commands that write a frame
+	STAT_SHIFT, // DISPATCH to SPI_DONE
+	STAT_LATCH, // SPI_DONE to LD
+	STAT_TOTAL, // RX to LD
+	STAT_NUM_INTERVALS
+} stat_interval_t;
+
+typedef struct {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint32_t hist[STATS_HIST_BUCKETS];
+} stat_hist_t;
+
+typedef struct {
+	stat_hist_t intervals[STAT_NUM_INTERVALS];
+	uint32_t rx_overflows; // Times USB input was held off because the input ring was full
+	uint32_t status[STATS_NUM_STATUS]; // Commands that failed, by status code
+} stats_t;
+
+extern const char *stat_interval_names[STAT_NUM_INTERVALS];
+
+/**
+ * Start the cycle counter and clear the counters
+ */
+void stats_init(void);
+
+/**
+ * Clear all counters
+ */
+void stats_clear(void);
+
+/**
+ * Stamp a point on the command path, and record the interval it ends
+ */
+void stats_mark(stat_mark_t mark);
+
+/**
+ * Count USB input being held off
+ */
+void stats_rx_overflow(void);
+
+/**
+ * Count the status returned by a command, if it failed
+ */
+void stats_status(uint8_t status);
+
+/**
+ * Return the counters
+ */
+const stats_t *stats_get(void);
+
+#endif
@@ -0,0 +1,199 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "hal.h"
+#include "globals.h"
+#include "timebase.h"
+#include "output.h"
+#include "stream.h"
+
+/**
+ * Frame FIFO. The main loop pushes at the head, and the timebase interrupt
+ * pops from the tail. Indices are free running.
+ */
+static uint8_t fifo[STREAM_DEPTH][SWITCHES_FRAME_SIZE];
+static volatile uint8_t head = 0;
+static volatile uint8_t tail = 0;
+
+/**
+ * Frame being shifted out. Popped frames are copied here so their FIFO slot
+ * can be refilled straight away.
+ */
+static uint8_t frame_out[SWITCHES_FRAME_SIZE];
+static volatile uint8_t popped_new = 0; // frame_out not yet taken by stream_sync
+
+static volatile uint8_t running = 0;
+static uint32_t period = 1;
+static uint32_t ticks = 0;
+static uint8_t credited = 0; // Tail position last reported back to the host
+static stream_counts_t counts = {0};
+
+/**
+ * Timebase callback, pops a frame every period ticks
+ */
+static void stream_tick(void) {
+	if (!running)
+		return;
+	if (ticks > 1) {
+		ticks -= 1;
+		return;
+	}
+	if (head == tail) {
+		counts.underruns += 1;
+		ticks = period;
+		return;
+	}
+	// Still shifting the last frame, try again on the next tick
+	if (CLK_OUT || (PULSE_LD & 1u)) {
+		counts.late += 1;
+		return;
+	}
+	memcpy(frame_out, fifo[tail & (STREAM_DEPTH - 1)], SWITCHES_FRAME_SIZE);
+	tail += 1;
+	output_queue(0, frame_out);
+	popped_new = 1;
+	counts.popped += 1;
+	ticks = period;
+}
+
+/**
+ * Register the timebase callback
+ */
+void stream_init(void) {
+	hal_tick_callback(TIMEBASE_SLOT_STREAM, stream_tick);
+}
+
+/**
+ * Push a frame
+ */
+usb_status_t stream_push(const uint8_t *frame) {
+	if ((uint8_t)(head - tail) >= STREAM_DEPTH) {
+		counts.overflows += 1;
+		return USB_BUF_OVERFLOW;
+	}
+	memcpy(fifo[head & (STREAM_DEPTH - 1)], frame, SWITCHES_FRAME_SIZE);
+	head += 1;
+	return USB_SUCCESS;
+}
+
+/**
+ * Start the stream
+ */
+usb_status_t stream_start(uint32_t new_period) {
+	if (new_period == 0)
+		return USB_INVALID_ARG;
+	if (CLK_OUT)
+		return USB_CLOCK_ON;
+	uint8_t intr = hal_enter_critical();
+	period = new_period;
+	// The first frame goes out on the next tick
+	ticks = 1;
+	running = 1;
+	hal_exit_critical(intr);
+	return USB_SUCCESS;
+}
+
+/**
+ * Stop the stream. Dropped frames count as popped for credits, so the host
+ * gets all of its credits back.
+ */
+void stream_stop(void) {
+	uint8_t intr = hal_enter_critical();
+	running = 0;
+	tail = head;
+	hal_exit_critical(intr);
+}
+
+/**
+ * Stop the stream and forget outstanding credits
+ */
+void stream_reset(void) {
+	uint8_t intr = hal_enter_critical();
+	running = 0;
+	tail = head;
+	credited = tail;
+	hal_exit_critical(intr);
+}
+
+/**
+ * Copy the last frame popped into the switch state
+ */
+void stream_sync(switches_t *state) {
+	uint8_t frame[SWITCHES_FRAME_SIZE];
+	uint8_t intr = hal_enter_critical();
+	uint8_t fresh = popped_new;
+	if (fresh) {
+		memcpy(frame, frame_out, SWITCHES_FRAME_SIZE);
+		popped_new = 0;
+	}
+	hal_exit_critical(intr);
+	if (fresh)
+		switches_unpack(state, frame);
+}
+
+/**
+ * Return 1 while streaming
+ */
+uint8_t stream_running(void) {
+	return running;
+}
+
+/**
+ * Return the number of queued frames
+ */
+uint8_t stream_queued(void) {
+	return head - tail;
+}
+
+/**
+ * Take the returned credits, once there are enough to be worth sending
+ */
+uint8_t stream_credits(void) {
+	uint8_t popped = tail;
+	uint8_t credits = popped - credited;
+	if (credits == 0)
+		return 0;
+	if (credits < STREAM_CREDIT_BATCH && popped != head)
+		return 0;
+	credited = popped;
+	return credits;
+}
+
+/**
+ * Return the counters
+ */
+const stream_counts_t *stream_counts(void) {
+	return &counts;
+}
+
+/**
+ * Reset the counters
+ */
+void stream_clear_counts(void) {
+	uint8_t intr = hal_enter_critical();
+	memset(&counts, 0, sizeof(counts));
+	hal_exit_critical(intr);
+}
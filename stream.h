@@ -0,0 +1,119 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <stdint.h>
+
+#include "switch.h"
+#include "usb_utils.h"
+
+/**
+ * Live frame streaming. The host pushes packed frames into a FIFO on the
+ * device, and the timebase pops one and shifts it out on chain 0 every
+ * period ticks. Flow control is by credits: the host starts with
+ * STREAM_DEPTH credits, spends one per frame pushed, and gets one back
+ * for each frame that has been popped or dropped by a stop. A tick with
+ * nothing to pop is an underrun, and a tick where the previous frame is
+ * still being shifted is late (the frame goes out on the next tick).
+ */
+#define STREAM_DEPTH (32u) // Must be a power of two
+#define STREAM_CREDIT_BATCH (8u) // Credits are returned in batches of at least this many, unless the FIFO is empty
+
+/**
+ * Streaming counters
+ */
+typedef struct {
+	uint32_t popped; // Frames shifted out
+	uint32_t underruns; // Ticks with an empty FIFO
+	uint32_t late; // Ticks where the output was still busy
+	uint32_t overflows; // Frames pushed without a credit, and dropped
+} stream_counts_t;
+
+/**
+ * Register the stream with the timebase
+ */
+void stream_init(void);
+
+/**
+ * Append a packed frame to the FIFO. Fails with USB_BUF_OVERFLOW if the FIFO
+ * is full, i.e. the host had no credit.
+ */
+usb_status_t stream_push(const uint8_t *frame);
+
+/**
+ * Start popping a frame every period ticks. Frames pushed beforehand go out
+ * first, so the host can fill the FIFO before starting.
+ */
+usb_status_t stream_start(uint32_t period);
+
+/**
+ * Stop streaming and empty the FIFO. The credits for the dropped frames are
+ * returned to the host, and the counters are kept.
+ */
+void stream_stop(void);
+
+/**
+ * Stop streaming and empty the FIFO for a new session. Credits owed to the
+ * last host are forgotten, as the new one starts with STREAM_DEPTH.
+ */
+void stream_reset(void);
+
+/**
+ * Bring the switch state of chain 0 up to date with the last frame popped,
+ * so that edits after a stream start from what it left on the outputs. A
+ * popped frame goes out before anything queued after it, so the state can
+ * take it as soon as it is queued.
+ */
+void stream_sync(switches_t *state);
+
+/**
+ * Return 1 if the stream is running. While this is the case, the main loop
+ * must not write frames itself.
+ */
+uint8_t stream_running(void);
+
+/**
+ * Return the number of frames waiting in the FIFO
+ */
+uint8_t stream_queued(void);
+
+/**
+ * Take the credits returned since the last call. Returns 0 until a batch is
+ * ready.
+ */
+uint8_t stream_credits(void);
+
+/**
+ * Return the streaming counters
+ */
+const stream_counts_t *stream_counts(void);
+
+/**
+ * Reset the streaming counters
+ */
+void stream_clear_counts(void);
+
+#endif
@@ -30,12 +30,134 @@ DEALINGS IN THE SOFTWARE.
 #include <string.h>
 #include <stdio.h>
 
+/**
+ * Return the group of 8 switches that a channel is packed into
+ */
+static inline size_t switches_group(size_t channel) {
+	return (NUM_SWITCHES - channel - 1)/8;
+}
+
+/**
+ * Position of the first bit of a channel in the frame, from the chain
+ * topology
+ */
+#define SWITCHES_BIT(c) (TOPOLOGY_FIRST_BIT((NUM_SWITCHES - (c) - 1u) / CHANNELS_PER_BOARD) + \
+                         ((NUM_SWITCHES - (c) - 1u) % CHANNELS_PER_BOARD) * 5u)
+#define SWITCHES_BYTE(c) ((c) < NUM_SWITCHES ? SWITCHES_BIT(c) / 8u : 0u)
+#define SWITCHES_SHIFT(c) ((c) < NUM_SWITCHES ? SWITCHES_BIT(c) % 8u : 0u)
+
+/* Repeat an entry for channels 0 to 255 */
+#define SWITCHES_REP4(X, n) X(n), X(n + 1u), X(n + 2u), X(n + 3u)
+#define SWITCHES_REP16(X, n) SWITCHES_REP4(X, n), SWITCHES_REP4(X, n + 4u), \
+                             SWITCHES_REP4(X, n + 8u), SWITCHES_REP4(X, n + 12u)
+#define SWITCHES_REP64(X, n) SWITCHES_REP16(X, n), SWITCHES_REP16(X, n + 16u), \
+                             SWITCHES_REP16(X, n + 32u), SWITCHES_REP16(X, n + 48u)
+#define SWITCHES_REP256(X) SWITCHES_REP64(X, 0u), SWITCHES_REP64(X, 64u), \
+                           SWITCHES_REP64(X, 128u), SWITCHES_REP64(X, 192u)
+
+/**
+ * Bit placement tables, built at compile time and stored in flash. Each
+ * channel is packed as 5 contiguous bits, so is described by the byte it
+ * starts in and the shift within that byte. Entries past NUM_SWITCHES are
+ * unused.
+ */
+static const uint8_t ch_byte[256] = {SWITCHES_REP256(SWITCHES_BYTE)};
+static const uint8_t ch_shift[256] = {SWITCHES_REP256(SWITCHES_SHIFT)};
+
+/**
+ * Clear the bits of a channel in a packed frame
+ */
+static inline void switches_clear_bits(uint8_t *frame, size_t channel) {
+	const uint16_t mask = (uint16_t)0x1F << ch_shift[channel];
+	frame[ch_byte[channel]] &= ~(uint8_t)mask;
+	if (ch_shift[channel] > 3)
+		frame[ch_byte[channel] + 1] &= ~(uint8_t)(mask >> 8);
+}
+
+/**
+ * OR the state of a channel into a packed frame
+ */
+static inline void switches_or_bits(uint8_t *frame, const switches_t *switches, size_t channel) {
+	const uint16_t bits = (uint16_t)(switches->switches[channel].byte & 0x1F) << ch_shift[channel];
+	frame[ch_byte[channel]] |= (uint8_t)bits;
+	if (ch_shift[channel] > 3)
+		frame[ch_byte[channel] + 1] |= (uint8_t)(bits >> 8);
+}
+
 /**
  * Set the state of all switches to a given state
  */
 void switches_all(switches_t *switches, uint8_t state) {
 	for (size_t i = 0; i < NUM_SWITCHES; i += 1)
 		switches->switches[i].byte = state & 0x1F;
+	// Bits not connected to a channel are never packed, so start them at 0
+	memset(switches->frame, 0x00, SWITCHES_FRAME_SIZE);
+	switches->dirty = SWITCHES_ALL_GROUPS;
+}
+
+/**
+ * Set the state of a single channel
+ */
+void switches_set(switches_t *switches, size_t channel, uint8_t state) {
+	if (channel >= NUM_SWITCHES)
+		return;
+	state &= 0x1F;
+	if (switches->switches[channel].byte == state)
+		return;
+	switches->switches[channel].byte = state;
+	switches->dirty |= 1u << switches_group(channel);
+}
+
+/**
+ * Set the state of an inclusive range of channels
+ */
+void switches_range(switches_t *switches, size_t first, size_t last, uint8_t state) {
+	if (last >= NUM_SWITCHES)
+		last = NUM_SWITCHES - 1;
+	for (size_t i = first; i <= last; i += 1)
+		switches_set(switches, i, state);
+}
+
+/**
+ * Validate a delta
+ */
+uint8_t switches_check_delta(const uint8_t *delta, size_t len) {
+	size_t i = 0;
+	while (i < len) {
+		if (i + 2 > len)
+			return 0;
+		uint8_t channel = delta[i];
+		uint8_t mask = delta[i + 1];
+		size_t last = channel;
+		i += 2;
+		if (mask & SWITCHES_DELTA_RUN) {
+			if (i >= len)
+				return 0;
+			last += delta[i];
+			i += 1;
+		}
+		if ((mask & ~SWITCHES_DELTA_RUN) > 0x1F || last >= NUM_SWITCHES)
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Apply a delta
+ */
+void switches_apply_delta(switches_t *switches, const uint8_t *delta, size_t len) {
+	size_t i = 0;
+	while (i < len) {
+		uint8_t channel = delta[i];
+		uint8_t mask = delta[i + 1];
+		i += 2;
+		if (mask & SWITCHES_DELTA_RUN) {
+			switches_range(switches, channel, channel + delta[i], mask);
+			i += 1;
+		} else {
+			switches_set(switches, channel, mask);
+		}
+	}
 }
 
 /** 
@@ -51,31 +173,90 @@ uint8_t switches_mask(uint8_t c) {
 }
 
 /**
- * Pack switches into a 20-byte string to be sent over SPI
+ * Parse a combination of switch characters into a mask
+ */
+uint8_t switches_parse_mask(const char *str, uint8_t *mask) {
+	*mask = 0;
+	if (str[0] == '\0')
+		return 0;
+	if (strcmp(str, "0") == 0)
+		return 1;
+	for (size_t i = 0; str[i] != '\0'; i += 1) {
+		uint8_t bit = switches_mask(str[i]);
+		if (bit == 0)
+			return 0;
+		*mask |= bit;
+	}
+	return 1;
+}
+
+/**
+ * Pack switches into a SWITCHES_FRAME_SIZE-byte string to be sent over SPI
  * args:
  *      state: the state of all switches
- *      out_buffer: pointer to at least 20 bytes of memory which will contain
- *          the raw data to be sent over SPI
+ *      out_buffer: pointer to at least SWITCHES_FRAME_SIZE bytes of memory
+ *          which will contain the raw data to be sent over SPI
  */
-typedef union {
-	uint64_t ld;
-	uint8_t b[8];
-} pack_t;
 void switches_pack(switches_t *switches, uint8_t *out_buffer) {
-	// Handle each packing in groups of 40 bits (8 switches)
-	// First let's clear the buffer
-	memset(out_buffer, 0x00, 20);
-
-	// Then in groups of 8, iterate over the switch matrix
-	for (size_t i = 0; i < NUM_SWITCHES/8; i += 1) {
-		pack_t data;
-		data.ld = 0;
-		for (size_t j = 0; j < 8; j += 1) {
-			data.ld |= ((uint64_t)(switches->switches[NUM_SWITCHES - (i*8 + j) - 1].byte & 0x1F)) << (j*5 + (1-i/2));
-		}
-		for (size_t j = 0; j < 6; j += 1) {
-			out_buffer[i*5 + j] |= data.b[j];
-		}
+	// Repack each group of 8 switches which has changed, by clearing the
+	// bits of its channels and ORing them back in. Neighbouring channels
+	// can share a bit (i.e. bit 80), so the channel either side of the
+	// group is ORed back in as well.
+	for (size_t i = 0; i < SWITCHES_NUM_GROUPS; i += 1) {
+		if ((switches->dirty & (1u << i)) == 0)
+			continue;
+		const size_t first = NUM_SWITCHES - i*8 - 8;
+		for (size_t c = first; c < first + 8; c += 1)
+			switches_clear_bits(switches->frame, c);
+		if (first > 0)
+			switches_or_bits(switches->frame, switches, first - 1);
+		for (size_t c = first; c < first + 8; c += 1)
+			switches_or_bits(switches->frame, switches, c);
+		if (first + 8 < NUM_SWITCHES)
+			switches_or_bits(switches->frame, switches, first + 8);
 	}
+	switches->dirty = 0;
+
+	memcpy(out_buffer, switches->frame, SWITCHES_FRAME_SIZE);
 	return;
-}
\ No newline at end of file
+}
+
+/**
+ * Count changed switches
+ */
+void switches_count_changes(const uint8_t *from, const uint8_t *to, uint32_t *counts) {
+	uint8_t diff[SWITCHES_FRAME_SIZE];
+	uint8_t any = 0;
+	for (size_t i = 0; i < SWITCHES_FRAME_SIZE; i += 1) {
+		diff[i] = from[i] ^ to[i];
+		any |= diff[i];
+	}
+	if (any == 0)
+		return;
+	for (size_t c = 0; c < NUM_SWITCHES; c += 1) {
+		const size_t b = ch_byte[c];
+		uint16_t bits = diff[b];
+		if (b + 1 < SWITCHES_FRAME_SIZE)
+			bits |= (uint16_t)diff[b + 1] << 8;
+		uint8_t changed = (bits >> ch_shift[c]) & 0x1F;
+		while (changed != 0) {
+			counts[c*5 + __builtin_ctz(changed)] += 1;
+			changed &= changed - 1;
+		}
+	}
+}
+
+/**
+ * Unpack a packed frame into the switch state
+ */
+void switches_unpack(switches_t *switches, const uint8_t *in_buffer) {
+	for (size_t c = 0; c < NUM_SWITCHES; c += 1) {
+		const size_t b = ch_byte[c];
+		uint16_t bits = in_buffer[b];
+		if (b + 1 < SWITCHES_FRAME_SIZE)
+			bits |= (uint16_t)in_buffer[b + 1] << 8;
+		switches->switches[c].byte = (bits >> ch_shift[c]) & 0x1F;
+	}
+	memset(switches->frame, 0x00, SWITCHES_FRAME_SIZE);
+	switches->dirty = SWITCHES_ALL_GROUPS;
+}
@@ -28,10 +28,21 @@ DEALINGS IN THE SOFTWARE.
 #include <stddef.h>
 #include <stdint.h>
 
-#define NUM_SWITCHES (32u)
+#include "topology.h"
+
+#define SWITCHES_NUM_GROUPS (NUM_SWITCHES/8u) // Switches are packed in groups of 8 (40 bits)
+#define SWITCHES_ALL_GROUPS ((SWITCHES_NUM_GROUPS >= 32u) ? 0xFFFFFFFFu : ((1u << SWITCHES_NUM_GROUPS) - 1u))
+
+#if (NUM_SWITCHES % 8u) != 0 || NUM_SWITCHES > 256u
+#error "NUM_SWITCHES must be a multiple of 8, and at most 256"
+#endif
 
 /* Define a struct for each switch */
-typedef struct __attribute__((packed)) {
+typedef struct {
+    // Cached packing of the whole frame
+    uint8_t frame[SWITCHES_FRAME_SIZE];
+    // Bitmask of groups that have changed since the last pack
+    uint32_t dirty;
     union {
         uint8_t byte;
     	struct __attribute__((packed)) {
@@ -54,15 +65,65 @@ typedef struct __attribute__((packed)) {
 void switches_all(switches_t *switches, uint8_t state);
 
 /**
- * Pack switches into a 20-byte string to be sent over SPI
- * Note: this function corrects for missing SR before bit 80
+ * Set a single channel to a given state
+ * args:
+ *      channel: the channel to set, from 0 to NUM_SWITCHES-1
+ *      state: a bitfield from 0 to 0x1F, as for switches_all
+ */
+void switches_set(switches_t *switches, size_t channel, uint8_t state);
+
+/**
+ * Set an inclusive range of channels to a given state
+ */
+void switches_range(switches_t *switches, size_t first, size_t last, uint8_t state);
+
+/**
+ * Delta updates. A delta is a list of entries, each a channel byte followed
+ * by a mask byte (bits 0-4, as for switches_set). If bit 7 of the mask byte
+ * is set, a count byte follows, and the mask also applies to that many
+ * further channels. Only the groups of 8 switches whose state actually
+ * changes are repacked.
+ */
+#define SWITCHES_DELTA_RUN (0x80u)
+
+/**
+ * Check that a delta is well formed, with every channel in range. Returns 1
+ * if it is valid, 0 otherwise.
+ */
+uint8_t switches_check_delta(const uint8_t *delta, size_t len);
+
+/**
+ * Apply a delta that has passed switches_check_delta
+ */
+void switches_apply_delta(switches_t *switches, const uint8_t *delta, size_t len);
+
+/**
+ * Unpack a packed frame (the inverse of switches_pack) into the switch state.
+ * Note: bits shared between two channels (i.e. bit 80) set both, and bits
+ * not connected to a channel are ignored.
+ */
+void switches_unpack(switches_t *switches, const uint8_t *in_buffer);
+
+/**
+ * Pack switches into a SWITCHES_FRAME_SIZE-byte string to be sent over SPI
+ * Note: bit positions come from the chain topology, which corrects for the
+ * missing SR before bit 80
+ * Only groups of 8 switches that have changed since the last call are
+ * repacked, the rest of the frame is taken from the cached packing.
  * args:
  *      state: the state of all switches
- *      out_buffer: pointer to at least 20 bytes of memory which will contain
- *          the raw data to be sent over SPI
+ *      out_buffer: pointer to at least SWITCHES_FRAME_SIZE bytes of memory
+ *          which will contain the raw data to be sent over SPI
  */
 void switches_pack(switches_t *switches, uint8_t *out_buffer);
 
+/**
+ * Count the switches that differ between two packed frames. counts holds
+ * 5 counters per channel, in mask bit order (E first), and the counter of
+ * each switch that changed is incremented.
+ */
+void switches_count_changes(const uint8_t *from, const uint8_t *to, uint32_t *counts);
+
 /** 
  * Return the bitmask corresponding to a given switch char:
  * i.e. A/a = 16, B/b = 8, C/c = 4, D/d = 2, E/e = 1
@@ -70,4 +131,10 @@ void switches_pack(switches_t *switches, uint8_t *out_buffer);
  */
 uint8_t switches_mask(uint8_t c); 
 
+/**
+ * Parse a mask made of any combination of the characters A-E (i.e. "ACE"),
+ * or "0" for no switches. Returns 0 if the string is invalid, 1 otherwise.
+ */
+uint8_t switches_parse_mask(const char *str, uint8_t *mask);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,59 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "hal.h"
+#include "timebase.h"
+
+/**
+ * Free running tick counter
+ */
+static volatile uint32_t ticks = 0;
+
+static void timebase_tick(void) {
+    ticks += 1;
+}
+
+/**
+ * Start the SysTick timer. CySysTickStart configures a 1ms period.
+ */
+void timebase_init(void) {
+    hal_tick_start();
+    hal_tick_callback(TIMEBASE_SLOT_TICKS, timebase_tick);
+}
+
+/**
+ * Return the number of ticks since timebase_init
+ */
+uint32_t timebase_now(void) {
+    return ticks;
+}
+
+/**
+ * Return the microseconds elapsed within the current tick
+ */
+uint32_t timebase_subtick_us(void) {
+    uint32_t reload = hal_tick_reload();
+    uint32_t elapsed = reload - hal_tick_value();
+    return (elapsed * (1000000u / TIMEBASE_HZ)) / (reload + 1u);
+}
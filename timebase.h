@@ -0,0 +1,59 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __TIMEBASE_H__
+#define __TIMEBASE_H__
+
+#include <stdint.h>
+
+/**
+ * Device timebase, driven by the Cortex-M3 SysTick timer. Modules that need
+ * a periodic hardware tick register a SysTick callback in their own slot.
+ */
+#define TIMEBASE_HZ (1000u)
+
+// SysTick callback slots (at most CY_SYS_SYST_NUM_OF_CALLBACKS)
+#define TIMEBASE_SLOT_TICKS (0u)
+#define TIMEBASE_SLOT_SEQUENCE (1u)
+#define TIMEBASE_SLOT_SCHEDULE (2u)
+#define TIMEBASE_SLOT_TRANSITION (3u)
+#define TIMEBASE_SLOT_STREAM (4u)
+
+/**
+ * Start the SysTick timer and the free running tick counter
+ */
+void timebase_init(void);
+
+/**
+ * Return the number of ticks since timebase_init
+ */
+uint32_t timebase_now(void);
+
+/**
+ * Return the number of microseconds elapsed within the current tick, read
+ * from the SysTick down counter
+ */
+uint32_t timebase_subtick_us(void);
+
+#endif
@@ -0,0 +1,103 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__
+
+#include <stdint.h>
+
+/**
+ * Shift register chain topology. The chain is made up of CHAIN_BOARDS
+ * daisy-chained boards of CHANNELS_PER_BOARD channels each, with 5 bits
+ * (switches A-E) per channel. The position of each board in the packed
+ * frame is given by TOPOLOGY_FIRST_BIT, which is where any gap or dead
+ * bits in the chain are accounted for.
+ */
+#ifndef CHAIN_BOARDS
+#define CHAIN_BOARDS (2u)
+#endif
+#ifndef CHANNELS_PER_BOARD
+#define CHANNELS_PER_BOARD (16u)
+#endif
+
+#define NUM_SWITCHES (CHAIN_BOARDS * CHANNELS_PER_BOARD)
+
+/**
+ * Number of independent chains, each with the same board layout, its own
+ * SPIM and its own LD line. Chain 0 is driven by SPIM and LD_PulseGen,
+ * chain n by SPIM_n and LD_PulseGen_n.
+ */
+#ifndef NUM_CHAINS
+#define NUM_CHAINS (1u)
+#endif
+#if NUM_CHAINS < 1 || NUM_CHAINS > 4
+#error "Between 1 and 4 chains are supported"
+#endif
+#define CHAINS_ALL ((1u << NUM_CHAINS) - 1u)
+
+// Size of a packed frame in bytes
+#ifndef SWITCHES_FRAME_SIZE
+#define SWITCHES_FRAME_SIZE ((NUM_SWITCHES * 5u + 7u) / 8u)
+#endif
+
+/**
+ * Board table: the frame bit holding switch E of the highest channel of
+ * board b, where board 0 holds the highest channels. The rest of the board
+ * follows contiguously, lowest channel last. A macro, so that bit placement
+ * can be worked out at compile time. Define it to describe another chain.
+ *
+ * On the stock chain of two 16 channel boards, the first board is offset by
+ * one bit, as there is no shift register bit before bit 80, so its last bit
+ * lands on the first bit of the second board. Any other chain defaults to
+ * boards following each other with no gaps.
+ */
+#ifndef TOPOLOGY_FIRST_BIT
+#if CHAIN_BOARDS == 2 && CHANNELS_PER_BOARD == 16
+#define TOPOLOGY_FIRST_BIT(b) ((b) == 0u ? 1u : 80u)
+#else
+#define TOPOLOGY_FIRST_BIT(b) ((b) * CHANNELS_PER_BOARD * 5u)
+#endif
+#endif
+
+/**
+ * Physical chain. Board 0 sits at the far end of the chain, and a frame is
+ * shifted in LSB first from byte 0, so the frame bits below board 0 fall off
+ * the far end and the chain holds the rest: TOPOLOGY_CHAIN_BITS bits,
+ * starting at frame bit TOPOLOGY_CHAIN_OFFSET. While a frame is shifted in,
+ * the previous one comes back out starting from that bit.
+ */
+#define TOPOLOGY_CHAIN_OFFSET (TOPOLOGY_FIRST_BIT(0u))
+#define TOPOLOGY_CHAIN_BITS (SWITCHES_FRAME_SIZE * 8u - TOPOLOGY_CHAIN_OFFSET)
+
+/* Every board has to land inside the frame */
+#if TOPOLOGY_FIRST_BIT(0u) + CHANNELS_PER_BOARD * 5u > SWITCHES_FRAME_SIZE * 8u || \
+    TOPOLOGY_FIRST_BIT(CHAIN_BOARDS - 1u) + CHANNELS_PER_BOARD * 5u > SWITCHES_FRAME_SIZE * 8u
+#error "The board table doesn't fit CHAIN_BOARDS boards in SWITCHES_FRAME_SIZE"
+#endif
+
+/* Frames are put to the SPIMs with a u8 count, see also output.c */
+#if SWITCHES_FRAME_SIZE > 255u
+#error "A frame must be at most 255 bytes"
+#endif
+
+#endif
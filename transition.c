@@ -0,0 +1,192 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "hal.h"
+#include "globals.h"
+#include "switch.h"
+#include "timebase.h"
+#include "output.h"
+#include "transition.h"
+
+typedef enum {
+	STEP_IDLE = 0, // Nothing to do
+	STEP_BREAK, // Waiting to queue the intermediate frame
+	STEP_LATCH, // Waiting for the intermediate frame to be latched
+	STEP_DWELL, // Waiting out the dwell time before latching the new state
+	STEP_SETTLE, // Waiting for the new state to be latched
+} transition_step_t;
+
+static transition_mode_t mode = TRANSITION_OFF;
+static uint16_t dwell = 0;
+
+static volatile uint8_t step = STEP_IDLE;
+static uint8_t chains = 0;
+static volatile uint8_t unlatched = 0; // Chains yet to latch the intermediate frame
+static volatile uint32_t due = 0;
+
+/**
+ * Intermediate and final frames for each chain. These have to stay valid
+ * until they are shifted out.
+ */
+static uint8_t between[NUM_CHAINS][SWITCHES_FRAME_SIZE];
+static uint8_t final[NUM_CHAINS][SWITCHES_FRAME_SIZE];
+
+/**
+ * Queue one frame per chain in the transition
+ */
+static void transition_queue(uint8_t (*frames)[SWITCHES_FRAME_SIZE]) {
+	const uint8_t *group_frames[NUM_CHAINS];
+
+	if ((chains & (chains - 1u)) == 0) {
+		for (uint8_t chain = 0; chain < NUM_CHAINS; chain += 1) {
+			if (chains & (1u << chain))
+				output_queue(chain, frames[chain]);
+		}
+		return;
+	}
+	for (uint8_t chain = 0; chain < NUM_CHAINS; chain += 1)
+		group_frames[chain] = frames[chain];
+	output_queue_group(chains, group_frames);
+}
+
+/**
+ * Timebase callback, moves the transition on once the previous frame has
+ * been latched
+ */
+static void transition_tick(void) {
+	if (step == STEP_IDLE)
+		return;
+	if (CLK_OUT || !output_idle(chains))
+		return;
+
+	uint32_t now = timebase_now();
+	switch (step) {
+	case STEP_BREAK:
+		// The dwell starts once the intermediate frame has latched
+		unlatched = chains;
+		step = STEP_LATCH;
+		transition_queue(between);
+		break;
+	case STEP_LATCH:
+		return;
+	case STEP_DWELL:
+		if ((int32_t)(now - due) < 0)
+			return;
+		transition_queue(final);
+		step = STEP_SETTLE;
+		break;
+	default:
+		step = STEP_IDLE;
+		break;
+	}
+}
+
+/**
+ * Called from the SPI interrupt when chains latch. The chains are idle when
+ * the intermediate frame is queued, so their next latch is that frame.
+ */
+void transition_latched(uint8_t latched) {
+	if (step != STEP_LATCH)
+		return;
+	unlatched &= ~latched;
+	if (unlatched == 0) {
+		due = timebase_now() + dwell;
+		step = STEP_DWELL;
+	}
+}
+
+/**
+ * Register the timebase callback
+ */
+void transition_init(void) {
+	step = STEP_IDLE;
+	hal_tick_callback(TIMEBASE_SLOT_TRANSITION, transition_tick);
+}
+
+/**
+ * Set the transition mode and dwell time
+ */
+void transition_configure(transition_mode_t new_mode, uint16_t new_dwell) {
+	mode = new_mode;
+	dwell = new_dwell;
+}
+
+/**
+ * Return the transition mode
+ */
+transition_mode_t transition_mode(void) {
+	return mode;
+}
+
+/**
+ * Pack the intermediate frames and start the transition
+ */
+usb_status_t transition_start(uint8_t mask, const uint8_t *const *frames) {
+	if (step != STEP_IDLE)
+		return USB_TRANSITION_RUNNING;
+
+	uint8_t needed = 0;
+	for (uint8_t chain = 0; chain < NUM_CHAINS; chain += 1) {
+		if (!(mask & (1u << chain)))
+			continue;
+		const uint8_t *last = output_last(chain);
+		memcpy(final[chain], frames[chain], SWITCHES_FRAME_SIZE);
+		// A set bit is open: break before make keeps a switch closed only
+		// if it is closed in both states, make before break if it is
+		// closed in either
+		for (size_t i = 0; i < SWITCHES_FRAME_SIZE; i += 1) {
+			if (mode == TRANSITION_MBB)
+				between[chain][i] = final[chain][i] & (last != NULL ? last[i] : 0xFF);
+			else
+				between[chain][i] = final[chain][i] | (last != NULL ? last[i] : 0xFF);
+		}
+		if (memcmp(between[chain], final[chain], SWITCHES_FRAME_SIZE) != 0
+				&& (last == NULL || memcmp(between[chain], last, SWITCHES_FRAME_SIZE) != 0))
+			needed = 1;
+	}
+
+	uint8_t intr = hal_enter_critical();
+	chains = mask;
+	// Skip the intermediate frame when it wouldn't change anything
+	step = needed ? STEP_BREAK : STEP_DWELL;
+	due = timebase_now();
+	hal_exit_critical(intr);
+	return USB_SUCCESS;
+}
+
+/**
+ * Return 1 while a transition is in progress
+ */
+uint8_t transition_running(void) {
+	return step != STEP_IDLE;
+}
+
+/**
+ * Abandon the transition
+ */
+void transition_stop(void) {
+	step = STEP_IDLE;
+}
@@ -0,0 +1,93 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __TRANSITION_H__
+#define __TRANSITION_H__
+
+#include <stdint.h>
+
+#include "usb_utils.h"
+
+/**
+ * Switch transitions. Rather than latching a new state in one step, a frame
+ * is first latched with only the switches common to the old and new states
+ * closed (break before make), or with both sets closed (make before break).
+ * The new state follows a dwell time after the intermediate frame has been
+ * latched. Both frames are packed up front and shifted from the timebase
+ * interrupt, so the dwell between the two latches is a whole number of ticks
+ * regardless of the main loop or how long the frames take to shift.
+ *
+ * Frames are compared bitwise, since packing only moves bits around. A set
+ * bit is an open switch, so the break before make frame is old | new and
+ * the make before break frame is old & new. Where the old state of a chain
+ * isn't known, break before make opens everything first, and make before
+ * break goes straight to the new state.
+ */
+typedef enum {
+	TRANSITION_OFF = 0, // Latch the new state directly
+	TRANSITION_BBM = 1, // Break before make
+	TRANSITION_MBB = 2, // Make before break
+} transition_mode_t;
+
+/**
+ * Register the transition engine with the timebase
+ */
+void transition_init(void);
+
+/**
+ * Choose how new states are latched, and the dwell time in ticks between the
+ * intermediate frame and the new state
+ */
+void transition_configure(transition_mode_t mode, uint16_t dwell);
+
+/**
+ * Return the current transition mode
+ */
+transition_mode_t transition_mode(void);
+
+/**
+ * Start a transition to a packed frame on each chain in the mask. frames is
+ * indexed by chain, and is copied. Fails with USB_TRANSITION_RUNNING if a
+ * transition is already running.
+ */
+usb_status_t transition_start(uint8_t mask, const uint8_t *const *frames);
+
+/**
+ * Called from the SPI interrupt with the chains that have just latched, to
+ * start the dwell once the intermediate frame is out
+ */
+void transition_latched(uint8_t chains);
+
+/**
+ * Return 1 if a transition hasn't finished latching its new state
+ */
+uint8_t transition_running(void);
+
+/**
+ * Abandon a running transition. Whatever has already been queued still goes
+ * out.
+ */
+void transition_stop(void);
+
+#endif
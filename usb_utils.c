@@ -22,14 +22,27 @@ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
 DEALINGS IN THE SOFTWARE.
 */
 
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <ctype.h>
 
-#include "project.h"
+#include "hal.h"
 #include "globals.h"
 #include "usb_utils.h"
 #include "switch.h"
+#include "bin_proto.h"
+#include "sequence.h"
+#include "output.h"
+#include "schedule.h"
+#include "timebase.h"
+#include "stats.h"
+#include "preset.h"
+#include "events.h"
+#include "transition.h"
+#include "stream.h"
+#include "wear.h"
+#include "speed.h"
 
 const char* parity[] = {"None", "Odd", "Even", "Mark", "Space"};
 const char* stop[]   = {"1", "1.5", "2"};
@@ -41,16 +54,118 @@ const cmd_map_t commands[] = {
 	{"SELECT", CMD_SELECT},
 	{"LOAD", CMD_LOAD},
 	{"CLOCK", CMD_CLOCK},
-	{"STOP", CMD_STOP}
+	{"STOP", CMD_STOP},
+	{"BINARY", CMD_BINARY},
+	{"SET", CMD_SET},
+	{"SETRANGE", CMD_SETRANGE},
+	{"DELTA", CMD_DELTA},
+	{"SEQCLEAR", CMD_SEQCLEAR},
+	{"SEQADD", CMD_SEQADD},
+	{"SEQRUN", CMD_SEQRUN},
+	{"STEP", CMD_STEP},
+	{"ECHO", CMD_ECHO},
+	{"AT", CMD_AT},
+	{"TIME", CMD_TIME},
+	{"CHAIN", CMD_CHAIN},
+	{"SAVE", CMD_SAVE},
+	{"RECALL", CMD_RECALL},
+	{"POWERON", CMD_POWERON},
+	{"BEGIN", CMD_BEGIN},
+	{"COMMIT", CMD_COMMIT},
+	{"STATS", CMD_STATS},
+	{"STATSCLEAR", CMD_STATSCLEAR},
+	{"VERIFY", CMD_VERIFY},
+	{"EVENTS", CMD_EVENTS},
+	{"TRANSITION", CMD_TRANSITION},
+	{"PUSH", CMD_PUSH},
+	{"STREAM", CMD_STREAM},
+	{"WEAR", CMD_WEAR},
+	{"SPEED", CMD_SPEED}
 };
 
+/**
+ * Hash table over commands[], so a command is found with (almost always) a
+ * single comparison. Each slot holds an index into commands[] plus one, or
+ * zero if it is empty.
+ */
+#define CMD_TABLE_SLOTS (64u) // Must be a power of two, and well above the number of commands
+static uint8_t command_table[CMD_TABLE_SLOTS];
+
+/**
+ * Add a character to a command hash. Commands are case insensitive, so
+ * letters are folded to lower case.
+ */
+static inline uint16_t command_hash(uint16_t hash, char c) {
+	return hash * 31u + (uint8_t)tolower((unsigned char)c);
+}
+
+/**
+ * Fill the command hash table
+ */
+static void command_table_init(void) {
+	memset(command_table, 0, sizeof(command_table));
+	for (size_t i = 0; i < sizeof(commands)/sizeof(cmd_map_t); i += 1) {
+		uint16_t hash = 0;
+		for (const char *c = commands[i].cmd_str; *c != '\0'; c += 1)
+			hash = command_hash(hash, *c);
+		uint8_t slot = hash & (CMD_TABLE_SLOTS - 1);
+		while (command_table[slot] != 0)
+			slot = (slot + 1) & (CMD_TABLE_SLOTS - 1);
+		command_table[slot] = i + 1;
+	}
+}
+
+/**
+ * Look up a command given its hash
+ */
+static command_t command_find(uint16_t hash, const char *cmd_str) {
+	uint8_t slot = hash & (CMD_TABLE_SLOTS - 1);
+	while (command_table[slot] != 0) {
+		const cmd_map_t *entry = &commands[command_table[slot] - 1];
+		if (strcasecmp(cmd_str, entry->cmd_str) == 0)
+			return entry->cmd;
+		slot = (slot + 1) & (CMD_TABLE_SLOTS - 1);
+	}
+	return CMD_INVALID;
+}
+
+/**
+ * USB transmit ring buffer. Responses are queued here by write_usb, and
+ * drained a packet at a time by flush_usb.
+ */
+static struct {
+	uint8_t buf[USB_TX_BUFFER_SIZE];
+	uint16_t head; // Free running write index
+	uint16_t tail; // Free running read index
+	uint8_t zlp; // A zero length packet is needed to end the last transfer
+	uint16_t line_start; // Index after the last line ending queued
+	uint8_t dropped; // Part of the current response was dropped
+} usb_tx = {0};
+
+// Longest report or event, as a line or a binary frame
+#define USB_REPORT_MAX (64u)
+
 /**
  * Initialize USB buffer
  */
 usb_status_t init_usb_buffer(usb_buf_t *buf) {
-    memset(buf->buf, 0x00, USBUART_BUFFER_SIZE);
-    buf->buf_size = 0;
-    buf->overflow = 0;
+    memset(buf->buf, 0x00, USB_RX_BUFFER_SIZE);
+    buf->head = buf->tail = 0;
+    buf->frame_waiting = 0;
+    buf->rx_held = 0;
+    usb_line_reset(buf);
+    command_table_init();
+    // A new session always starts in ASCII mode, with verbose echo, and
+    // nothing left to send from the last session
+    BINARY_MODE = 0;
+    ECHO_ON = 1;
+    STAGED = 0;
+    CHAIN_SEL = 1u;
+    events_enable(0);
+    stream_reset();
+    usb_tx.head = usb_tx.tail = usb_tx.line_start = 0;
+    usb_tx.zlp = 0;
+    usb_tx.dropped = 0;
     return USB_SUCCESS;
 }
 
@@ -59,14 +174,14 @@ usb_status_t init_usb_buffer(usb_buf_t *buf) {
  */
 usb_status_t check_usb_uart_config_change(void) {
     // Configure the USB UART interface if the host sends a change configuration request
-    if (USBUART_IsConfigurationChanged())
+    if (hal_usb_config_changed())
     {
         /* Initialize IN endpoints when device is configured. */
-        if (USBUART_GetConfiguration())
+        if (hal_usb_configured())
         {
             /* Enumeration is done, enable OUT endpoint to receive data 
              * from host. */
-            USBUART_CDC_Init();
+            hal_usb_cdc_init();
 
             return USB_CONFIG_CHANGED;
         }
@@ -75,105 +190,680 @@ usb_status_t check_usb_uart_config_change(void) {
 }
 
 /**
- * Send data over USB CDC. Wait until the USB device is ready before putting data.
+ * Free space in the transmit ring
+ */
+static inline uint16_t usb_tx_free(void) {
+	return USB_TX_BUFFER_SIZE - (uint16_t)(usb_tx.head - usb_tx.tail);
+}
+
+/**
+ * Copy data into the transmit ring, which must have room for it
+ */
+static void usb_tx_put(const uint8_t *buffer, size_t len) {
+	for (size_t i = 0; i < len; i += 1) {
+		usb_tx.buf[usb_tx.head & (USB_TX_BUFFER_SIZE - 1)] = buffer[i];
+		usb_tx.head += 1;
+		if (buffer[i] == '\n')
+			usb_tx.line_start = usb_tx.head;
+	}
+}
+
+/**
+ * Queue data to be sent over USB CDC, leaving reserve bytes of the ring
+ * free. The data is sent by flush_usb, which coalesces queued responses
+ * into full packets.
+ */
+static usb_status_t usb_tx_write(const uint8_t *buffer, size_t len, size_t reserve) {
+	// Nothing to do for an empty write
+	if (len == 0)
+		return USB_SUCCESS;
+	if (buffer == NULL)
+		return USB_INVALID_BUF;
+	// The rest of a response that has lost a piece is dropped as well
+	if (usb_tx.dropped && reserve != 0)
+		return USB_BUF_OVERFLOW;
+
+	// Make room by sending a packet if the host has taken the last one, but
+	// never wait for it. A host that stops reading mustn't stall the loop.
+	if (usb_tx_free() < len + reserve)
+		flush_usb();
+	if (usb_tx_free() < len + reserve) {
+		if (reserve != 0 && !usb_tx.dropped && !BINARY_MODE) {
+			// Take back the line in progress, or if some of it has been
+			// sent already, end it out of the reserve so it isn't run into
+			// the status
+			if ((uint16_t)(usb_tx.head - usb_tx.line_start) <= (uint16_t)(usb_tx.head - usb_tx.tail))
+				usb_tx.head = usb_tx.line_start;
+			else if (usb_tx_free() >= 2)
+				usb_tx_put((const uint8_t *)"\r\n", 2);
+		}
+		if (reserve != 0)
+			usb_tx.dropped = 1;
+		return USB_BUF_OVERFLOW;
+	}
+	usb_tx_put(buffer, len);
+	return USB_SUCCESS;
+}
+
+/**
+ * Queue data to be sent
  */
 usb_status_t write_usb(uint8_t *buffer, size_t len) {
-	// Wait until the usb device is ready
-	while (USBUART_CDCIsReady() == USB_NOT_READY);
+	return usb_tx_write(buffer, len, USB_TX_REPLY_RESERVE);
+}
+
+/**
+ * Queue a status reply
+ */
+usb_status_t write_usb_reply(uint8_t *buffer, size_t len) {
+	return usb_tx_write(buffer, len, 0);
+}
+
+/**
+ * Check there is room to queue len bytes
+ */
+uint8_t usb_tx_room(size_t len) {
+	if (usb_tx_free() < len + USB_TX_REPLY_RESERVE)
+		flush_usb();
+	return usb_tx_free() >= len + USB_TX_REPLY_RESERVE;
+}
+
+/**
+ * End a response
+ */
+uint8_t usb_tx_end(void) {
+	uint8_t dropped = usb_tx.dropped;
+	usb_tx.dropped = 0;
+	return dropped;
+}
+
+/**
+ * Send a single packet of queued data, if the USB device is ready.
+ */
+usb_status_t flush_usb(void) {
+	static uint8_t packet[USBUART_BUFFER_SIZE];
+	uint16_t queued = usb_tx.head - usb_tx.tail;
+
+	if (queued == 0 && usb_tx.zlp == 0)
+		return USB_SUCCESS;
+	if (hal_usb_tx_ready() == USB_NOT_READY)
+		return USB_NOT_READY;
 
 	// Check if we want to write a zero-length packet
-	if (len == 0) {
-		USBUART_PutData(NULL, 0);
+	if (queued == 0) {
+		hal_usb_put(NULL, 0);
+		usb_tx.zlp = 0;
 		return USB_SUCCESS;
 	}
 
-	// Check that the buffer is not NULL, and we won't overflow
-	if (buffer == NULL)
-		return USB_INVALID_BUF;
-	if (len > 64)
+	// Otherwise send as much as will fit in a packet
+	size_t len = (queued > USBUART_BUFFER_SIZE) ? USBUART_BUFFER_SIZE : queued;
+	for (size_t i = 0; i < len; i += 1) {
+		packet[i] = usb_tx.buf[usb_tx.tail & (USB_TX_BUFFER_SIZE - 1)];
+		usb_tx.tail += 1;
+	}
+	hal_usb_put(packet, len);
+	/* If the packet is exactly the length of the buffer and there is
+	 * nothing following it, we put a zero length packet to ensure that the
+	 * end of segment is properly identified by the host */
+	usb_tx.zlp = (len == USBUART_BUFFER_SIZE);
+	return USB_SUCCESS;
+}
+
+/**
+ * Check for USB data to handle in either direction
+ */
+uint8_t usb_idle(void) {
+	return !hal_usb_rx_ready() && usb_tx.head == usb_tx.tail && usb_tx.zlp == 0;
+}
+
+/**
+ * Queue a compact status response: two hex digits and a line ending
+ */
+usb_status_t write_status(usb_status_t status) {
+	static const char hex[] = "0123456789ABCDEF";
+	uint8_t response[4];
+	response[0] = hex[(status >> 4) & 0x0F];
+	response[1] = hex[status & 0x0F];
+	response[2] = '\r';
+	response[3] = '\n';
+	return write_usb_reply(response, sizeof(response));
+}
+
+/**
+ * Format an unsigned integer in decimal, returning the number of characters
+ * written (at most 10)
+ */
+static size_t format_uint(uint32_t val, char *out) {
+	char digits[10];
+	size_t n = 0;
+	do {
+		digits[n++] = '0' + (val % 10);
+		val /= 10;
+	} while (val != 0);
+	for (size_t i = 0; i < n; i += 1)
+		out[i] = digits[n - i - 1];
+	return n;
+}
+
+/**
+ * Queue a string, optionally followed by a decimal number
+ */
+static void write_str(const char *str) {
+	write_usb((uint8_t *)str, strlen(str));
+}
+
+static void write_uint(uint32_t val) {
+	char digits[10];
+	write_usb((uint8_t *)digits, format_uint(val, digits));
+}
+
+/**
+ * Dump the latency and error counters. Each interval is written as
+ *      <name> count=<n> min=<cycles> max=<cycles> hist=<b0>,<b1>,...
+ * with the histogram cut off after its last non-empty bucket, followed by
+ * the count of times USB input was held off and the number of failures for each status.
+ */
+usb_status_t write_stats(void) {
+	const stats_t *stats = stats_get();
+	for (size_t i = 0; i < STAT_NUM_INTERVALS; i += 1) {
+		const stat_hist_t *h = &stats->intervals[i];
+		size_t last = 0;
+		for (size_t b = 0; b < STATS_HIST_BUCKETS; b += 1) {
+			if (h->hist[b] != 0)
+				last = b;
+		}
+		write_str(stat_interval_names[i]);
+		write_str(" count=");
+		write_uint(h->count);
+		write_str(" min=");
+		write_uint(h->count ? h->min : 0);
+		write_str(" max=");
+		write_uint(h->max);
+		write_str(" hist=");
+		for (size_t b = 0; b <= last; b += 1) {
+			if (b != 0)
+				write_str(",");
+			write_uint(h->hist[b]);
+		}
+		write_str("\r\n");
+	}
+	write_str("RX_OVERFLOW ");
+	write_uint(stats->rx_overflows);
+	write_str("\r\nSTATUS");
+	for (size_t s = 0; s < STATS_NUM_STATUS; s += 1) {
+		if (stats->status[s] == 0)
+			continue;
+		write_str(" ");
+		write_uint(s);
+		write_str("=");
+		write_uint(stats->status[s]);
+	}
+	write_str("\r\n");
+	return USB_SUCCESS;
+}
+
+/**
+ * Report the readback verification counters
+ */
+usb_status_t write_verify(void) {
+	const output_verify_t *verify = output_verify_counts();
+	write_str(output_verify_enabled() ? "VERIFY ON checked=" : "VERIFY OFF checked=");
+	write_uint(verify->checked);
+	write_str(" mismatches=");
+	write_uint(verify->mismatches);
+	write_str(" bits=");
+	write_uint(verify->bit_errors);
+	write_str("\r\n");
+	return USB_SUCCESS;
+}
+
+/**
+ * Send reports for executed scheduled frames
+ */
+usb_status_t write_schedule_reports(void) {
+	sched_report_t report;
+	// Reports wait in their queue until there is room to send them
+	while (usb_tx_room(USB_REPORT_MAX) && schedule_report(&report)) {
+		if (BINARY_MODE) {
+			uint8_t payload[8];
+			for (size_t i = 0; i < 4; i += 1) {
+				payload[i] = report.due >> (8*i);
+				payload[4 + i] = report.late_us >> (8*i);
+			}
+			bin_event(BIN_SCHEDULE, payload, sizeof(payload));
+		} else {
+			char line[3 + 10 + 1 + 10 + 2];
+			size_t len = 0;
+			memcpy(line, "AT ", 3);
+			len += 3;
+			len += format_uint(report.due, line + len);
+			line[len++] = ' ';
+			len += format_uint(report.late_us, line + len);
+			line[len++] = '\r';
+			line[len++] = '\n';
+			write_usb((uint8_t *)line, len);
+		}
+	}
+	return USB_SUCCESS;
+}
+
+/**
+ * Dump the streaming counters
+ */
+usb_status_t write_stream_status(void) {
+	const stream_counts_t *counts = stream_counts();
+	write_str(stream_running() ? "STREAM RUNNING" : "STREAM STOPPED");
+	write_str(" queued=");
+	write_uint(stream_queued());
+	write_str(" popped=");
+	write_uint(counts->popped);
+	write_str(" underruns=");
+	write_uint(counts->underruns);
+	write_str(" late=");
+	write_uint(counts->late);
+	write_str(" overflows=");
+	write_uint(counts->overflows);
+	write_str("\r\n");
+	return USB_SUCCESS;
+}
+
+/**
+ * Dump the wear counters of a channel, or of all channels if channel is
+ * NUM_SWITCHES, on the selected chains
+ */
+usb_status_t write_wear(size_t channel) {
+	size_t first = (channel < NUM_SWITCHES) ? channel : 0;
+	size_t last = (channel < NUM_SWITCHES) ? channel : NUM_SWITCHES - 1;
+	FOR_EACH_SELECTED_CHAIN(chain) {
+		const uint32_t *counts = wear_counts(chain);
+		for (size_t c = first; c <= last; c += 1) {
+			write_str("WEAR ");
+			write_uint(chain);
+			write_str(":");
+			write_uint(c);
+			// Counters are in mask bit order, E first
+			for (size_t s = 0; s < 5; s += 1) {
+				static const char *const names[] = {" A=", " B=", " C=", " D=", " E="};
+				write_str(names[s]);
+				write_uint(counts[c*5 + 4 - s]);
+			}
+			write_str("\r\n");
+		}
+	}
+	return USB_SUCCESS;
+}
+
+/**
+ * Report the shift clock divider
+ */
+usb_status_t write_speed(void) {
+	write_str("SPEED ");
+	write_uint(speed_divider());
+	write_str("\r\n");
+	return USB_SUCCESS;
+}
+
+/**
+ * Return stream credits to the host
+ */
+usb_status_t write_stream_credits(void) {
+	if (!usb_tx_room(USB_REPORT_MAX))
 		return USB_BUF_OVERFLOW;
+	uint8_t credits = stream_credits();
+	if (credits == 0)
+		return USB_SUCCESS;
+	if (BINARY_MODE)
+		return bin_event(BIN_CREDIT, &credits, 1);
+	write_str("CREDIT ");
+	write_uint(credits);
+	write_str("\r\n");
+	return USB_SUCCESS;
+}
 
-	// Otherwise write data
-	USBUART_PutData(buffer, len);
-	/* If the packet is exactly the length of the buffer, we put a zero
-	 * length packet to ensure that the end of segment is properly 
-	 * identified by the host */
-	if (len == USBUART_BUFFER_SIZE)
-		return write_usb(NULL, 0);
+/**
+ * Send completion events
+ */
+usb_status_t write_events(void) {
+	event_t event;
+	while (usb_tx_room(USB_REPORT_MAX) && events_take(&event)) {
+		if (BINARY_MODE) {
+			uint8_t payload[10];
+			payload[0] = event.type;
+			payload[1] = event.chains;
+			payload[2] = event.seq;
+			payload[3] = event.seq >> 8;
+			for (size_t i = 0; i < 4; i += 1)
+				payload[4 + i] = event.tick >> (8*i);
+			payload[8] = event.us;
+			payload[9] = event.us >> 8;
+			bin_event(BIN_EVENTS, payload, sizeof(payload));
+		} else {
+			char line[8 + 4*(10 + 1) + 2];
+			size_t len = 0;
+			if (event.type == EVENT_LATCHED) {
+				memcpy(line, "LD ", 3);
+				len += 3;
+			} else {
+				memcpy(line, "DRAINED ", 8);
+				len += 8;
+			}
+			len += format_uint(event.seq, line + len);
+			line[len++] = ' ';
+			len += format_uint(event.tick, line + len);
+			line[len++] = ' ';
+			len += format_uint(event.us, line + len);
+			if (event.type == EVENT_LATCHED) {
+				line[len++] = ' ';
+				len += format_uint(event.chains, line + len);
+			}
+			line[len++] = '\r';
+			line[len++] = '\n';
+			write_usb((uint8_t *)line, len);
+		}
+	}
+	return USB_SUCCESS;
+}
+
+/**
+ * Shift a frame out on each selected chain, either a given frame or each
+ * chain's packed state. The LD lines are pulsed from the TX ISRs once the
+ * transfers have completed. Nothing is sent while a transaction is staged,
+ * or to chains where the frame is already latched.
+ */
+static usb_status_t write_chains(switches_t *state, const uint8_t *frame) {
+	const uint8_t *group_frames[NUM_CHAINS];
+	uint8_t send = 0;
+
+	if (STAGED)
+		return USB_SUCCESS;
+	if (CLK_OUT)
+		return USB_CLOCK_ON;
+	if (sequence_running() || stream_running() || schedule_busy())
+		return USB_SEQ_RUNNING;
+	if (transition_running())
+		return USB_TRANSITION_RUNNING;
+	FOR_EACH_SELECTED_CHAIN(chain) {
+		uint8_t *out;
+		if (frame != NULL) {
+			if (output_is_latched(chain, frame))
+				continue;
+			out = output_buffer(chain);
+			memcpy(out, frame, SWITCHES_FRAME_SIZE);
+		} else {
+			out = output_buffer(chain);
+			switches_pack(&state[chain], out);
+			// The buffer is left free if the frame doesn't need to go out
+			if (output_is_latched(chain, out))
+				continue;
+		}
+		group_frames[chain] = out;
+		send |= (1u << chain);
+	}
+
+	if (send == 0)
+		return USB_SUCCESS;
+	// Only commands that put out a frame on chain 0 are followed on to LD,
+	// so a command that writes nothing doesn't leave a stale dispatch
+	if (send & 1u)
+		stats_mark(STAT_MARK_DISPATCH);
+	if (transition_mode() != TRANSITION_OFF)
+		return transition_start(send, group_frames);
+	// A single chain keeps double buffering, several are latched together
+	if ((send & (send - 1u)) == 0) {
+		FOR_EACH_SELECTED_CHAIN(chain) {
+			if (send & (1u << chain))
+				output_queue(chain, group_frames[chain]);
+		}
+	} else {
+		output_queue_group(send, group_frames);
+	}
+	return USB_SUCCESS;
+}
+
+/**
+ * Shift a packed frame out on the selected chains
+ */
+usb_status_t write_frame(const uint8_t *frame) {
+	return write_chains(NULL, frame);
+}
 
-	// Succcessful write :)
+/**
+ * Pack the switch state of the selected chains into their next output
+ * buffers and shift them out
+ */
+usb_status_t write_switches(switches_t *state) {
+	return write_chains(state, NULL);
+}
+
+/**
+ * Write a preset to the selected chains. The stored frame goes straight out,
+ * and the switch state is only brought up to date afterwards.
+ */
+usb_status_t recall_preset(switches_t *state, uint8_t slot) {
+	const uint8_t *frame = preset_get(slot);
+	if (frame == NULL)
+		return USB_INVALID_ARG;
+	usb_status_t status = write_frame(frame);
+	if (status != USB_SUCCESS)
+		return status;
+	FOR_EACH_SELECTED_CHAIN(chain)
+		switches_unpack(&state[chain], frame);
+	return USB_SUCCESS;
+}
+
+/**
+ * Start the clock output
+ */
+usb_status_t start_clock(uint8_t pattern, uint32_t count, uint32_t divider) {
+	if (CLK_OUT)
+		return USB_CLOCK_ON;
+	if (sequence_running() || stream_running())
+		return USB_SEQ_RUNNING;
+	if (count > OUTPUT_CLOCK_MAX_COUNT || divider > 0xFFFF)
+		return USB_INVALID_ARG;
+#ifndef HAL_HAS_SPI_DIVIDER
+	if (divider != 0)
+		return USB_NOT_IMPLEMENTED;
+#endif
+	if (output_clock_start(pattern, count, divider) == 0)
+		return USB_BUF_OVERFLOW;
 	return USB_SUCCESS;
 }
 
+/**
+ * Copy unparsed bytes out of the input ring into a linear buffer
+ */
+void usb_buf_copy(const usb_buf_t *buf, uint16_t offset, uint8_t *out, size_t len) {
+    for (size_t i = 0; i < len; i += 1)
+        out[i] = usb_buf_peek(buf, offset + i);
+}
+
 /**
  * Read data in from the USB device and place data into usb_input_buffer
  */
 usb_status_t read_usb_data(usb_buf_t *usb_input_buffer) {
     uint8_t buffer[USBUART_BUFFER_SIZE];
     /* Check for input data from host. */
-    if (USBUART_DataIsReady())
+    if (hal_usb_rx_ready())
     {
+        // Leave the packet in the endpoint until the ring has room for a
+        // whole one. The host is NAKed meanwhile, so nothing is lost, and
+        // every command it sent still gets its reply.
+        if (USB_RX_BUFFER_SIZE - usb_buf_count(usb_input_buffer) < USBUART_BUFFER_SIZE) {
+            if (!usb_input_buffer->rx_held) {
+                usb_input_buffer->rx_held = 1;
+                stats_rx_overflow();
+            }
+            return USB_BUF_OVERFLOW;
+        }
+        usb_input_buffer->rx_held = 0;
+
     	size_t count = 0;
         /* Read received data and re-enable OUT endpoint. */
-        count = USBUART_GetAll(buffer);
+        count = hal_usb_get(buffer);
         if (count > 0)
         {
-            // Store the received data in the UART buffer, unless there is an overflow
-            // In the case of an overflow, we'll just reset the buffer
-            // The overflow flag is set such that we can ignore the next (partial)
-            // message.
-            if ((count + usb_input_buffer->buf_size) > USBUART_BUFFER_SIZE) {
-                usb_input_buffer->buf_size = 0;
-                usb_input_buffer->overflow = 1;
-                return USB_BUF_OVERFLOW;
+            for (size_t i = 0; i < count; i += 1) {
+                usb_input_buffer->buf[usb_input_buffer->head & (USB_RX_BUFFER_SIZE - 1)] = buffer[i];
+                usb_input_buffer->head += 1;
             }
-            memcpy(usb_input_buffer->buf + usb_input_buffer->buf_size, buffer, count);
-            usb_input_buffer->buf_size += count;
+            stats_mark(STAT_MARK_RX);
         }
     }
     return USB_SUCCESS;
 }
 
 /**
- * Parse input buffer looking for completed lines.
+ * Store a byte of the line being received, splitting it into arguments as
+ * it goes
  */
-usb_status_t parse_usb_buffer(usb_buf_t *usb_input_buffer, switches_t *state) {
-    const size_t term_len = sizeof(term)/sizeof(char) - 1;
-
-    // Look for terminators
-    if (usb_input_buffer->buf_size < term_len)
-        return USB_SUCCESS;
-    for (size_t i = 0; i < usb_input_buffer->buf_size - (term_len-1); i += 1) {
-        if (memcmp(usb_input_buffer->buf + i, term, term_len) == 0) {
-            // Ignore if the last command overflowed, we may be looking at a partial message
-            if (usb_input_buffer->overflow == 0) {
-                // We've found a terminator, handle the command
-                usb_input_buffer->buf[i] = '\0';
-                write_usb((uint8_t *)"Command: \"", 11);
-                write_usb((uint8_t *)usb_input_buffer->buf, i - (term_len-1));
+static void line_push(usb_buf_t *buf, char c) {
+    if (buf->overflow)
+        return;
+    // If the line is too long, drop it, and keep dropping until the next
+    // terminator
+    if (buf->line_len >= USB_CMD_MAX_LEN) {
+        buf->overflow = 1;
+        return;
+    }
+    if (isspace((unsigned char)c)) {
+        buf->line[buf->line_len++] = '\0';
+        buf->in_arg = 0;
+        return;
+    }
+    if (!buf->in_arg) {
+        if (buf->argc < USB_CMD_MAX_ARGS)
+            buf->argv[buf->argc++] = &buf->line[buf->line_len];
+        else
+            buf->too_many = 1;
+        buf->in_arg = 1;
+    }
+    if (buf->argc == 1)
+        buf->verb_hash = command_hash(buf->verb_hash, c);
+    buf->line[buf->line_len++] = c;
+}
+
+/**
+ * Run the line that has just been terminated
+ */
+static usb_status_t line_run(usb_buf_t *buf, switches_t *state) {
+    buf->line[buf->line_len] = '\0';
+    if (buf->too_many)
+        return USB_INVALID_NUM_ARGS;
+    if (buf->argc == 0)
+        return USB_INVALID_CMD;
+    command_t cmd = command_find(buf->verb_hash, buf->argv[0]);
+    if (cmd == CMD_INVALID)
+        return USB_INVALID_CMD;
+    return run_command(cmd, buf->argc, buf->argv, state);
+}
+
+/**
+ * Reset the line parser
+ */
+void usb_line_reset(usb_buf_t *buf) {
+    buf->term_matched = 0;
+    buf->overflow = 0;
+    buf->line_len = 0;
+    buf->argc = 0;
+    buf->in_arg = 0;
+    buf->too_many = 0;
+    buf->verb_hash = 0;
+}
+
+/**
+ * Parse the input buffer, running each line as its terminator arrives. Bytes
+ * are taken out of the ring as they are parsed, and never looked at twice.
+ * Returns USB_MODE_CHANGED if a command switched to binary mode.
+ */
+static usb_status_t parse_ascii_buffer(usb_buf_t *usb_input_buffer, switches_t *state) {
+    const size_t term_len = strlen(term);
+
+    while (usb_input_buffer->tail != usb_input_buffer->head) {
+        // Leave the input until the host has read enough of the replies to
+        // make room for the next one
+        if (!usb_tx_room(USB_TX_PARSE_ROOM))
+            break;
+        char c = usb_input_buffer->buf[usb_input_buffer->tail & (USB_RX_BUFFER_SIZE - 1)];
+        usb_input_buffer->tail += 1;
+
+        if (c != term[usb_input_buffer->term_matched]) {
+            // The partial terminator was part of the line after all
+            for (size_t i = 0; i < usb_input_buffer->term_matched; i += 1)
+                line_push(usb_input_buffer, term[i]);
+            usb_input_buffer->term_matched = 0;
+            if (c != term[0]) {
+                line_push(usb_input_buffer, c);
+                continue;
+            }
+        }
+        usb_input_buffer->term_matched += 1;
+        if (usb_input_buffer->term_matched < term_len)
+            continue;
+
+        // We've found a terminator. Don't run the line if it overflowed,
+        // we'd be looking at a partial message, but still answer it so
+        // that every line gets a reply
+        if (usb_input_buffer->overflow) {
+            stats_status(USB_BUF_OVERFLOW);
+            if (!ECHO_ON)
+                write_status(USB_BUF_OVERFLOW);
+            usb_tx_end();
+        } else {
+            stats_mark(STAT_MARK_TERM);
+            if (ECHO_ON) {
+                // Echo the line with the whitespace that was split on put
+                // back as spaces
+                char echo[USB_CMD_MAX_LEN];
+                for (size_t i = 0; i < usb_input_buffer->line_len; i += 1) {
+                    char e = usb_input_buffer->line[i];
+                    echo[i] = (e == '\0') ? ' ' : e;
+                }
+                write_usb((uint8_t *)"Command: \"", 10);
+                write_usb((uint8_t *)echo, usb_input_buffer->line_len);
                 write_usb((uint8_t *)"\"\r\n", 3);
 
                 // Execute the command
-            	do_command(usb_input_buffer->buf, state);
+                stats_status(line_run(usb_input_buffer, state));
+                usb_tx_end();
             } else {
-            	// If we had an overflow on the last command, ignore the potentially
-            	// partial message
-                usb_input_buffer->overflow = 0;
+                // Execute the command, replying with just its status, which
+                // fails if any of its output had to be dropped
+                usb_status_t status = line_run(usb_input_buffer, state);
+                if (usb_tx_end() && status == USB_SUCCESS)
+                    status = USB_BUF_OVERFLOW;
+                stats_status(status);
+                write_status(status);
             }
-
-            // Shuffle the buffer down
-            const char *eoc = usb_input_buffer->buf + i + (term_len-1);
-            const size_t len_remain = usb_input_buffer->buf_size - i - (term_len);
-            memmove(usb_input_buffer->buf, eoc, len_remain);
-            usb_input_buffer->buf_size = len_remain;
-
-            // Reset the loop to the beginning of the list
-            i = -1;
         }
+        usb_line_reset(usb_input_buffer);
+
+        // If the command switched us into binary mode, the rest of the
+        // buffer is framed data
+        if (BINARY_MODE)
+            return USB_MODE_CHANGED;
     }
     return USB_SUCCESS;
 }
 
+/**
+ * Parse the input buffer with the parser for the current mode. A parser
+ * returns when a command switches modes, rather than calling the other one,
+ * so any number of switches in the buffer runs in constant stack.
+ */
+usb_status_t parse_usb_buffer(usb_buf_t *usb_input_buffer, switches_t *state) {
+    usb_status_t status;
+    do {
+        // Binary sessions are handled by the framed protocol parser
+        if (BINARY_MODE)
+            status = parse_binary_buffer(usb_input_buffer, state);
+        else
+            status = parse_ascii_buffer(usb_input_buffer, state);
+    } while (status == USB_MODE_CHANGED);
+    return status;
+}
+
 /**
  * Extract parameters from a command
  */
@@ -212,82 +902,449 @@ usb_status_t extract_params(char *buffer, command_t *cmd, size_t *argc, char **a
 
     // We should now have a list of arguments.
     // Let's figure out what the command is
-    char *cmd_str = argv[0];
-    size_t n_cmds = sizeof(commands)/sizeof(cmd_map_t);
-    *cmd = CMD_INVALID;
-    for (size_t i = 0; i < n_cmds; i += 1) {
-    	if (strcasecmp(cmd_str, commands[i].cmd_str) == 0) {
-    		*cmd = commands[i].cmd;
-    		break;
-    	}
-    }
+    uint16_t hash = 0;
+    for (const char *c = argv[0]; *c != '\0'; c += 1)
+    	hash = command_hash(hash, *c);
+    *cmd = command_find(hash, argv[0]);
     if (*cmd == CMD_INVALID)
     	return USB_INVALID_CMD;
 
     return USB_SUCCESS;
 }
 
+/**
+ * Decode a single hex digit, returning 0xFF if the character is invalid
+ */
+static inline uint8_t hex_nibble(char c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20; // Lower case
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return 0xFF;
+}
+
+/**
+ * Decode a hex string into a packed frame. The string is read most
+ * significant byte first, i.e. the last two digits are byte 0 of the frame.
+ * The string must be exactly 2*len digits long.
+ */
+static usb_status_t hex_decode(const char *str, uint8_t *out, size_t len) {
+	if (strlen(str) != 2*len)
+		return USB_INVALID_ARG;
+	for (size_t i = 0; i < len; i += 1) {
+		uint8_t hi = hex_nibble(str[2*i]);
+		uint8_t lo = hex_nibble(str[2*i + 1]);
+		if ((hi | lo) & 0xF0)
+			return USB_INVALID_ARG;
+		out[len - i - 1] = (hi << 4) | lo;
+	}
+	return USB_SUCCESS;
+}
+
+/**
+ * Parse an unsigned decimal integer
+ */
+static usb_status_t parse_uint(const char *str, uint32_t *val) {
+	char *end;
+	unsigned long parsed = strtoul(str, &end, 10);
+	if (*str == '\0' || *end != '\0')
+		return USB_INVALID_ARG;
+	*val = parsed;
+	return USB_SUCCESS;
+}
+
+/**
+ * Parse a channel number, checking that it is in range
+ */
+static usb_status_t parse_channel(const char *str, size_t *channel) {
+	uint32_t val;
+	if (parse_uint(str, &val) != USB_SUCCESS || val >= NUM_SWITCHES)
+		return USB_INVALID_ARG;
+	*channel = val;
+	return USB_SUCCESS;
+}
+
+/**
+ * Parse a delta entry "channel:mask" or "first-last:mask" into its binary
+ * form, returning the number of bytes written or 0 if it is invalid
+ */
+static size_t parse_delta_entry(char *str, uint8_t *out) {
+	size_t first, last;
+	uint8_t mask;
+	char *colon = strchr(str, ':');
+	if (colon == NULL)
+		return 0;
+	*colon = '\0';
+	if (switches_parse_mask(colon + 1, &mask) == 0)
+		return 0;
+	char *dash = strchr(str, '-');
+	if (dash != NULL)
+		*dash = '\0';
+	if (parse_channel(str, &first) != USB_SUCCESS)
+		return 0;
+	last = first;
+	if (dash != NULL && (parse_channel(dash + 1, &last) != USB_SUCCESS || last < first))
+		return 0;
+	out[0] = first;
+	if (last == first) {
+		out[1] = mask;
+		return 2;
+	}
+	out[1] = mask | SWITCHES_DELTA_RUN;
+	out[2] = last - first;
+	return 3;
+}
+
 /**
  * Parse command
  */
-uint8_t hex_start[] = {'0', 'x'};
 usb_status_t do_command(char* buffer, switches_t *state) {
     command_t cmd = CMD_NOOP;
     size_t argc = USB_CMD_MAX_ARGS;
     char *argv[USB_CMD_MAX_ARGS] = {0};
 
-    // Create a buffer to send over SPI
-    uint8_t out_buffer[SPIM_TX_BUFFER_SIZE];
-
     // Extract the command from the command line
-    extract_params(buffer, &cmd, &argc, argv);
+    usb_status_t status = extract_params(buffer, &cmd, &argc, argv);
+    if (status != USB_SUCCESS)
+        return status;
+    return run_command(cmd, argc, argv, state);
+}
+
+/**
+ * Run a command
+ */
+uint8_t hex_start[] = {'0', 'x'};
+usb_status_t run_command(command_t cmd, size_t argc, char **argv, switches_t *state) {
+    usb_status_t status;
+    size_t first, last;
+    uint8_t mask, pattern;
+    uint32_t count, period, divider, due;
+    seq_source_t source;
+
+    // Create a buffer to send over SPI
+    uint8_t out_buffer[SWITCHES_FRAME_SIZE];
+    // Binary form of a DELTA command, at most 3 bytes per argument
+    uint8_t delta[3 * (USB_CMD_MAX_ARGS - 1)];
+    size_t delta_len;
 
     // Switch on the extracted command
     switch(cmd) {
     case CMD_NOOP:
     	break;
     case CMD_CLEAR:
-        switches_all(state, 0x00);
-        switches_pack(state, out_buffer);
-        if (CLK_OUT == 0) {
-        	PULSE_LD = 1;
-        	SPIM_PutArray(out_buffer, SPIM_TX_BUFFER_SIZE);
-        }
-        else
-        	return USB_CLOCK_ON;
-        break;
+        FOR_EACH_SELECTED_CHAIN(chain)
+            switches_all(&state[chain], 0x00);
+        return write_switches(state);
     case CMD_WRITE:
     	if (argc != 2) // Must be a single command + argument
     		return USB_INVALID_NUM_ARGS;
     	if (memcmp(argv[1], hex_start, 2) == 0) // If we start with "0x" move pointer past this
     		argv[1] += 2;
-    	return USB_NOT_IMPLEMENTED;
+    	status = hex_decode(argv[1], out_buffer, SWITCHES_FRAME_SIZE);
+    	if (status != USB_SUCCESS)
+    		return status;
+    	FOR_EACH_SELECTED_CHAIN(chain)
+    		switches_unpack(&state[chain], out_buffer);
+    	return write_frame(out_buffer);
     case CMD_SELECT:
     	if (argc != 2) // Must be a single command + argument
     		return USB_INVALID_NUM_ARGS;
     	if (strlen(argv[1]) != 1) // Must be a single character
     		return USB_INVALID_ARG;
-    	switches_all(state, switches_mask(argv[1][0]));
-    	switches_pack(state, out_buffer);
-    	if (CLK_OUT == 0) {
-    		PULSE_LD = 1;
-    		SPIM_PutArray(out_buffer, SPIM_TX_BUFFER_SIZE);
-    	}
-    	else
-    		return USB_CLOCK_ON;
-        break;
+    	mask = switches_mask(argv[1][0]);
+    	FOR_EACH_SELECTED_CHAIN(chain)
+    		switches_all(&state[chain], mask);
+    	return write_switches(state);
     case CMD_LOAD:
-    	if (CLK_OUT == 0)
-    		LD_PulseGen_Write(1u);
-    	else
+    	if (sequence_running())
+    		return USB_SEQ_RUNNING;
+    	if (CLK_OUT == 0) {
+    		FOR_EACH_SELECTED_CHAIN(chain)
+    			hal_ld_pulse(chain);
+    		output_invalidate(CHAIN_SEL);
+    		wear_forget(CHAIN_SEL);
+    	} else
     		return USB_CLOCK_ON;
     	break;
     case CMD_CLOCK:
-    	CLK_OUT = 1;
-   		break;
+    	if (argc > 4) // Command + [pattern] + [count] + [divider]
+    		return USB_INVALID_NUM_ARGS;
+    	pattern = 0x00;
+    	count = 0;
+    	divider = 0;
+    	if (argc > 1) {
+    		if (memcmp(argv[1], hex_start, 2) == 0)
+    			argv[1] += 2;
+    		if (hex_decode(argv[1], &pattern, 1) != USB_SUCCESS)
+    			return USB_INVALID_ARG;
+    	}
+    	if (argc > 2 && parse_uint(argv[2], &count) != USB_SUCCESS)
+    		return USB_INVALID_ARG;
+    	if (argc > 3 && parse_uint(argv[3], &divider) != USB_SUCCESS)
+    		return USB_INVALID_ARG;
+    	return start_clock(pattern, count, divider);
    	case CMD_STOP:
-   		CLK_OUT = 0;
-   		SPIM_ClearTxBuffer();
+   		sequence_stop();
+   		schedule_clear();
+   		transition_stop();
+   		stream_stop();
+   		stream_sync(&state[0]);
+   		output_stop();
+   		break;
+   	case CMD_BINARY:
+   		BINARY_MODE = 1;
+   		break;
+   	case CMD_SET:
+   		if (argc != 3) // Command + channel + mask
+   			return USB_INVALID_NUM_ARGS;
+   		if (parse_channel(argv[1], &first) != USB_SUCCESS ||
+   		    switches_parse_mask(argv[2], &mask) == 0)
+   			return USB_INVALID_ARG;
+   		FOR_EACH_SELECTED_CHAIN(chain)
+   			switches_set(&state[chain], first, mask);
+   		return write_switches(state);
+   	case CMD_DELTA:
+   		if (argc < 2)
+   			return USB_INVALID_NUM_ARGS;
+   		delta_len = 0;
+   		for (size_t i = 1; i < argc; i += 1) {
+   			size_t n = parse_delta_entry(argv[i], delta + delta_len);
+   			if (n == 0)
+   				return USB_INVALID_ARG;
+   			delta_len += n;
+   		}
+   		FOR_EACH_SELECTED_CHAIN(chain)
+   			switches_apply_delta(&state[chain], delta, delta_len);
+   		return write_switches(state);
+   	case CMD_SETRANGE:
+   		if (argc != 4) // Command + first + last + mask
+   			return USB_INVALID_NUM_ARGS;
+   		if (parse_channel(argv[1], &first) != USB_SUCCESS ||
+   		    parse_channel(argv[2], &last) != USB_SUCCESS ||
+   		    first > last ||
+   		    switches_parse_mask(argv[3], &mask) == 0)
+   			return USB_INVALID_ARG;
+   		FOR_EACH_SELECTED_CHAIN(chain)
+   			switches_range(&state[chain], first, last, mask);
+   		return write_switches(state);
+   	case CMD_SEQCLEAR:
+   		sequence_clear();
+   		break;
+   	case CMD_SEQADD:
+   		if (argc == 1) { // No argument, store the current state of chain 0
+   			switches_pack(&state[0], out_buffer);
+   		} else if (argc == 2) {
+   			if (memcmp(argv[1], hex_start, 2) == 0)
+   				argv[1] += 2;
+   			status = hex_decode(argv[1], out_buffer, SWITCHES_FRAME_SIZE);
+   			if (status != USB_SUCCESS)
+   				return status;
+   		} else
+   			return USB_INVALID_NUM_ARGS;
+   		return sequence_add(out_buffer);
+   	case CMD_SEQRUN:
+   		if (argc < 2 || argc > 4) // Command + source + [count] + [period]
+   			return USB_INVALID_NUM_ARGS;
+   		if (strcasecmp(argv[1], "MANUAL") == 0)
+   			source = SEQ_MANUAL;
+   		else if (strcasecmp(argv[1], "TIMER") == 0)
+   			source = SEQ_TIMER;
+   		else if (strcasecmp(argv[1], "TRIGGER") == 0)
+   			source = SEQ_TRIGGER;
+   		else
+   			return USB_INVALID_ARG;
+   		count = 1;
+   		period = 1;
+   		if (argc > 2 && parse_uint(argv[2], &count) != USB_SUCCESS)
+   			return USB_INVALID_ARG;
+   		if (argc > 3 && parse_uint(argv[3], &period) != USB_SUCCESS)
+   			return USB_INVALID_ARG;
+   		return sequence_run(source, count, period);
+   	case CMD_STEP:
+   		// Later commands are queued behind the step, so they start from it
+   		status = sequence_step();
+   		sequence_sync(&state[0]);
+   		return status;
+   	case CMD_ECHO:
+   		if (argc != 2)
+   			return USB_INVALID_NUM_ARGS;
+   		if (strcasecmp(argv[1], "ON") == 0)
+   			ECHO_ON = 1;
+   		else if (strcasecmp(argv[1], "OFF") == 0)
+   			ECHO_ON = 0;
+   		else
+   			return USB_INVALID_ARG;
+   		break;
+   	case CMD_AT:
+   		if (argc != 3) // Command + tick + frame
+   			return USB_INVALID_NUM_ARGS;
+   		if (argv[1][0] == '+') {
+   			if (parse_uint(argv[1] + 1, &due) != USB_SUCCESS)
+   				return USB_INVALID_ARG;
+   			due += timebase_now();
+   		} else if (parse_uint(argv[1], &due) != USB_SUCCESS) {
+   			return USB_INVALID_ARG;
+   		}
+   		if (memcmp(argv[2], hex_start, 2) == 0)
+   			argv[2] += 2;
+   		status = hex_decode(argv[2], out_buffer, SWITCHES_FRAME_SIZE);
+   		if (status != USB_SUCCESS)
+   			return status;
+   		if (CLK_OUT)
+   			return USB_CLOCK_ON;
+   		if (sequence_running() || stream_running())
+   			return USB_SEQ_RUNNING;
+   		if (transition_running())
+   			return USB_TRANSITION_RUNNING;
+   		// Scheduled frames go out on chain 0, and reach the state once
+   		// they have latched
+   		return schedule_add(due, out_buffer);
+   	case CMD_TIME:
+   		// Prefixed, so the tick can't be mistaken for a status line
+   		write_str("TIME ");
+   		write_uint(timebase_now());
+   		write_str("\r\n");
+   		break;
+   	case CMD_CHAIN:
+   		if (argc != 2)
+   			return USB_INVALID_NUM_ARGS;
+   		if (strcasecmp(argv[1], "ALL") == 0) {
+   			CHAIN_SEL = CHAINS_ALL;
+   		} else {
+   			if (parse_uint(argv[1], &count) != USB_SUCCESS || count >= NUM_CHAINS)
+   				return USB_INVALID_ARG;
+   			CHAIN_SEL = 1u << count;
+   		}
+   		break;
+   	case CMD_SAVE:
+   		if (argc != 2)
+   			return USB_INVALID_NUM_ARGS;
+   		if (parse_uint(argv[1], &count) != USB_SUCCESS || count >= PRESET_SLOTS)
+   			return USB_INVALID_ARG;
+   		FOR_EACH_SELECTED_CHAIN(chain) {
+   			switches_pack(&state[chain], out_buffer);
+   			break;
+   		}
+   		return preset_save(count, out_buffer);
+   	case CMD_RECALL:
+   		if (argc != 2)
+   			return USB_INVALID_NUM_ARGS;
+   		if (parse_uint(argv[1], &count) != USB_SUCCESS || count >= PRESET_SLOTS)
+   			return USB_INVALID_ARG;
+   		return recall_preset(state, count);
+   	case CMD_POWERON:
+   		if (argc != 2)
+   			return USB_INVALID_NUM_ARGS;
+   		if (strcasecmp(argv[1], "NONE") == 0)
+   			return preset_set_power_on(PRESET_NONE);
+   		if (parse_uint(argv[1], &count) != USB_SUCCESS || count >= PRESET_SLOTS)
+   			return USB_INVALID_ARG;
+   		return preset_set_power_on(count);
+   	case CMD_BEGIN:
+   		STAGED = 1;
+   		break;
+   	case CMD_COMMIT:
+   		STAGED = 0;
+   		return write_switches(state);
+   	case CMD_STATS:
+   		return write_stats();
+   	case CMD_STATSCLEAR:
+   		stats_clear();
+   		break;
+   	case CMD_VERIFY:
+   		if (argc == 1)
+   			return write_verify();
+   		if (argc != 2)
+   			return USB_INVALID_NUM_ARGS;
+   		if (strcasecmp(argv[1], "ON") == 0)
+   			output_verify_enable(1);
+   		else if (strcasecmp(argv[1], "OFF") == 0)
+   			output_verify_enable(0);
+   		else if (strcasecmp(argv[1], "CLEAR") == 0)
+   			output_verify_clear();
+   		else
+   			return USB_INVALID_ARG;
+   		break;
+   	case CMD_PUSH:
+   		if (argc != 2)
+   			return USB_INVALID_NUM_ARGS;
+   		if (memcmp(argv[1], hex_start, 2) == 0)
+   			argv[1] += 2;
+   		status = hex_decode(argv[1], out_buffer, SWITCHES_FRAME_SIZE);
+   		if (status != USB_SUCCESS)
+   			return status;
+   		return stream_push(out_buffer);
+   	case CMD_STREAM:
+   		if (argc == 1)
+   			return write_stream_status();
+   		if (argc != 2)
+   			return USB_INVALID_NUM_ARGS;
+   		if (strcasecmp(argv[1], "STOP") == 0) {
+   			// Nothing is popped after this, so the state is final
+   			stream_stop();
+   			stream_sync(&state[0]);
+   			break;
+   		}
+   		if (strcasecmp(argv[1], "CLEAR") == 0) {
+   			stream_clear_counts();
+   			break;
+   		}
+   		if (parse_uint(argv[1], &period) != USB_SUCCESS)
+   			return USB_INVALID_ARG;
+   		if (sequence_running() || schedule_busy())
+   			return USB_SEQ_RUNNING;
+   		return stream_start(period);
+   	case CMD_SPEED:
+   		if (argc == 1)
+   			return write_speed();
+   		if (argc != 2)
+   			return USB_INVALID_NUM_ARGS;
+   		if (strcasecmp(argv[1], "CAL") == 0) {
+   			status = speed_calibrate();
+   			if (status != USB_SUCCESS)
+   				return status;
+   			return write_speed();
+   		}
+   		if (parse_uint(argv[1], &divider) != USB_SUCCESS)
+   			return USB_INVALID_ARG;
+   		return speed_set(divider);
+   	case CMD_WEAR:
+   		if (argc == 1)
+   			return write_wear(NUM_SWITCHES);
+   		if (argc != 2)
+   			return USB_INVALID_NUM_ARGS;
+   		if (strcasecmp(argv[1], "SAVE") == 0)
+   			return wear_save();
+   		if (strcasecmp(argv[1], "CLEAR") == 0)
+   			return wear_clear(CHAIN_SEL);
+   		if (parse_channel(argv[1], &first) != USB_SUCCESS)
+   			return USB_INVALID_ARG;
+   		return write_wear(first);
+   	case CMD_TRANSITION:
+   		if (argc < 2 || argc > 3) // Command + mode + [dwell]
+   			return USB_INVALID_NUM_ARGS;
+   		period = 0;
+   		if (argc > 2 && (parse_uint(argv[2], &period) != USB_SUCCESS || period > 0xFFFFu))
+   			return USB_INVALID_ARG;
+   		if (strcasecmp(argv[1], "OFF") == 0)
+   			transition_configure(TRANSITION_OFF, period);
+   		else if (strcasecmp(argv[1], "BBM") == 0)
+   			transition_configure(TRANSITION_BBM, period);
+   		else if (strcasecmp(argv[1], "MBB") == 0)
+   			transition_configure(TRANSITION_MBB, period);
+   		else
+   			return USB_INVALID_ARG;
+   		break;
+   	case CMD_EVENTS:
+   		if (argc != 2)
+   			return USB_INVALID_NUM_ARGS;
+   		if (strcasecmp(argv[1], "ON") == 0)
+   			events_enable(1);
+   		else if (strcasecmp(argv[1], "OFF") == 0)
+   			events_enable(0);
+   		else
+   			return USB_INVALID_ARG;
    		break;
     default:
         return USB_INVALID_CMD;
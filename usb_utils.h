@@ -40,8 +40,12 @@ typedef enum {
 	USB_INVALID_ARG = 5,
 	USB_CLOCK_ON = 6,
 	USB_NOT_IMPLEMENTED = 7,
+	USB_BAD_CRC = 8,
+	USB_SEQ_RUNNING = 9,
+	USB_TRANSITION_RUNNING = 10, // A write arrived before the last transition finished
 	USB_OTHER_FAIL = 0x7F,
 	USB_CONFIG_CHANGED = 0x80,
+	USB_MODE_CHANGED = 0x81, // Internal, a command switched between ASCII and binary
 	USB_SUCCESS = 0xFF
 } usb_status_t;
 
@@ -51,27 +55,96 @@ typedef enum {
 	CMD_WRITE, // Write an arbitrary hex string (must be 160 bits)
 	CMD_SELECT, // Select one switch set (1-5) to open on all channels
 	CMD_LOAD, // Pulse the LD line, without changing shift registers
-	CMD_CLOCK, // Start the clock with no data (all zeros)
+	CMD_CLOCK, // Start the clock with no data (CLOCK [pattern] [count] [divider])
 	CMD_STOP, // Stop all operations
+	CMD_BINARY, // Switch this session to the binary framed protocol
+	CMD_SET, // Set one channel to a switch mask (i.e. SET 3 AC)
+	CMD_SETRANGE, // Set an inclusive range of channels to a switch mask
+	CMD_DELTA, // Set several channels or ranges at once (DELTA 3:AC 10-15:B ...)
+	CMD_SEQCLEAR, // Empty the sequence table
+	CMD_SEQADD, // Append a hex frame (or the current state) to the sequence table
+	CMD_SEQRUN, // Arm the sequence (SEQRUN MANUAL|TIMER|TRIGGER [count] [period])
+	CMD_STEP, // Output the next step of an armed sequence
+	CMD_ECHO, // ECHO OFF replaces the command echo with a status code per command
+	CMD_AT, // Output a hex frame at a timebase tick (AT tick|+delay frame)
+	CMD_TIME, // Report the current timebase tick
+	CMD_CHAIN, // Select the chain that commands apply to (CHAIN n|ALL)
+	CMD_SAVE, // Store the state of the (first) selected chain in a preset slot (SAVE n)
+	CMD_RECALL, // Write a preset slot to the selected chains (RECALL n)
+	CMD_POWERON, // Choose the preset output at power on (POWERON n|NONE)
+	CMD_BEGIN, // Stage channel edits without sending them
+	CMD_COMMIT, // Send and latch the staged edits as a single frame
+	CMD_STATS, // Dump the latency and error counters
+	CMD_STATSCLEAR, // Reset the latency and error counters
+	CMD_VERIFY, // Readback verification (VERIFY [ON|OFF|CLEAR]), reports counters with no argument
+	CMD_EVENTS, // Turn completion events on or off (EVENTS ON|OFF)
+	CMD_TRANSITION, // Latch new states through an intermediate frame (TRANSITION OFF|BBM|MBB [dwell ticks])
+	CMD_PUSH, // Append a hex frame to the stream FIFO
+	CMD_STREAM, // Stream control (STREAM period|STOP|CLEAR), reports the counters with no argument
+	CMD_WEAR, // Switch wear counters (WEAR [channel]|SAVE|CLEAR)
+	CMD_SPEED, // Shift clock divider (SPEED divider|CAL), reports it with no argument
 	CMD_INVALID // Invalid Command, not a real command, just a place holder
 } command_t;
 
 // Define buffer parameters
 static const uint32_t USBFS_DEVICE = 0u;
 #define USBUART_BUFFER_SIZE (64u)
+#define USB_TX_BUFFER_SIZE (512u) // Must be a power of two
+#define USB_RX_BUFFER_SIZE (512u) // Must be a power of two
+#define USB_CMD_MAX_LEN (88u + 2u*SWITCHES_FRAME_SIZE) // Longest ASCII command, room for a hex frame
 #define USB_CMD_MAX_ARGS (12u)
+// TX ring space kept back for the status reply that ends a response
+#define USB_TX_REPLY_RESERVE (8u)
+// Free TX ring space needed to parse input, enough for a verbose echo
+#define USB_TX_PARSE_ROOM (USB_CMD_MAX_LEN + 16u)
 
 // Define CDC properties
 extern const char* parity[];
 extern const char* stop[];
 
-// Mapping from strings to chars
+// Input ring buffer. Indices are free running, and wrapped on access.
+// ASCII commands are taken out of the ring a byte at a time and split into
+// arguments as they arrive, so a line is complete as soon as its terminator
+// is seen.
 typedef struct {
-    char buf[USBUART_BUFFER_SIZE];
-    size_t buf_size;
-    uint8_t overflow;
+    char buf[USB_RX_BUFFER_SIZE];
+    uint16_t head; // Next byte to be written
+    uint16_t tail; // Next byte to be parsed
+    uint8_t term_matched; // Number of terminator characters matched so far
+    uint8_t overflow; // The current line was too long and is being dropped
+    // Line being assembled. Whitespace is stored as NULs, so each argument
+    // is already a string.
+    char line[USB_CMD_MAX_LEN + 1];
+    uint16_t line_len;
+    char *argv[USB_CMD_MAX_ARGS];
+    uint8_t argc; // Number of arguments started, including the command
+    uint8_t in_arg; // The last byte stored was part of an argument
+    uint8_t too_many; // More than USB_CMD_MAX_ARGS arguments
+    uint16_t verb_hash; // Hash of the command so far, see command_hash
+    uint8_t rx_held; // A packet is being left in the endpoint for want of room
+    uint8_t frame_waiting; // The binary parser is waiting for the rest of a frame
+    uint32_t frame_wait_start; // and the tick it started waiting
 } usb_buf_t;
 
+/**
+ * Number of unparsed bytes in the input buffer
+ */
+static inline uint16_t usb_buf_count(const usb_buf_t *buf) {
+    return buf->head - buf->tail;
+}
+
+/**
+ * Return the unparsed byte at offset from the tail of the input buffer
+ */
+static inline uint8_t usb_buf_peek(const usb_buf_t *buf, uint16_t offset) {
+    return buf->buf[(uint16_t)(buf->tail + offset) & (USB_RX_BUFFER_SIZE - 1)];
+}
+
+/**
+ * Copy len unparsed bytes starting at offset into a linear buffer
+ */
+void usb_buf_copy(const usb_buf_t *buf, uint16_t offset, uint8_t *out, size_t len);
+
 /* Commands mapping */
 typedef struct {
 	char *cmd_str;
@@ -85,22 +158,154 @@ extern const cmd_map_t commands[];
 usb_status_t init_usb_buffer(usb_buf_t *buf);
 
 /**
- * Write USB Data, blocking until the device is ready.
+ * Queue USB data to be sent. This never waits for the host: if the transmit
+ * ring is still full after trying to send a packet, the data is dropped and
+ * USB_BUF_OVERFLOW returned. Once part of a response has been dropped, the
+ * rest of it is dropped too, along with the unsent part of the line in
+ * progress, so the host only sees whole lines. USB_TX_REPLY_RESERVE bytes
+ * are kept back for write_usb_reply.
  */
 usb_status_t write_usb(uint8_t *buffer, size_t len);
 
+/**
+ * Queue the status reply that ends a command's response, which may use the
+ * space write_usb keeps back
+ */
+usb_status_t write_usb_reply(uint8_t *buffer, size_t len);
+
+/**
+ * Return 1 if len bytes can be queued with write_usb without dropping
+ * anything, i.e. before taking an event off its queue to report it
+ */
+uint8_t usb_tx_room(size_t len);
+
+/**
+ * End a response, returning 1 if any of it was dropped since the last call
+ */
+uint8_t usb_tx_end(void);
+
+/**
+ * Send the next packet of queued USB data if the device is ready.
+ * Returns USB_NOT_READY if there is data waiting but it couldn't be sent.
+ */
+usb_status_t flush_usb(void);
+
+/**
+ * Return 1 if no data is waiting to be read from or sent to the host
+ */
+uint8_t usb_idle(void);
+
+/**
+ * Queue a compact status response for a command (i.e. "FF\r\n")
+ */
+usb_status_t write_status(usb_status_t status);
+
+/**
+ * Loop over the chains selected by CHAIN_SEL. Command handlers are passed
+ * the switch state of every chain, indexed by chain.
+ */
+#define FOR_EACH_SELECTED_CHAIN(chain) \
+	for (uint8_t chain = 0; chain < NUM_CHAINS; chain += 1) \
+		if (CHAIN_SEL & (1u << chain))
+
+/**
+ * Write a preset slot to the selected chains, updating their switch state
+ */
+usb_status_t recall_preset(switches_t *state, uint8_t slot);
+
+/**
+ * Shift a packed frame (SWITCHES_FRAME_SIZE bytes) out over SPI on each
+ * selected chain, and pulse the LD lines once it has been sent. With several
+ * chains selected they are shifted concurrently and latched together. Fails
+ * with USB_CLOCK_ON if the clock output is running, USB_SEQ_RUNNING if a
+ * sequence owns the output, or USB_TRANSITION_RUNNING if a transition is
+ * still running. While a transaction is staged nothing is sent, nor to chains
+ * where the frame matches the one already latched. With a transition mode
+ * set, the frame is latched through the transition engine instead.
+ */
+usb_status_t write_frame(const uint8_t *frame);
+
+/**
+ * Pack the switch state of each selected chain directly into a free output
+ * buffer, and shift it out as for write_frame.
+ */
+usb_status_t write_switches(switches_t *state);
+
+/**
+ * Start clocking a fill pattern out over SPI with no LD pulse. A count of 0
+ * runs until STOP. A non-zero divider sets the SPIM clock divider for this
+ * run only, and the previous one is restored when it finishes or is stopped.
+ * Fails with USB_CLOCK_ON if the clock is already running, USB_SEQ_RUNNING
+ * if a sequence owns the output, or USB_BUF_OVERFLOW if a frame is still
+ * being shifted out.
+ */
+usb_status_t start_clock(uint8_t pattern, uint32_t count, uint32_t divider);
+
+/**
+ * Send a report for each scheduled frame that has been output since the
+ * last call, giving its due tick and how late it started in microseconds.
+ * In ASCII mode this is a line "AT <due> <late_us>", in binary mode a
+ * BIN_SCHEDULE event frame.
+ */
+usb_status_t write_schedule_reports(void);
+
+/**
+ * Send any completion events recorded since the last call. In ASCII mode
+ * these are the lines "LD <seq> <tick> <us> <chain mask>" and
+ * "DRAINED <seq> <tick> <us>", in binary mode BIN_EVENTS event frames.
+ */
+usb_status_t write_events(void);
+
+/**
+ * Dump the streaming state and counters on a single line
+ */
+usb_status_t write_stream_status(void);
+
+/**
+ * Return credits for streamed frames that have been popped, once a batch is
+ * ready. In ASCII mode this is a line "CREDIT <n>", in binary mode a
+ * BIN_PUSH event frame with n as its payload.
+ */
+usb_status_t write_stream_credits(void);
+
+/**
+ * Report switch wear counters, one line per channel of each selected chain
+ *      WEAR <chain>:<channel> A=<n> B=<n> C=<n> D=<n> E=<n>
+ * for a single channel, or for every channel if channel is NUM_SWITCHES
+ */
+usb_status_t write_wear(size_t channel);
+
+/**
+ * Report the shift clock divider as "SPEED <divider>", 0 if it is fixed
+ */
+usb_status_t write_speed(void);
+
+/**
+ * Dump the latency histograms (in CPU cycles) and error counters, one line
+ * per interval
+ */
+usb_status_t write_stats(void);
+
+/**
+ * Report the readback verification state and counters as
+ *      VERIFY <ON|OFF> checked=<n> mismatches=<n> bits=<n>
+ */
+usb_status_t write_verify(void);
+
 /**
  * Check for a USB configuration change from the host.
  */
 usb_status_t check_usb_uart_config_change(void);
 
 /**
- * Read data in from the USB device.
+ * Read data in from the USB device. A packet is only taken once the input
+ * ring has room for it, otherwise it is left for the host to retry.
  */
 usb_status_t read_usb_data(usb_buf_t *usb_input_buffer);
 
 /**
- * Parse the USB buffer for completed commands
+ * Parse the USB buffer for completed commands, with the ASCII or binary
+ * parser as the mode requires
  */
 usb_status_t parse_usb_buffer(usb_buf_t *usb_input_buffer, switches_t *state);
 
@@ -116,9 +321,19 @@ usb_status_t parse_usb_buffer(usb_buf_t *usb_input_buffer, switches_t *state);
  */
 usb_status_t extract_params(char *buffer, command_t *cmd, size_t *argc, char **argv);
 
+/**
+ * Forget any partially received ASCII line
+ */
+void usb_line_reset(usb_buf_t *buf);
+
 /**
  * Run a command based on a complete line of input.
  */
 usb_status_t do_command(char* buffer, switches_t *state);
 
+/**
+ * Run a command that has already been split into arguments
+ */
+usb_status_t run_command(command_t cmd, size_t argc, char **argv, switches_t *state);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,185 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "hal.h"
+#include "wear.h"
+#include "timebase.h"
+
+#if (WEAR_COUNTERS * 4u) % HAL_EEPROM_ROW_SIZE != 0
+#error "Wear counters must fill whole EEPROM rows"
+#endif
+
+/**
+ * Counters, and what the outputs of each chain hold
+ */
+static uint32_t counts[NUM_CHAINS][WEAR_COUNTERS];
+static uint8_t outputs[NUM_CHAINS][SWITCHES_FRAME_SIZE];
+static volatile uint8_t outputs_valid = 0; // Mask of chains
+
+/**
+ * Checkpoint state. Counts changed since the last checkpoint started are
+ * flagged by dirty, and next_row is the step the running checkpoint is up
+ * to, or WEAR_IDLE.
+ */
+#define WEAR_IDLE (0xFFFFu)
+#define WEAR_ROWS ((WEAR_SAVED_CHAINS == 0) ? 0u : 1u + WEAR_SAVED_CHAINS * WEAR_CHAIN_ROWS)
+static volatile uint8_t dirty = 0;
+static uint16_t next_row = WEAR_IDLE;
+static uint32_t last_checkpoint = 0;
+
+// Result of syncing a row
+#define WEAR_ROW_SAME (0u)
+#define WEAR_ROW_WRITTEN (1u)
+#define WEAR_ROW_FAILED (2u)
+
+/**
+ * Return the start of a wear row in the EEPROM
+ */
+static inline const uint8_t *wear_row(uint16_t row) {
+	return hal_eeprom_data() + (WEAR_FIRST_ROW + row) * HAL_EEPROM_ROW_SIZE;
+}
+
+/**
+ * Load the saved counters
+ */
+void wear_init(void) {
+	const uint8_t *header = wear_row(0);
+	memset(counts, 0, sizeof(counts));
+	outputs_valid = 0;
+	dirty = 0;
+	next_row = WEAR_IDLE;
+	last_checkpoint = timebase_now();
+	if (WEAR_SAVED_CHAINS == 0 || header[0] != WEAR_MAGIC || header[1] != (uint8_t)NUM_SWITCHES)
+		return;
+	for (uint8_t chain = 0; chain < WEAR_SAVED_CHAINS; chain += 1)
+		memcpy(counts[chain], wear_row(1u + chain * WEAR_CHAIN_ROWS), sizeof(counts[chain]));
+}
+
+/**
+ * Count the switches changed by a latch
+ */
+void wear_latch(uint8_t chain, const uint8_t *frame) {
+	uint8_t bit = 1u << chain;
+	if (outputs_valid & bit) {
+		switches_count_changes(outputs[chain], frame, counts[chain]);
+		dirty = 1;
+	}
+	memcpy(outputs[chain], frame, SWITCHES_FRAME_SIZE);
+	outputs_valid |= bit;
+}
+
+/**
+ * Forget the contents of outputs
+ */
+void wear_forget(uint8_t mask) {
+	uint8_t intr = hal_enter_critical();
+	outputs_valid &= ~mask;
+	hal_exit_critical(intr);
+}
+
+/**
+ * Return the counters of a chain
+ */
+const uint32_t *wear_counts(uint8_t chain) {
+	return counts[chain];
+}
+
+/**
+ * Bring a row of the EEPROM up to date with the counters. Checkpoints go
+ * through the counter rows first and the header last, so the header is
+ * only valid once every row has been written at least once.
+ */
+static uint8_t wear_sync_row(uint16_t step) {
+	uint16_t row = (step + 1u) % WEAR_ROWS;
+	uint32_t data[HAL_EEPROM_ROW_SIZE / 4u];
+	if (row == 0) {
+		memset(data, 0xFF, sizeof(data));
+		((uint8_t *)data)[0] = WEAR_MAGIC;
+		((uint8_t *)data)[1] = (uint8_t)NUM_SWITCHES;
+	} else {
+		// Counters are updated from the interrupt, but each is read in one go
+		uint16_t chain = (row - 1u) / WEAR_CHAIN_ROWS;
+		const volatile uint32_t *src = counts[chain] + ((row - 1u) % WEAR_CHAIN_ROWS) * (HAL_EEPROM_ROW_SIZE / 4u);
+		for (size_t i = 0; i < HAL_EEPROM_ROW_SIZE / 4u; i += 1)
+			data[i] = src[i];
+	}
+	if (memcmp(wear_row(row), data, HAL_EEPROM_ROW_SIZE) == 0)
+		return WEAR_ROW_SAME;
+	if (!hal_eeprom_write_row(WEAR_FIRST_ROW + row, (const uint8_t *)data))
+		return WEAR_ROW_FAILED;
+	return WEAR_ROW_WRITTEN;
+}
+
+/**
+ * Zero the counters of some chains
+ */
+usb_status_t wear_clear(uint8_t mask) {
+	uint8_t intr = hal_enter_critical();
+	for (uint8_t chain = 0; chain < NUM_CHAINS; chain += 1) {
+		if (mask & (1u << chain))
+			memset(counts[chain], 0, sizeof(counts[chain]));
+	}
+	hal_exit_critical(intr);
+	return wear_save();
+}
+
+/**
+ * Save all counters now
+ */
+usb_status_t wear_save(void) {
+	usb_status_t status = USB_SUCCESS;
+	dirty = 0;
+	next_row = WEAR_IDLE;
+	last_checkpoint = timebase_now();
+	for (uint16_t step = 0; step < WEAR_ROWS; step += 1) {
+		if (wear_sync_row(step) == WEAR_ROW_FAILED)
+			status = USB_OTHER_FAIL;
+	}
+	return status;
+}
+
+/**
+ * Step the checkpoint
+ */
+void wear_poll(void) {
+	if (next_row == WEAR_IDLE) {
+		if (!dirty || timebase_now() - last_checkpoint < WEAR_CHECKPOINT_TICKS)
+			return;
+		dirty = 0;
+		next_row = 0;
+		last_checkpoint = timebase_now();
+	}
+	// Skip over rows that are already up to date, and stop after the first
+	// write so the main loop isn't held up for long
+	while (next_row < WEAR_ROWS) {
+		uint8_t result = wear_sync_row(next_row);
+		next_row += 1;
+		if (result != WEAR_ROW_SAME)
+			break;
+	}
+	if (next_row >= WEAR_ROWS)
+		next_row = WEAR_IDLE;
+}
@@ -0,0 +1,101 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Sebastian Pauka
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __WEAR_H__
+#define __WEAR_H__
+
+#include <stdint.h>
+
+#include "hal.h"
+#include "preset.h"
+#include "switch.h"
+#include "usb_utils.h"
+
+/**
+ * Switch wear counters. Every time a frame is latched, it is compared with
+ * what the outputs held before, and the counter of each switch that changed
+ * state is incremented. The first frame latched after power up or a LOAD is
+ * only taken as the reference, as what the outputs held before it isn't
+ * known.
+ *
+ * Counters are checkpointed to EEPROM from the main loop, at most once every
+ * WEAR_CHECKPOINT_TICKS and one row per pass, with rows that haven't changed
+ * skipped. At one write per row every 10 minutes the EEPROM's endurance of
+ * a million writes lasts about 19 years of switching around the clock.
+ * Counts since the last checkpoint are lost at power off.
+ *
+ * EEPROM layout, from WEAR_FIRST_ROW (after the presets):
+ *      row 0: [WEAR_MAGIC] [NUM_SWITCHES]
+ *      rows 1 + WEAR_CHAIN_ROWS*n: counters of chain n, as u32 LE, 5 per
+ *          channel in mask bit order (E first)
+ * Chains that don't fit in the EEPROM are counted, but not saved.
+ */
+#define WEAR_MAGIC (0xA7u)
+#define WEAR_COUNTERS (NUM_SWITCHES * 5u) // Counters per chain
+#define WEAR_FIRST_ROW (PRESET_FIRST_ROW + PRESET_ROWS)
+#define WEAR_CHAIN_ROWS ((WEAR_COUNTERS * 4u) / HAL_EEPROM_ROW_SIZE)
+#define WEAR_FIT_CHAINS ((WEAR_FIRST_ROW + 1u + WEAR_CHAIN_ROWS <= HAL_EEPROM_ROWS) ? (HAL_EEPROM_ROWS - WEAR_FIRST_ROW - 1u) / WEAR_CHAIN_ROWS : 0u)
+#define WEAR_SAVED_CHAINS ((NUM_CHAINS < WEAR_FIT_CHAINS) ? NUM_CHAINS : WEAR_FIT_CHAINS)
+#define WEAR_CHECKPOINT_TICKS (600000u) // 10 minutes
+
+/**
+ * Load the counters saved in EEPROM. The EEPROM must have been started
+ * (preset_init).
+ */
+void wear_init(void);
+
+/**
+ * Count the switches changed by latching a frame on a chain. Called from
+ * the output interrupt.
+ */
+void wear_latch(uint8_t chain, const uint8_t *frame);
+
+/**
+ * Forget what the outputs of the chains in the mask hold, i.e. after
+ * latching shift register contents that aren't known
+ */
+void wear_forget(uint8_t mask);
+
+/**
+ * Return the counters of a chain, 5 per channel in mask bit order
+ */
+const uint32_t *wear_counts(uint8_t chain);
+
+/**
+ * Zero the counters of the chains in the mask, and save them
+ */
+usb_status_t wear_clear(uint8_t mask);
+
+/**
+ * Save all counters that have changed now
+ */
+usb_status_t wear_save(void);
+
+/**
+ * Continue a checkpoint, or start one if it is due. Called from the main
+ * loop, and programs at most one EEPROM row per call.
+ */
+void wear_poll(void);
+
+#endif